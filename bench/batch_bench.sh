@@ -0,0 +1,38 @@
+# Wall clock of N one-shot runs, one process per frame, against a single
+# batch run rendering the same N frames, and the batch again with the
+# command buffers recorded once (PRERECORDED). Needs the shaders built by
+# ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+frames=${1:-200}
+
+build_main batch_bench.bin || exit 1
+build_main batch_bench_prerecorded.bin -DPRERECORDED=1 || exit 1
+
+# Slide the triangle across the image, one offset per frame.
+for i in $(seq 0 $((frames - 1))); do
+    echo "vertex_offset=$(echo "scale=4; $i / $frames - 0.5" | bc),0,0,0"
+done > batch_bench.txt
+
+echo "== $frames one-shot runs"
+start=$(date +%s.%N)
+for i in $(seq 1 $frames); do
+    ./batch_bench.bin > /dev/null || exit 1
+done
+end=$(date +%s.%N)
+echo "$frames frames in $(echo "$end - $start" | bc) s, $(echo "scale=1; $frames / ($end - $start)" | bc) frames/s"
+
+echo "== one batch of $frames frames"
+start=$(date +%s.%N)
+./batch_bench.bin batch_bench.txt | grep -E "setup:|recording:|frames/s"
+end=$(date +%s.%N)
+echo "$frames frames in $(echo "$end - $start" | bc) s including setup"
+
+echo "== one batch of $frames frames, prerecorded"
+start=$(date +%s.%N)
+./batch_bench_prerecorded.bin batch_bench.txt | grep -E "setup:|recording:|frames/s"
+end=$(date +%s.%N)
+echo "$frames frames in $(echo "$end - $start" | bc) s including setup"
+
+rm -f batch_bench.bin batch_bench_prerecorded.bin batch_bench.txt results.csv output.ppm output_*.ppm
@@ -0,0 +1,24 @@
+gcc -O2 -o image_writer_bench.bin image_writer_bench.c ../image_writer.c -pthread -lz
+gcc -O2 -o image_format_bench.bin image_format_bench.c ../image_writer.c -pthread -lz
+
+./image_writer_bench.bin
+./image_format_bench.bin
+
+sh readback_bench.sh
+sh readback_to_file_bench.sh
+sh rle_readback_bench.sh
+sh host_image_copy_bench.sh
+sh batch_bench.sh
+sh render_server_bench.sh
+sh frames_in_flight_bench.sh
+sh pipeline_cache_bench.sh
+sh shader_load_bench.sh
+sh pipeline_threads_bench.sh
+sh pipeline_variants_bench.sh
+sh secondary_recording_bench.sh
+sh render_pool_bench.sh
+sh check_reduction_bench.sh
+sh palette_classify_bench.sh
+sh image_stats_bench.sh
+sh occlusion_check_bench.sh
+sh subpass_check_bench.sh
@@ -0,0 +1,15 @@
+# GPU time of check.comp against resolution: one atomic per pixel (the
+# original kernel), one per workgroup, and per-workgroup partials added up by
+# a second pass, 256x256 to 4096x4096.
+# Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+for size in 256 512 1024 2048 4096; do
+    for reduction in 0 1 2; do
+        echo "== ${size}x${size}, CHECK_REDUCTION=$reduction"
+        bench_main check_reduction_bench.bin "^check:|^Frame 0 Compute" \
+            -DIMAGE_WIDTH=$size -DIMAGE_HEIGHT=$size -DFRAME_COUNT=8 -DCHECK_REDUCTION=$reduction
+    done
+done
+rm -f check_reduction_bench.bin
@@ -0,0 +1,30 @@
+# Sourced by the bench scripts once they are in the repository root: the one
+# place that knows how the samples are built.
+
+MAIN_SOURCES="main.c image_writer.c pipeline_cache.c pipeline_variants.c shader_code.c"
+RENDER_POOL_SOURCES="render_pool.c image_writer.c pipeline_cache.c shader_code.c"
+
+# build_main OUT [FLAGS...]: main.c into OUT, built with FLAGS (-D...).
+build_main() {
+    out=$1
+    shift
+    gcc -O2 -pthread "$@" -o $out $MAIN_SOURCES -lvulkan -lz
+}
+
+# build_render_pool OUT [FLAGS...]: render_pool.c the same way.
+build_render_pool() {
+    out=$1
+    shift
+    gcc -O2 -pthread "$@" -o $out $RENDER_POOL_SOURCES -lvulkan -lz
+}
+
+# bench_main OUT FILTER [FLAGS...]: build main.c with FLAGS, run it once and
+# print the lines matching the extended regex FILTER. Exits on a build error.
+bench_main() {
+    out=$1
+    filter=$2
+    shift 2
+    build_main $out "$@" || exit 1
+    ./$out | grep -E "$filter"
+    rm -f output_*.ppm output_*.pam
+}
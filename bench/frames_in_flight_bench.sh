@@ -0,0 +1,14 @@
+# Throughput and per-frame latency with 1 to 4 frames in flight. Latency is
+# measured from recording a frame until the writer thread is done with it.
+# Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+for size in 1024 4096; do
+    for inflight in 1 2 3 4; do
+        echo "== ${size}x${size} FRAMES_IN_FLIGHT=$inflight"
+        bench_main frames_in_flight_bench.bin "frames/s|writer thread|latency:" \
+            -DIMAGE_WIDTH=$size -DIMAGE_HEIGHT=$size -DFRAME_COUNT=32 -DFRAMES_IN_FLIGHT=$inflight
+    done
+done
+rm -f frames_in_flight_bench.bin
@@ -0,0 +1,18 @@
+# Readback latency and peak memory of vkCopyImageToMemoryEXT against the
+# staging buffer path. On lavapipe device memory is host memory, so the
+# maximum RSS covers the staging buffers too. Needs the shaders built by
+# ../build.sh and GNU time.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+for size in 1024 4096 8192; do
+    for hic in 0 1; do
+        build_main host_image_copy_bench.bin \
+            -DIMAGE_WIDTH=$size -DIMAGE_HEIGHT=$size -DFRAME_COUNT=8 -DHOST_IMAGE_COPY=$hic || exit 1
+        echo "== ${size}x${size} HOST_IMAGE_COPY=$hic"
+        /usr/bin/time -v ./host_image_copy_bench.bin 2>&1 |
+            grep -E "frames/s|writer thread|readback via|host image copy:|not usable|Maximum resident"
+        rm -f output_*.ppm
+    done
+done
+rm -f host_image_copy_bench.bin
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "../image_writer.h"
+
+// Throughput and output size of every format the shared writer supports, on
+// a synthetic frame that looks like what the samples render: a gradient
+// background with flat shaded triangles on top.
+//
+// usage: image_format_bench.bin [max_size] [output_dir]
+// IMAGE_WRITER_THREADS limits the PNG thread pool.
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void
+render_frame(uint8_t *rgba, uint32_t size)
+{
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            uint8_t *pixel = rgba + ((size_t)y * size + x) * 4;
+            // Inside a triangle pointing up, one per quarter of the image.
+            uint32_t cx = x % (size / 2), cy = y % (size / 2);
+            int inside = cy > size / 8 && 2 * (cx > size / 4 ? cx - size / 4 : size / 4 - cx) < cy - size / 8;
+
+            pixel[0] = inside ? 0 : x * 255 / size;
+            pixel[1] = inside ? 255 : y * 255 / size;
+            pixel[2] = inside ? (x < size / 2 ? 0 : 255) : 64;
+            pixel[3] = 255;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    static const ImageFileFormat formats[] = {
+        IMAGE_FILE_PPM, IMAGE_FILE_PAM, IMAGE_FILE_QOI, IMAGE_FILE_PNG,
+    };
+    uint32_t max_size = argc > 1 ? atoi(argv[1]) : 8192;
+    const char *dir = argc > 2 ? argv[2] : ".";
+
+    printf("%8s %6s %12s %12s %12s %8s\n", "size", "format", "ms", "MB/s", "bytes", "ratio");
+
+    for (uint32_t size = 256; size <= max_size; size *= 2) {
+        size_t pixel_count = (size_t)size * size;
+        uint8_t *rgba = malloc(pixel_count * 4);
+        int reps = size <= 1024 ? 10 : size <= 4096 ? 3 : 1;
+        size_t ppm_size = 0;
+
+        if (!rgba) {
+            fprintf(stderr, "Out of memory at %ux%u\n", size, size);
+            return -1;
+        }
+        render_frame(rgba, size);
+
+        for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+            const char *ext = image_writer_format_extension(formats[f]);
+            char path[4096];
+            double best = 1e30;
+            struct stat st;
+
+            snprintf(path, sizeof(path), "%s/bench_format.%s", dir, ext);
+            for (int r = 0; r < reps; r++) {
+                double start = now_ms();
+                if (image_writer_write(path, rgba, IMAGE_PIXEL_RGBA8, formats[f], size, size, 0))
+                    return -1;
+                double elapsed = now_ms() - start;
+                if (elapsed < best)
+                    best = elapsed;
+            }
+            if (stat(path, &st))
+                return -1;
+            if (formats[f] == IMAGE_FILE_PPM)
+                ppm_size = st.st_size;
+
+            // MB/s of input pixels, so the formats are compared on equal work.
+            printf("%8u %6s %12.2f %12.1f %12lld %7.3fx\n", size, ext, best,
+                   pixel_count * 4 / (best * 1000.0), (long long)st.st_size,
+                   (double)st.st_size / ppm_size);
+            remove(path);
+        }
+
+        free(rgba);
+    }
+    return 0;
+}
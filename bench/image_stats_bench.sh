@@ -0,0 +1,12 @@
+# GPU time of stats.comp against resolution, 256x256 to 4096x4096, and the
+# bytes read back for the statistics instead of the image.
+# Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+for size in 256 512 1024 2048 4096; do
+    echo "== ${size}x${size}"
+    bench_main image_stats_bench.bin "^stats:|^Frame 0 [RGBA]:" \
+        -DIMAGE_WIDTH=$size -DIMAGE_HEIGHT=$size -DFRAME_COUNT=8 -DIMAGE_STATS=1
+done
+rm -f image_stats_bench.bin
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../image_writer.h"
+
+// Compares the per-pixel fwrite() loop every sample used to carry with the
+// shared image writer, from 256x256 up to 16384x16384.
+//
+// usage: image_writer_bench.bin [max_size] [output_dir]
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// The loop from main.c step 12 before the shared writer existed.
+static int
+write_ppm_legacy(const char *path, const uint8_t *data, uint32_t width, uint32_t height)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+
+    fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            const uint8_t *pixel = data + ((size_t)y * width + x) * 4;
+            fwrite(pixel, 1, 3, fp);
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int
+files_match(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    char bufa[1 << 16], bufb[1 << 16];
+    int match = fa && fb;
+
+    while (match) {
+        size_t na = fread(bufa, 1, sizeof(bufa), fa);
+        size_t nb = fread(bufb, 1, sizeof(bufb), fb);
+        if (na != nb || memcmp(bufa, bufb, na))
+            match = 0;
+        if (na == 0)
+            break;
+    }
+    if (fa)
+        fclose(fa);
+    if (fb)
+        fclose(fb);
+    return match;
+}
+
+int main(int argc, char **argv) {
+    uint32_t max_size = argc > 1 ? atoi(argv[1]) : 16384;
+    const char *dir = argc > 2 ? argv[2] : ".";
+    char legacy_path[4096], writer_path[4096];
+
+    snprintf(legacy_path, sizeof(legacy_path), "%s/bench_legacy.ppm", dir);
+    snprintf(writer_path, sizeof(writer_path), "%s/bench_writer.ppm", dir);
+
+    printf("%8s %12s %12s %12s %10s %8s\n",
+           "size", "legacy ms", "writer ms", "repack ms", "writer MB/s", "speedup");
+
+    for (uint32_t size = 256; size <= max_size; size *= 2) {
+        size_t pixel_count = (size_t)size * size;
+        uint8_t *rgba = malloc(pixel_count * 4);
+        uint8_t *rgb = malloc(pixel_count * 3);
+        int reps = size <= 1024 ? 10 : size <= 4096 ? 3 : 1;
+        double legacy = 1e30, writer = 1e30, repack = 1e30;
+
+        if (!rgba || !rgb) {
+            fprintf(stderr, "Out of memory at %ux%u\n", size, size);
+            return -1;
+        }
+        for (size_t i = 0; i < pixel_count * 4; i++)
+            rgba[i] = (uint8_t)(i * 2654435761u >> 13);
+
+        for (int r = 0; r < reps; r++) {
+            double start = now_ms();
+            if (write_ppm_legacy(legacy_path, rgba, size, size))
+                return -1;
+            double mid = now_ms();
+            if (image_writer_write_ppm(writer_path, rgba, IMAGE_PIXEL_RGBA8, size, size, 0))
+                return -1;
+            double end = now_ms();
+            image_writer_rgba_to_rgb(rgb, rgba, pixel_count);
+            double repacked = now_ms();
+
+            if (mid - start < legacy)
+                legacy = mid - start;
+            if (end - mid < writer)
+                writer = end - mid;
+            if (repacked - end < repack)
+                repack = repacked - end;
+        }
+
+        if (!files_match(legacy_path, writer_path)) {
+            fprintf(stderr, "Output mismatch at %ux%u\n", size, size);
+            return -1;
+        }
+
+        printf("%8u %12.2f %12.2f %12.2f %10.1f %7.1fx\n", size, legacy, writer, repack,
+               pixel_count * 3 / (writer * 1000.0), legacy / writer);
+
+        free(rgba);
+        free(rgb);
+    }
+
+    remove(legacy_path);
+    remove(writer_path);
+    return 0;
+}
@@ -0,0 +1,14 @@
+# Cost of the triangle check: check.comp, the occlusion query alone, and both
+# compared frame by frame, 256x256 to 4096x4096.
+# Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+for size in 256 1024 4096; do
+    for mode in 0 1 2; do
+        echo "== ${size}x${size}, OCCLUSION_CHECK=$mode"
+        bench_main occlusion_check_bench.bin "^check:|^occlusion query:|^latency:|^Frame 0 Compute" \
+            -DIMAGE_WIDTH=$size -DIMAGE_HEIGHT=$size -DFRAME_COUNT=16 -DOCCLUSION_CHECK=$mode
+    done
+done
+rm -f occlusion_check_bench.bin
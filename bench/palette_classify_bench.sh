@@ -0,0 +1,19 @@
+# GPU time of classify.comp against the palette size, 1 to 256 classes, with
+# counts only and with bounding boxes, at 1024x1024. The palettes are gray
+# ramps so most pixels test every class before they match or not.
+# Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+for classes in 1 4 16 64 256; do
+    awk -v n=$classes 'BEGIN { for (i = 0; i < n; i++) printf "color=%f,%f,%f tolerance=0.002\n", i / n, i / n, i / n }' \
+        > palette_bench.txt
+    for mode in 1 2; do
+        build_main palette_classify_bench.bin -DIMAGE_WIDTH=1024 -DIMAGE_HEIGHT=1024 -DFRAME_COUNT=8 \
+            -DPALETTE_CLASSIFY=$mode || exit 1
+        echo "== $classes classes, PALETTE_CLASSIFY=$mode"
+        PALETTE=palette_bench.txt ./palette_classify_bench.bin | grep -E "^check:|^classify:|^Frame 0 classes"
+        rm -f output_*.ppm
+    done
+done
+rm -f palette_classify_bench.bin palette_bench.txt
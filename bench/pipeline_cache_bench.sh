@@ -0,0 +1,21 @@
+# Cold against warm start of every sample: the first run compiles its
+# pipelines into an empty cache directory, the second one loads them back.
+# Needs the samples built by their build scripts.
+cd "$(dirname "$0")/.."
+
+export PIPELINE_CACHE_DIR=$(mktemp -d)
+
+for sample in ./main.bin ./bindless.bin clear-attachment/main.bin indirect-draw/main.bin mesh/main.bin \
+              query-pool/main.bin ray_traicing/vulkan_test spill_fill_compute/spill_fill.bin \
+              spill_fill_vertex/spill_fill.bin; do
+    [ -x $sample ] || { echo "== $sample not built, skipped"; continue; }
+    echo "== $sample"
+    for run in cold warm; do
+        start=$(date +%s.%N)
+        (cd $(dirname $sample) && ./$(basename $sample) | grep -E "^pipeline cache:")
+        end=$(date +%s.%N)
+        echo "$run run: $(echo "($end - $start) * 1000" | bc) ms wall clock"
+    done
+done
+
+rm -rf $PIPELINE_CACHE_DIR
@@ -0,0 +1,18 @@
+# Startup against the number of cores: main.bin with the RLE readback (five
+# pipelines) pinned to 1, 2, 4, ... CPUs with one pipeline worker per CPU, and
+# the pipeline cache off so every pipeline goes through lavapipe's compiler.
+# Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+build_main pipeline_threads_bench.bin -DRLE_READBACK=1 || exit 1
+
+cpus=1
+while [ $cpus -le $(nproc) ]; do
+    echo "== $cpus CPUs"
+    PIPELINE_CACHE=0 PIPELINE_THREADS=$cpus taskset -c 0-$((cpus - 1)) ./pipeline_threads_bench.bin |
+        grep -E "^pipeline cache:|^setup:|^first pipeline:"
+    cpus=$((cpus * 2))
+done
+
+rm -f pipeline_threads_bench.bin output.ppm
@@ -0,0 +1,23 @@
+# Variant-creation latency: 36 frames through the 18 pipeline variants with
+# full pipelines, fast-linked pipeline libraries (with and without the
+# optimized builds in the background) and shader objects, against a cold
+# and a warm pipeline cache. A backend the driver lacks says so and falls
+# back. Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+export PIPELINE_CACHE_DIR=$(mktemp -d)
+for backend in 1 2 3; do
+    build_main pipeline_variants_bench.bin -DPIPELINE_VARIANTS=$backend -DFRAME_COUNT=36 || exit 1
+    for optimize in 1 0; do
+        [ $backend = 2 ] || [ $optimize = 1 ] || continue
+        rm -f "$PIPELINE_CACHE_DIR"/*.pipeline_cache
+        for run in cold warm; do
+            echo "== PIPELINE_VARIANTS=$backend PIPELINE_VARIANTS_OPTIMIZE=$optimize, $run"
+            PIPELINE_VARIANTS_OPTIMIZE=$optimize ./pipeline_variants_bench.bin |
+                grep -E "not supported|^pipeline variants:|^pipeline cache:|frames/s|^recording:"
+            rm -f output_*.ppm
+        done
+    done
+done
+rm -rf "$PIPELINE_CACHE_DIR" pipeline_variants_bench.bin
@@ -0,0 +1,13 @@
+# Readback cost of the RGBA8 copy against the PACK_RGB24 compute pack, at
+# growing resolutions. Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+for size in 1024 4096 8192; do
+    for pack in 0 1; do
+        echo "== ${size}x${size} PACK_RGB24=$pack"
+        bench_main readback_bench.bin "frames/s|writer thread|readback via|^readback:" \
+            -DIMAGE_WIDTH=$size -DIMAGE_HEIGHT=$size -DFRAME_COUNT=8 -DPACK_RGB24=$pack
+    done
+done
+rm -f readback_bench.bin
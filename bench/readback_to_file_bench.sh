@@ -0,0 +1,14 @@
+# Readback through the staging buffer and write() against READBACK_TO_FILE
+# copying straight into the imported output file: bytes through the CPU and
+# time per frame, at growing resolutions. Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+for size in 1024 4096 8192; do
+    for import in 0 1; do
+        echo "== ${size}x${size} READBACK_TO_FILE=$import"
+        bench_main readback_to_file_bench.bin "frames/s|writer thread|readback via|^readback:" \
+            -DIMAGE_WIDTH=$size -DIMAGE_HEIGHT=$size -DFRAME_COUNT=8 -DREADBACK_TO_FILE=$import
+    done
+done
+rm -f readback_to_file_bench.bin
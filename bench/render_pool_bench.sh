@@ -0,0 +1,18 @@
+# Jobs/s against the number of render contexts: 256 jobs on 1, 2, 4, ...
+# 2 x nproc contexts, each with as many queues as the device gives it, then
+# again with every context on one shared queue.
+# Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+build_render_pool render_pool_bench.bin || exit 1
+
+for queues in "" 1; do
+    contexts=1
+    while [ $contexts -le $(($(nproc) * 2)) ]; do
+        echo "== RENDER_CONTEXTS=$contexts${queues:+ RENDER_QUEUES=$queues}"
+        RENDER_CONTEXTS=$contexts RENDER_QUEUES=$queues ./render_pool_bench.bin 256 | grep -E "jobs/s|^per job|^work stealing"
+        contexts=$((contexts * 2))
+    done
+done
+rm -f render_pool_bench.bin output_pool_*
@@ -0,0 +1,21 @@
+# Per-request latency of a warm `main.bin --serve` against spawning main.bin
+# for every frame. Needs the shaders and binaries built by ../build.sh.
+cd "$(dirname "$0")/.."
+
+requests=${1:-200}
+socket=/tmp/render_server_bench.sock
+
+for output in none shm file; do
+    ./main.bin --serve $socket > /dev/null &
+    server=$!
+    while [ ! -S $socket ]; do sleep 0.1; done
+
+    echo "== output $output"
+    if [ $output = none ]; then
+        ./render_client.bin -n $requests -o $output -s ./main.bin -q $socket
+    else
+        ./render_client.bin -n $requests -o $output -q $socket
+    fi
+    wait $server
+done
+rm -f client_*.ppm output.ppm
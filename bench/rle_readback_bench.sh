@@ -0,0 +1,14 @@
+# Readback cost of the RGBA8 staging copy against the RLE_READBACK runs, at
+# growing resolutions: GPU time of the readback commands, bytes read back and
+# the CPU decode. Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+for size in 1024 4096 8192; do
+    for rle in 0 1; do
+        echo "== ${size}x${size} RLE_READBACK=$rle"
+        bench_main rle_readback_bench.bin "frames/s|writer thread|^readback:|^RLE:" \
+            -DIMAGE_WIDTH=$size -DIMAGE_HEIGHT=$size -DFRAME_COUNT=8 -DRLE_READBACK=$rle
+    done
+done
+rm -f rle_readback_bench.bin
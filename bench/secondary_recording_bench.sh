@@ -0,0 +1,21 @@
+# Recording time against thread count for 1k to 1M draws per frame: the
+# draws recorded inline on the render loop's thread, then split across 1, 2,
+# 4, ... recording threads into secondary command buffers.
+# Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+for draws in 1000 10000 100000 1000000; do
+    echo "== $draws draws, inline"
+    bench_main secondary_recording_bench.bin "^recording:" -DDRAW_COUNT=$draws -DFRAME_COUNT=8
+
+    build_main secondary_recording_bench.bin -DDRAW_COUNT=$draws -DFRAME_COUNT=8 -DSECONDARY_RECORDING=1 || exit 1
+    threads=1
+    while [ $threads -le $(nproc) ]; do
+        echo "== $draws draws, RECORD_THREADS=$threads"
+        RECORD_THREADS=$threads ./secondary_recording_bench.bin | grep -E "^recording"
+        threads=$((threads * 2))
+    done
+    rm -f output_*.ppm
+done
+rm -f secondary_recording_bench.bin
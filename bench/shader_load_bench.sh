@@ -0,0 +1,22 @@
+# Time from process start to the first pipeline, with the shaders embedded in
+# main.bin against mapping them from SHADER_DIR, each with and without the
+# pipeline cache. Needs the shaders and main.bin built by ../build.sh.
+cd "$(dirname "$0")/.."
+
+runs=${1:-20}
+
+export PIPELINE_CACHE_DIR=$(mktemp -d)
+./main.bin > /dev/null # fill the pipeline cache
+
+for cache in 1 0; do
+    for shaders in embedded mapped; do
+        [ $shaders = mapped ] && dir=. || dir=
+        echo "== shaders $shaders, PIPELINE_CACHE=$cache"
+        for i in $(seq 1 $runs); do
+            PIPELINE_CACHE=$cache SHADER_DIR=$dir ./main.bin | grep "^first pipeline:"
+        done | awk '{ total += $3; if (min == "" || $3 < min) min = $3 }
+                    END { printf "%d runs, mean %.2f ms, min %.2f ms\n", NR, total / NR, min }'
+    done
+done
+
+rm -rf $PIPELINE_CACHE_DIR output.ppm
@@ -0,0 +1,15 @@
+# GPU time of the render pass and the check together: check.comp after the
+# render pass against check_subpass.frag as its second subpass, 256x256 to
+# 4096x4096.
+# Needs the shaders built by ../build.sh.
+cd "$(dirname "$0")/.."
+. bench/common.sh
+
+for size in 256 1024 4096; do
+    for subpass in 0 1; do
+        echo "== ${size}x${size}, SUBPASS_CHECK=$subpass"
+        bench_main subpass_check_bench.bin "^render pass \+ check:|^check:|^Frame 0 Compute" \
+            -DIMAGE_WIDTH=$size -DIMAGE_HEIGHT=$size -DFRAME_COUNT=16 -DSUBPASS_CHECK=$subpass
+    done
+done
+rm -f subpass_check_bench.bin
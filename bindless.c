@@ -4,6 +4,16 @@
 #include <string.h>
 #include <assert.h>
 
+#include "image_writer.h"
+#include "pipeline_cache.h"
+#include "shader_code.h"
+
+// Compiled in by build_bindless.sh
+#include "bindless.vert.spv.h"
+#include "bindless.frag.spv.h"
+static const ShaderCode vertShader = SHADER_CODE("bindless.vert.spv", bindless_vert_spv);
+static const ShaderCode fragShader = SHADER_CODE("bindless.frag.spv", bindless_frag_spv);
+
 #define WIDTH 800
 #define HEIGHT 600
 #define BINDLESS_ARRAY_SIZE 10
@@ -11,19 +21,6 @@
 // Helper to check results
 #define CHECK_VK(f) { VkResult r = (f); if (r != VK_SUCCESS) { printf("Fatal : VkResult is %d in %s at line %d\n", r, __FILE__, __LINE__); exit(1); } }
 
-// Helper to read binary file (SPV)
-static char* readFile(const char* filename, size_t* size) {
-    FILE* file = fopen(filename, "rb");
-    if (!file) { fprintf(stderr, "Failed to find %s\n", filename); exit(1); }
-    fseek(file, 0, SEEK_END);
-    *size = ftell(file);
-    rewind(file);
-    char* buffer = (char*)malloc(*size);
-    fread(buffer, 1, *size, file);
-    fclose(file);
-    return buffer;
-}
-
 // Find memory type index
 uint32_t getMemoryTypeIndex(VkPhysicalDevice phys, uint32_t typeBits, VkMemoryPropertyFlags properties) {
     VkPhysicalDeviceMemoryProperties memProps;
@@ -82,9 +79,18 @@ int main() {
     VkPhysicalDeviceFeatures deviceFeatures = {0};
     devInfo.pEnabledFeatures = &deviceFeatures;
 
+    // Per-pipeline compile times and cache hits in the report.
+    const char *feedbackExtension = pipeline_cache_feedback_extension(physDevice);
+    devInfo.enabledExtensionCount = feedbackExtension ? 1 : 0;
+    devInfo.ppEnabledExtensionNames = &feedbackExtension;
+
     VkDevice device;
     CHECK_VK(vkCreateDevice(physDevice, &devInfo, NULL, &device));
 
+    // Pipelines compiled by an earlier run come out of the cache file.
+    PipelineCache pipelineCache;
+    CHECK_VK(pipeline_cache_open(&pipelineCache, physDevice, device, "bindless", feedbackExtension != NULL));
+
     VkQueue queue;
     vkGetDeviceQueue(device, 0, 0, &queue);
 
@@ -275,16 +281,9 @@ int main() {
     // -------------------------------------------------------------------------
     // 7. Pipeline Setup
     // -------------------------------------------------------------------------
-    size_t vertSize, fragSize;
-    char* vertCode = readFile("bindless.vert.spv", &vertSize);
-    char* fragCode = readFile("bindless.frag.spv", &fragSize);
-
     VkShaderModule vertMod, fragMod;
-    VkShaderModuleCreateInfo shInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
-    shInfo.codeSize = vertSize; shInfo.pCode = (uint32_t*)vertCode;
-    vkCreateShaderModule(device, &shInfo, NULL, &vertMod);
-    shInfo.codeSize = fragSize; shInfo.pCode = (uint32_t*)fragCode;
-    vkCreateShaderModule(device, &shInfo, NULL, &fragMod);
+    CHECK_VK(shader_code_create_module(device, &vertShader, &vertMod));
+    CHECK_VK(shader_code_create_module(device, &fragShader, &fragMod));
 
     // Render Pass
     VkAttachmentDescription attDesc = {0};
@@ -367,7 +366,8 @@ int main() {
     gpInfo.renderPass = renderPass;
 
     VkPipeline pipeline;
-    CHECK_VK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &gpInfo, NULL, &pipeline));
+    CHECK_VK(pipeline_cache_create_graphics(&pipelineCache, "bindless", &gpInfo, &pipeline));
+    pipeline_cache_close(&pipelineCache);
 
     // Framebuffer
     VkFramebufferCreateInfo fbInfo = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
@@ -445,16 +445,8 @@ int main() {
     // Map and Write to PPM
     void* data;
     vkMapMemory(device, outBufferMem, 0, VK_WHOLE_SIZE, 0, &data);
-    uint8_t* pixels = (uint8_t*)data;
-
-    FILE* fout = fopen("output_bindless.ppm", "wb");
-    fprintf(fout, "P3\n%d %d\n255\n", WIDTH, HEIGHT);
-    for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        // Vulkan is usually BGRA or RGBA depending on format, R8G8B8A8 was requested
-        // PPM needs R G B integers
-        fprintf(fout, "%d %d %d ", pixels[i*4 + 0], pixels[i*4 + 1], pixels[i*4 + 2]);
-    }
-    fclose(fout);
+    // Vulkan is usually BGRA or RGBA depending on format, R8G8B8A8 was requested
+    image_writer_write_ppm("output_bindless.ppm", data, IMAGE_PIXEL_RGBA8, WIDTH, HEIGHT, 0);
     vkUnmapMemory(device, outBufferMem);
     printf("Render saved to output_bindless.ppm\n");
 
@@ -464,8 +456,6 @@ int main() {
     vkFreeMemory(device, renderImageMem, NULL);
     vkDestroyDevice(device, NULL);
     vkDestroyInstance(instance, NULL);
-    free(vertCode);
-    free(fragCode);
 
     return 0;
 }
\ No newline at end of file
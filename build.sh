@@ -1,12 +1,42 @@
-rm triangle.vert.spv
-rm triangle.frag.spv
-rm output.ppm
+rm -f triangle*.spv triangle*.spv.h check_subpass*.spv check_subpass*.spv.h *.comp.spv *.comp.spv.h
+rm -f output.ppm output.pam output.qoi output.png
+rm -f output_pool_*
 
-glslangValidator -V triangle.vert -o triangle.vert.spv
-glslangValidator -V triangle.frag -o triangle.frag.spv
-glslangValidator -V check.comp -o check.comp.spv
+# Every shader twice: as a header compiled into main.bin, and as a .spv file
+# that SHADER_DIR=. loads instead while working on the shaders.
+shader() {
+    out=$1
+    shift
+    glslangValidator -V "$@" -o $out
+    glslangValidator -V "$@" --vn $(echo $out | tr . _) -o $out.h
+}
 
-gcc -o main.bin main.c -lvulkan
+shader triangle.vert.spv triangle.vert
+shader triangle.frag.spv triangle.frag
+shader check.comp.spv check.comp
+shader triangle_ubo.vert.spv -DPARAMS_UBO triangle.vert
+shader check_ubo.comp.spv -DPARAMS_UBO check.comp
+# CHECK_REDUCTION=1 and 2 in main.c, subgroup operations need SPIR-V 1.3
+shader check_reduce.comp.spv --target-env vulkan1.1 -DREDUCE -DSUBGROUP check.comp
+shader check_reduce_shared.comp.spv -DREDUCE check.comp
+shader check_partials.comp.spv --target-env vulkan1.1 -DREDUCE -DSUBGROUP -DPARTIALS check.comp
+shader check_partials_shared.comp.spv -DREDUCE -DPARTIALS check.comp
+shader check_sum.comp.spv check_sum.comp
+shader pack_rgb.comp.spv pack_rgb.comp
+shader rle_count.comp.spv rle_count.comp
+shader rle_scan.comp.spv rle_scan.comp
+shader rle_emit.comp.spv rle_emit.comp
+shader tile_diff.comp.spv tile_diff.comp
+shader classify.comp.spv classify.comp
+shader stats.comp.spv stats.comp
+# SUBPASS_CHECK=1 in main.c
+shader check_subpass.vert.spv check_subpass.vert
+shader check_subpass.frag.spv --target-env vulkan1.1 -DSUBGROUP check_subpass.frag
+shader check_subpass_atomic.frag.spv check_subpass.frag
+
+gcc -O2 -pthread -o main.bin main.c image_writer.c pipeline_cache.c pipeline_variants.c shader_code.c -lvulkan -lz
+gcc -O2 -o render_client.bin render_client.c
+gcc -O2 -pthread -o render_pool.bin render_pool.c image_writer.c pipeline_cache.c shader_code.c -lvulkan -lz
 
 ./main.bin
 eog output.ppm &
\ No newline at end of file
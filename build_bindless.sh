@@ -1,11 +1,13 @@
-rm bindless.vert.spv
-rm bindless.frag.spv
+rm -f bindless.vert.spv bindless.vert.spv.h
+rm -f bindless.frag.spv bindless.frag.spv.h
 rm output_bindless.ppm
 
 glslangValidator -V bindless.vert -o bindless.vert.spv
 glslangValidator -V bindless.frag -o bindless.frag.spv
+glslangValidator -V bindless.vert --vn bindless_vert_spv -o bindless.vert.spv.h
+glslangValidator -V bindless.frag --vn bindless_frag_spv -o bindless.frag.spv.h
 
-gcc -o bindless.bin bindless.c -lvulkan
+gcc -O2 -o bindless.bin bindless.c image_writer.c pipeline_cache.c shader_code.c -lvulkan -pthread -lz
 
 ./bindless.bin
 eog output_bindless.ppm &
\ No newline at end of file
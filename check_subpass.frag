@@ -0,0 +1,58 @@
+#version 450
+
+// SUBPASS_CHECK in main.c: check.comp as the second subpass of the render
+// pass. The pixel comes from the color attachment of the first subpass as an
+// input attachment, so on a tiler it never leaves the tile. With SUBGROUP
+// the subgroup adds its counts with subgroupAdd() and one invocation does
+// the atomics, like check.comp's REDUCE; otherwise every pixel does.
+#ifdef SUBGROUP
+#extension GL_KHR_shader_subgroup_arithmetic : require
+#extension GL_KHR_shader_subgroup_ballot : require
+#endif
+
+// Binding 0: the color the first subpass rendered, at this pixel
+layout (input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput inputColor;
+
+// Binding 1: The output buffer for the result
+layout (set = 0, binding = 1, std430) buffer ResultBuffer {
+    uint triangle;
+    uint backgroud;
+    uint total;
+    uint test;
+} res;
+
+// Push constant block matching the C struct for correct layout
+layout(push_constant) uniform PushConstants {
+    vec4 positions[3];
+    vec4 color;
+    vec4 vertex_offset;
+    vec4 color_offset;
+    uint test;
+    uint use_buffer;
+} push_consts;
+
+void main() {
+    vec4 color = subpassLoad(inputColor) - push_consts.color_offset;
+
+    // Check if the pixel color is very close to the target color from the push constant.
+    bool inTriangle = distance(color.rgb, push_consts.color.rgb) < 0.1;
+    uvec4 mine = uvec4(inTriangle ? 1 : 0, inTriangle ? 0 : 1, 1, push_consts.test == 24 ? 1 : 0);
+#ifdef SUBGROUP
+    // Helper invocations add nothing and must not be the one whose atomics
+    // are dropped.
+    if (gl_HelperInvocation)
+        mine = uvec4(0);
+    uvec4 sums = subgroupAdd(mine);
+    if (subgroupBallotFindLSB(subgroupBallot(!gl_HelperInvocation)) == gl_SubgroupInvocationID) {
+        atomicAdd(res.triangle, sums.x);
+        atomicAdd(res.backgroud, sums.y);
+        atomicAdd(res.total, sums.z);
+        atomicAdd(res.test, sums.w);
+    }
+#else
+    atomicAdd(res.triangle, mine.x);
+    atomicAdd(res.backgroud, mine.y);
+    atomicAdd(res.total, mine.z);
+    atomicAdd(res.test, mine.w);
+#endif
+}
@@ -1,4 +1,6 @@
 glslangValidator -V shader.vert -o vert.spv
 glslangValidator -V shader.frag -o frag.spv
+glslangValidator -V shader.vert --vn vert_spv -o vert.spv.h
+glslangValidator -V shader.frag --vn frag_spv -o frag.spv.h
 
-gcc -o main.bin main.c -lvulkan
+gcc -O2 -o main.bin main.c ../image_writer.c ../pipeline_cache.c ../shader_code.c -lvulkan -pthread -lz
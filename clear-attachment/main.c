@@ -4,6 +4,16 @@
 #include <string.h>
 #include <assert.h>
 
+#include "../image_writer.h"
+#include "../pipeline_cache.h"
+#include "../shader_code.h"
+
+// Compiled in by build.sh
+#include "vert.spv.h"
+#include "frag.spv.h"
+static const ShaderCode vert_shader = SHADER_CODE("vert.spv", vert_spv);
+static const ShaderCode frag_shader = SHADER_CODE("frag.spv", frag_spv);
+
 #define WIDTH 512
 #define HEIGHT 512
 
@@ -16,19 +26,6 @@
     } \
 }
 
-// Utility to read SPIR-V files
-char* read_shader(const char* filename, size_t* size) {
-    FILE* f = fopen(filename, "rb");
-    if (!f) return NULL;
-    fseek(f, 0, SEEK_END);
-    *size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    char* buffer = malloc(*size);
-    fread(buffer, 1, *size, f);
-    fclose(f);
-    return buffer;
-}
-
 uint32_t find_memory_type(VkPhysicalDevice physical_device, uint32_t type_filter, VkMemoryPropertyFlags properties) {
     VkPhysicalDeviceMemoryProperties mem_props;
     vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_props);
@@ -65,14 +62,23 @@ int main() {
         .pQueuePriorities = &queue_priority
     };
 
+    // Per-pipeline compile times and cache hits in the report.
+    const char *feedback_extension = pipeline_cache_feedback_extension(physical_device);
+
     VkDevice device;
     VkDeviceCreateInfo device_create_info = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = &queue_create_info
+        .pQueueCreateInfos = &queue_create_info,
+        .enabledExtensionCount = feedback_extension ? 1 : 0,
+        .ppEnabledExtensionNames = &feedback_extension
     };
     VK_CHECK(vkCreateDevice(physical_device, &device_create_info, NULL, &device));
 
+    // Pipelines compiled by an earlier run come out of the cache file.
+    PipelineCache pipeline_cache;
+    VK_CHECK(pipeline_cache_open(&pipeline_cache, physical_device, device, "clear-attachment", feedback_extension != NULL));
+
     VkQueue queue;
     vkGetDeviceQueue(device, graphics_queue_index, 0, &queue);
 
@@ -137,16 +143,9 @@ int main() {
     VK_CHECK(vkCreateFramebuffer(device, &fb_info, NULL, &framebuffer));
 
     // --- Pipeline ---
-    size_t vert_size, frag_size;
-    char *vert_code = read_shader("vert.spv", &vert_size);
-    char *frag_code = read_shader("frag.spv", &frag_size);
-    assert(vert_code && frag_code && "Failed to read shaders! Compile them to vert.spv and frag.spv.");
-
     VkShaderModule vert_module, frag_module;
-    VkShaderModuleCreateInfo vert_info = { .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO, .codeSize = vert_size, .pCode = (uint32_t*)vert_code };
-    VkShaderModuleCreateInfo frag_info = { .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO, .codeSize = frag_size, .pCode = (uint32_t*)frag_code };
-    vkCreateShaderModule(device, &vert_info, NULL, &vert_module);
-    vkCreateShaderModule(device, &frag_info, NULL, &frag_module);
+    VK_CHECK(shader_code_create_module(device, &vert_shader, &vert_module));
+    VK_CHECK(shader_code_create_module(device, &frag_shader, &frag_module));
 
     VkPipelineShaderStageCreateInfo shader_stages[] = {
         { .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, .stage = VK_SHADER_STAGE_VERTEX_BIT, .module = vert_module, .pName = "main" },
@@ -175,7 +174,8 @@ int main() {
         .layout = pipeline_layout, .renderPass = render_pass, .subpass = 0
     };
     VkPipeline pipeline;
-    VK_CHECK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, NULL, &pipeline));
+    VK_CHECK(pipeline_cache_create_graphics(&pipeline_cache, "clear-attachment", &pipeline_info, &pipeline));
+    pipeline_cache_close(&pipeline_cache);
 
     // --- Command Recording ---
     VkCommandBuffer cmd;
@@ -235,14 +235,8 @@ int main() {
     void* data;
     vkMapMemory(device, buf_memory, 0, WIDTH * HEIGHT * 4, 0, &data);
     
-    FILE* ppm = fopen("output.ppm", "wb");
-    fprintf(ppm, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
-    uint8_t* pixels = (uint8_t*)data;
-    for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        // Assuming R8G8B8A8, writing RGB
-        fwrite(&pixels[i * 4], 1, 3, ppm);
-    }
-    fclose(ppm);
+    // Assuming R8G8B8A8, writing RGB
+    image_writer_write_ppm("output.ppm", data, IMAGE_PIXEL_RGBA8, WIDTH, HEIGHT, 0);
     vkUnmapMemory(device, buf_memory);
 
     printf("Image written to output.ppm\n");
@@ -263,8 +257,6 @@ int main() {
     vkDestroyDevice(device, NULL);
     vkDestroyInstance(instance, NULL);
     
-    free(vert_code);
-    free(frag_code);
     free(physical_devices);
 
     return 0;
@@ -0,0 +1,880 @@
+#include "image_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMAGE_WRITER_X86 1
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// zlib level for the PNG stripes. Favours throughput, QOI-sized output is
+// already reached at level 1 for rendered frames.
+#ifndef IMAGE_WRITER_PNG_LEVEL
+#define IMAGE_WRITER_PNG_LEVEL 1
+#endif
+
+// Uncompressed bytes per PNG stripe, small enough to spread a single frame
+// over every core and large enough that the per-stripe flush is noise.
+#define PNG_STRIPE_BYTES (1 << 20)
+
+static void
+rgba_to_rgb_scalar(uint8_t *dst, const uint8_t *src, size_t pixel_count)
+{
+    for (size_t i = 0; i < pixel_count; i++) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst += 3;
+        src += 4;
+    }
+}
+
+#ifdef IMAGE_WRITER_X86
+// 16 pixels per iteration: every 16 byte load is shuffled down to 12 RGB
+// bytes and the four results are stitched into three full 16 byte stores,
+// so nothing is written past dst + pixel_count * 3.
+__attribute__((target("ssse3"))) static void
+rgba_to_rgb_ssse3(uint8_t *dst, const uint8_t *src, size_t pixel_count)
+{
+    const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t i = 0;
+
+    for (; i + 16 <= pixel_count; i += 16) {
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 0)), mask);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 16)), mask);
+        __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 32)), mask);
+        __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 48)), mask);
+
+        _mm_storeu_si128((__m128i *)(dst + 0), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128((__m128i *)(dst + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128((__m128i *)(dst + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+
+        src += 64;
+        dst += 48;
+    }
+
+    rgba_to_rgb_scalar(dst, src, pixel_count - i);
+}
+
+// 8 pixels per iteration: the in-lane shuffle leaves 12 bytes at the bottom
+// of each 128 bit lane and the cross-lane permute packs them into the low 24
+// bytes. Each 32 byte store overlaps the next one by 8 bytes, so the loop
+// stops while there is still room for that overhang and SSSE3 finishes.
+__attribute__((target("avx2"))) static void
+rgba_to_rgb_avx2(uint8_t *dst, const uint8_t *src, size_t pixel_count)
+{
+    const __m256i mask = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    size_t i = 0;
+
+    for (; i + 11 <= pixel_count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)src);
+        v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, mask), pack);
+        _mm256_storeu_si256((__m256i *)dst, v);
+
+        src += 32;
+        dst += 24;
+    }
+
+    rgba_to_rgb_ssse3(dst, src, pixel_count - i);
+}
+#endif
+
+typedef void (*rgba_to_rgb_func)(uint8_t *dst, const uint8_t *src, size_t pixel_count);
+
+static rgba_to_rgb_func
+select_rgba_to_rgb(void)
+{
+#ifdef IMAGE_WRITER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return rgba_to_rgb_avx2;
+    if (__builtin_cpu_supports("ssse3"))
+        return rgba_to_rgb_ssse3;
+#endif
+    return rgba_to_rgb_scalar;
+}
+
+void
+image_writer_rgba_to_rgb(uint8_t *dst, const uint8_t *src, size_t pixel_count)
+{
+    static rgba_to_rgb_func func;
+
+    if (!func)
+        func = select_rgba_to_rgb();
+    func(dst, src, pixel_count);
+}
+
+// Grow-only buffer reused across frames so the hot path does not pay for
+// fresh page faults on every image.
+static __thread uint8_t *scratch;
+static __thread size_t scratch_size;
+
+static uint8_t *
+get_scratch(size_t size)
+{
+    if (size > scratch_size) {
+        uint8_t *buffer = realloc(scratch, size);
+        if (!buffer)
+            return NULL;
+        scratch = buffer;
+        scratch_size = size;
+    }
+    return scratch;
+}
+
+// writev() may return early for very large payloads or on signals, keep going
+// until every iovec has been consumed.
+static int
+writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t ret = writev(fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return 0;
+}
+
+static int
+write_file(const char *path, struct iovec *iov, int iovcnt)
+{
+    int fd, ret;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s for writing: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    ret = writev_all(fd, iov, iovcnt);
+    if (ret)
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+
+    if (close(fd) && !ret) {
+        fprintf(stderr, "Failed to close %s: %s\n", path, strerror(errno));
+        ret = -1;
+    }
+    return ret;
+}
+
+int
+image_writer_write_ppm(const char *path, const void *pixels, ImagePixelFormat format,
+                       uint32_t width, uint32_t height, size_t stride)
+{
+    const size_t src_bpp = format == IMAGE_PIXEL_RGBA8 ? 4 : 3;
+    const size_t row_size = (size_t)width * 3;
+    const size_t payload_size = row_size * height;
+    const uint8_t *src = pixels;
+    const uint8_t *payload;
+    char header[64];
+    int header_len;
+
+    if (!stride)
+        stride = (size_t)width * src_bpp;
+
+    if (format == IMAGE_PIXEL_RGB8 && stride == row_size) {
+        // Already in file order, hand the mapping straight to the kernel.
+        payload = src;
+    } else {
+        uint8_t *dst = get_scratch(payload_size);
+        if (!dst) {
+            fprintf(stderr, "Failed to allocate %zu bytes for %s\n", payload_size, path);
+            return -1;
+        }
+
+        if (format == IMAGE_PIXEL_RGBA8 && stride == (size_t)width * 4) {
+            image_writer_rgba_to_rgb(dst, src, (size_t)width * height);
+        } else {
+            for (uint32_t y = 0; y < height; y++) {
+                if (format == IMAGE_PIXEL_RGBA8)
+                    image_writer_rgba_to_rgb(dst + y * row_size, src + y * stride, width);
+                else
+                    memcpy(dst + y * row_size, src + y * stride, row_size);
+            }
+        }
+        payload = dst;
+    }
+
+    header_len = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width, height);
+
+    struct iovec iov[2] = {
+        { .iov_base = header, .iov_len = header_len },
+        { .iov_base = (void *)payload, .iov_len = payload_size },
+    };
+    return write_file(path, iov, 2);
+}
+
+int
+image_writer_stream_open(ImageStream *stream, const char *path, uint32_t width, uint32_t height)
+{
+    char header[64];
+    int header_len = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width, height);
+    struct iovec iov = { .iov_base = header, .iov_len = header_len };
+
+    stream->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (stream->fd < 0) {
+        fprintf(stderr, "Failed to open %s for writing: %s\n", path, strerror(errno));
+        return -1;
+    }
+    stream->width = width;
+    stream->height = height;
+    stream->rows_written = 0;
+    stream->header_size = header_len;
+    stream->pixels_written = 0;
+
+    if (writev_all(stream->fd, &iov, 1)) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        close(stream->fd);
+        stream->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+int
+image_writer_stream_write_rows(ImageStream *stream, const void *pixels, ImagePixelFormat format,
+                               uint32_t rows, size_t stride)
+{
+    const size_t src_bpp = format == IMAGE_PIXEL_RGBA8 ? 4 : 3;
+    const size_t row_size = (size_t)stream->width * 3;
+    const uint8_t *src = pixels;
+    const uint8_t *payload = src;
+
+    if (stream->fd < 0 || rows > stream->height - stream->rows_written)
+        return -1;
+    if (!stride)
+        stride = (size_t)stream->width * src_bpp;
+
+    if (format != IMAGE_PIXEL_RGB8 || stride != row_size) {
+        uint8_t *dst = get_scratch(row_size * rows);
+        if (!dst) {
+            fprintf(stderr, "Failed to allocate %zu bytes for a PPM band\n", row_size * rows);
+            return -1;
+        }
+        for (uint32_t y = 0; y < rows; y++) {
+            if (format == IMAGE_PIXEL_RGBA8)
+                image_writer_rgba_to_rgb(dst + y * row_size, src + y * stride, stream->width);
+            else
+                memcpy(dst + y * row_size, src + y * stride, row_size);
+        }
+        payload = dst;
+    }
+
+    struct iovec iov = { .iov_base = (void *)payload, .iov_len = row_size * rows };
+    if (writev_all(stream->fd, &iov, 1)) {
+        fprintf(stderr, "Failed to write PPM rows: %s\n", strerror(errno));
+        return -1;
+    }
+    stream->rows_written += rows;
+    stream->pixels_written += (uint64_t)stream->width * rows;
+    return 0;
+}
+
+// pwrite() counterpart of writev_all().
+static int
+pwrite_all(int fd, const uint8_t *data, size_t size, off_t offset)
+{
+    while (size > 0) {
+        ssize_t ret = pwrite(fd, data, size, offset);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += ret;
+        size -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+int
+image_writer_stream_write_tile(ImageStream *stream, const void *pixels, ImagePixelFormat format,
+                               uint32_t x, uint32_t y, uint32_t width, uint32_t height, size_t stride)
+{
+    const size_t src_bpp = format == IMAGE_PIXEL_RGBA8 ? 4 : 3;
+    const size_t row_size = (size_t)width * 3;
+    const uint8_t *src = pixels;
+
+    if (stream->fd < 0 || x > stream->width || width > stream->width - x ||
+        y > stream->height || height > stream->height - y)
+        return -1;
+    if (!stride)
+        stride = (size_t)width * src_bpp;
+
+    // RGB rows go out as they are, RGBA is repacked into a tile-sized scratch.
+    if (format != IMAGE_PIXEL_RGB8) {
+        uint8_t *dst = get_scratch(row_size * height);
+        if (!dst) {
+            fprintf(stderr, "Failed to allocate %zu bytes for a PPM tile\n", row_size * height);
+            return -1;
+        }
+        for (uint32_t row = 0; row < height; row++)
+            image_writer_rgba_to_rgb(dst + row * row_size, src + row * stride, width);
+        src = dst;
+        stride = row_size;
+    }
+
+    for (uint32_t row = 0; row < height; row++) {
+        off_t offset = stream->header_size + ((off_t)(y + row) * stream->width + x) * 3;
+        if (pwrite_all(stream->fd, src + row * stride, row_size, offset)) {
+            fprintf(stderr, "Failed to write a PPM tile: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    stream->pixels_written += (uint64_t)width * height;
+    return 0;
+}
+
+int
+image_writer_stream_close(ImageStream *stream)
+{
+    int ret = 0;
+
+    if (stream->fd < 0)
+        return -1;
+    if (stream->pixels_written != (uint64_t)stream->width * stream->height) {
+        fprintf(stderr, "PPM stream closed after %llu of %llu pixels\n",
+                (unsigned long long)stream->pixels_written, (unsigned long long)stream->width * stream->height);
+        ret = -1;
+    }
+    if (close(stream->fd) && !ret) {
+        fprintf(stderr, "Failed to close PPM stream: %s\n", strerror(errno));
+        ret = -1;
+    }
+    stream->fd = -1;
+    return ret;
+}
+
+size_t
+image_writer_pam_header(char *dst, size_t dst_size, uint32_t width, uint32_t height,
+                        uint32_t depth, size_t padded_size)
+{
+    static const char end[] = "ENDHDR\n";
+    int len = snprintf(dst, dst_size, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH %u\nMAXVAL 255\nTUPLTYPE %s\n",
+                       width, height, depth, depth == 4 ? "RGB_ALPHA" : "RGB");
+    size_t size = len + sizeof(end) - 1;
+
+    if (len < 0 || size > dst_size)
+        return 0;
+
+    if (padded_size) {
+        // "#" + spaces + "\n" is the shortest comment that can take up the slack.
+        size_t pad = padded_size - size;
+        if (padded_size < size + 2 || padded_size > dst_size)
+            return 0;
+        dst[len] = '#';
+        memset(dst + len + 1, ' ', pad - 2);
+        dst[len + pad - 1] = '\n';
+        len += pad;
+        size = padded_size;
+    }
+
+    memcpy(dst + len, end, sizeof(end) - 1);
+    return size;
+}
+
+static int
+write_pam(const char *path, const uint8_t *src, uint32_t channels,
+          uint32_t width, uint32_t height, size_t stride)
+{
+    const size_t row_size = (size_t)width * channels;
+    const size_t payload_size = row_size * height;
+    const uint8_t *payload = src;
+    char header[128];
+    size_t header_len;
+
+    header_len = image_writer_pam_header(header, sizeof(header), width, height, channels, 0);
+
+    if (stride != row_size) {
+        uint8_t *dst = get_scratch(payload_size);
+        if (!dst) {
+            fprintf(stderr, "Failed to allocate %zu bytes for %s\n", payload_size, path);
+            return -1;
+        }
+        for (uint32_t y = 0; y < height; y++)
+            memcpy(dst + y * row_size, src + y * stride, row_size);
+        payload = dst;
+    }
+
+    struct iovec iov[2] = {
+        { .iov_base = header, .iov_len = header_len },
+        { .iov_base = (void *)payload, .iov_len = payload_size },
+    };
+    return write_file(path, iov, 2);
+}
+
+static void
+put_be32(uint8_t *dst, uint32_t value)
+{
+    dst[0] = value >> 24;
+    dst[1] = value >> 16;
+    dst[2] = value >> 8;
+    dst[3] = value;
+}
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+
+typedef union QoiPixel {
+    struct {
+        uint8_t r, g, b, a;
+    };
+    uint32_t v;
+} QoiPixel;
+
+// Single pass over the pixels, see https://qoiformat.org/qoi-specification.pdf
+// dst must hold width * height * (channels + 1) + 22 bytes.
+static size_t
+qoi_encode(uint8_t *dst, const uint8_t *src, uint32_t channels,
+           uint32_t width, uint32_t height, size_t stride)
+{
+    static const uint8_t padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    QoiPixel index[64] = {};
+    QoiPixel prev = { .a = 255 };
+    uint32_t run = 0;
+    uint8_t *p = dst;
+
+    memcpy(p, "qoif", 4);
+    put_be32(p + 4, width);
+    put_be32(p + 8, height);
+    p[12] = channels;
+    p[13] = 0; // sRGB with linear alpha
+    p += 14;
+
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *pixel = src + y * stride;
+
+        for (uint32_t x = 0; x < width; x++, pixel += channels) {
+            QoiPixel px = { .r = pixel[0], .g = pixel[1], .b = pixel[2],
+                            .a = channels == 4 ? pixel[3] : 255 };
+
+            if (px.v == prev.v) {
+                if (++run == 62) {
+                    *p++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run) {
+                *p++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            uint32_t hash = (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+            if (index[hash].v == px.v) {
+                *p++ = QOI_OP_INDEX | hash;
+            } else if (px.a == prev.a) {
+                int8_t vr = px.r - prev.r;
+                int8_t vg = px.g - prev.g;
+                int8_t vb = px.b - prev.b;
+                int8_t vg_r = vr - vg;
+                int8_t vg_b = vb - vg;
+
+                index[hash] = px;
+                if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1) {
+                    *p++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                } else if (vg_r >= -8 && vg_r <= 7 && vg >= -32 && vg <= 31 && vg_b >= -8 && vg_b <= 7) {
+                    *p++ = QOI_OP_LUMA | (vg + 32);
+                    *p++ = (vg_r + 8) << 4 | (vg_b + 8);
+                } else {
+                    *p++ = QOI_OP_RGB;
+                    *p++ = px.r;
+                    *p++ = px.g;
+                    *p++ = px.b;
+                }
+            } else {
+                index[hash] = px;
+                *p++ = QOI_OP_RGBA;
+                *p++ = px.r;
+                *p++ = px.g;
+                *p++ = px.b;
+                *p++ = px.a;
+            }
+            prev = px;
+        }
+    }
+    if (run)
+        *p++ = QOI_OP_RUN | (run - 1);
+
+    memcpy(p, padding, sizeof(padding));
+    return p + sizeof(padding) - dst;
+}
+
+static int
+write_qoi(const char *path, const uint8_t *src, uint32_t channels,
+          uint32_t width, uint32_t height, size_t stride)
+{
+    const size_t max_size = (size_t)width * height * (channels + 1) + 14 + 8;
+    uint8_t *dst = get_scratch(max_size);
+
+    if (!dst) {
+        fprintf(stderr, "Failed to allocate %zu bytes for %s\n", max_size, path);
+        return -1;
+    }
+
+    struct iovec iov = {
+        .iov_base = dst,
+        .iov_len = qoi_encode(dst, src, channels, width, height, stride),
+    };
+    return write_file(path, &iov, 1);
+}
+
+// Persistent workers shared by every writer call, started on first use.
+// Callers take turns through pool_owner, the calling thread works on its own
+// job too, so everything still completes if no worker could be started.
+typedef struct WorkerPool {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    void (*func)(void *arg, size_t index);
+    void *arg;
+    size_t next;
+    size_t count;
+    size_t remaining;
+} WorkerPool;
+
+static WorkerPool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+};
+static pthread_mutex_t pool_owner = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static void *
+pool_worker(void *unused)
+{
+    (void)unused;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.next >= pool.count)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+
+        void (*func)(void *, size_t) = pool.func;
+        void *arg = pool.arg;
+        size_t index = pool.next++;
+
+        pthread_mutex_unlock(&pool.lock);
+        func(arg, index);
+        pthread_mutex_lock(&pool.lock);
+
+        if (--pool.remaining == 0)
+            pthread_cond_signal(&pool.idle);
+    }
+    return NULL;
+}
+
+// One worker per online CPU besides the caller, IMAGE_WRITER_THREADS
+// overrides the total.
+static void
+pool_start(void)
+{
+    const char *env = getenv("IMAGE_WRITER_THREADS");
+    long threads = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (threads > 64)
+        threads = 64;
+    for (long i = 1; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_worker, NULL))
+            break;
+        pthread_detach(thread);
+    }
+}
+
+static void
+parallel_for(void (*func)(void *arg, size_t index), void *arg, size_t count)
+{
+    pthread_once(&pool_once, pool_start);
+    pthread_mutex_lock(&pool_owner);
+    pthread_mutex_lock(&pool.lock);
+
+    pool.func = func;
+    pool.arg = arg;
+    pool.next = 0;
+    pool.count = count;
+    pool.remaining = count;
+    pthread_cond_broadcast(&pool.wake);
+
+    while (pool.next < pool.count) {
+        size_t index = pool.next++;
+        pthread_mutex_unlock(&pool.lock);
+        func(arg, index);
+        pthread_mutex_lock(&pool.lock);
+        pool.remaining--;
+    }
+    while (pool.remaining)
+        pthread_cond_wait(&pool.idle, &pool.lock);
+
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool_owner);
+}
+
+// A run of rows deflated on its own into one IDAT chunk. Every stripe but the
+// last ends with a sync flush so the raw deflate streams concatenate into one
+// valid stream; the first one carries the zlib header and the Adler-32 of the
+// whole image goes in a separate IDAT at the end.
+typedef struct PngStripe {
+    const uint8_t *src;
+    size_t stride;
+    uint32_t width;
+    uint32_t channels;
+    uint32_t row_count;
+    int first;
+    int last;
+    uint8_t *chunk;   // length, "IDAT", data, CRC
+    size_t chunk_size;
+    uLong adler;      // of the filtered rows
+    size_t raw_size;
+    int failed;
+} PngStripe;
+
+static void
+png_deflate_stripe(void *arg, size_t index)
+{
+    PngStripe *stripe = (PngStripe *)arg + index;
+    const size_t row_size = (size_t)stripe->width * stripe->channels + 1;
+    const uint32_t bpp = stripe->channels;
+    z_stream z = {};
+    uint8_t *row = malloc(row_size);
+
+    stripe->failed = 1;
+    if (!row)
+        return;
+    if (deflateInit2(&z, IMAGE_WRITER_PNG_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(row);
+        return;
+    }
+
+    stripe->raw_size = row_size * stripe->row_count;
+    // deflateBound() covers one Z_FINISH, leave room for the sync flush marker.
+    size_t bound = deflateBound(&z, stripe->raw_size) + 64;
+    stripe->chunk = malloc(8 + 2 + bound + 4);
+    if (!stripe->chunk)
+        goto out;
+
+    uint8_t *data = stripe->chunk + 8;
+    size_t header_size = 0;
+    if (stripe->first) {
+        data[0] = 0x78; // deflate, 32K window
+        data[1] = 0x01; // fastest, no dictionary
+        header_size = 2;
+    }
+    z.next_out = data + header_size;
+    z.avail_out = bound;
+    stripe->adler = adler32(0, NULL, 0);
+
+    for (uint32_t y = 0; y < stripe->row_count; y++) {
+        const uint8_t *src = stripe->src + y * stripe->stride;
+        int flush = Z_NO_FLUSH;
+
+        // Sub filter: cheap and good on the flat spans of a rendered frame.
+        row[0] = 1;
+        memcpy(row + 1, src, bpp);
+        for (size_t i = bpp; i < row_size - 1; i++)
+            row[1 + i] = src[i] - src[i - bpp];
+        stripe->adler = adler32(stripe->adler, row, row_size);
+
+        if (y + 1 == stripe->row_count)
+            flush = stripe->last ? Z_FINISH : Z_SYNC_FLUSH;
+
+        z.next_in = row;
+        z.avail_in = row_size;
+        int ret = deflate(&z, flush);
+        if (ret == Z_STREAM_ERROR || z.avail_in || (flush == Z_FINISH && ret != Z_STREAM_END))
+            goto out;
+    }
+
+    size_t data_size = (uint8_t *)z.next_out - data;
+    put_be32(stripe->chunk, data_size);
+    memcpy(stripe->chunk + 4, "IDAT", 4);
+    put_be32(data + data_size, crc32(crc32(0, NULL, 0), stripe->chunk + 4, data_size + 4));
+    stripe->chunk_size = data_size + 12;
+    stripe->failed = 0;
+
+out:
+    deflateEnd(&z);
+    free(row);
+}
+
+static void
+png_chunk(uint8_t *dst, const char *type, const uint8_t *data, uint32_t size)
+{
+    put_be32(dst, size);
+    memcpy(dst + 4, type, 4);
+    if (size)
+        memcpy(dst + 8, data, size);
+    put_be32(dst + 8 + size, crc32(crc32(0, NULL, 0), dst + 4, size + 4));
+}
+
+static int
+write_png(const char *path, const uint8_t *src, uint32_t channels,
+          uint32_t width, uint32_t height, size_t stride)
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    const size_t row_size = (size_t)width * channels + 1;
+    const uint32_t rows_per_stripe = row_size < PNG_STRIPE_BYTES ? PNG_STRIPE_BYTES / row_size : 1;
+    const size_t stripe_count = ((size_t)height + rows_per_stripe - 1) / rows_per_stripe;
+    uint8_t head[8 + 25], tail[16 + 12], ihdr[13], adler[4];
+    PngStripe *stripes;
+    struct iovec *iov;
+    int ret = -1;
+
+    if (!width || !height) {
+        fprintf(stderr, "Cannot write an empty PNG to %s\n", path);
+        return -1;
+    }
+
+    stripes = calloc(stripe_count, sizeof(*stripes));
+    iov = calloc(stripe_count + 2, sizeof(*iov));
+    if (!stripes || !iov) {
+        fprintf(stderr, "Failed to allocate PNG stripes for %s\n", path);
+        goto out;
+    }
+
+    for (size_t i = 0; i < stripe_count; i++) {
+        uint32_t first_row = i * rows_per_stripe;
+
+        stripes[i].src = src + first_row * stride;
+        stripes[i].stride = stride;
+        stripes[i].width = width;
+        stripes[i].channels = channels;
+        stripes[i].row_count = height - first_row < rows_per_stripe ? height - first_row : rows_per_stripe;
+        stripes[i].first = i == 0;
+        stripes[i].last = i + 1 == stripe_count;
+    }
+
+    parallel_for(png_deflate_stripe, stripes, stripe_count);
+
+    uLong checksum = adler32(0, NULL, 0);
+    for (size_t i = 0; i < stripe_count; i++) {
+        if (stripes[i].failed) {
+            fprintf(stderr, "Failed to deflate %s\n", path);
+            goto out;
+        }
+        checksum = adler32_combine(checksum, stripes[i].adler, stripes[i].raw_size);
+        iov[1 + i].iov_base = stripes[i].chunk;
+        iov[1 + i].iov_len = stripes[i].chunk_size;
+    }
+
+    put_be32(ihdr, width);
+    put_be32(ihdr + 4, height);
+    ihdr[8] = 8;                     // bit depth
+    ihdr[9] = channels == 4 ? 6 : 2; // RGBA or RGB
+    ihdr[10] = 0;                    // deflate
+    ihdr[11] = 0;                    // adaptive filtering
+    ihdr[12] = 0;                    // not interlaced
+    memcpy(head, signature, sizeof(signature));
+    png_chunk(head + 8, "IHDR", ihdr, sizeof(ihdr));
+
+    put_be32(adler, checksum);
+    png_chunk(tail, "IDAT", adler, sizeof(adler));
+    png_chunk(tail + 16, "IEND", NULL, 0);
+
+    iov[0].iov_base = head;
+    iov[0].iov_len = sizeof(head);
+    iov[1 + stripe_count].iov_base = tail;
+    iov[1 + stripe_count].iov_len = sizeof(tail);
+    ret = write_file(path, iov, stripe_count + 2);
+
+out:
+    if (stripes) {
+        for (size_t i = 0; i < stripe_count; i++)
+            free(stripes[i].chunk);
+    }
+    free(stripes);
+    free(iov);
+    return ret;
+}
+
+int
+image_writer_write(const char *path, const void *pixels, ImagePixelFormat format,
+                   ImageFileFormat file_format, uint32_t width, uint32_t height, size_t stride)
+{
+    const uint32_t channels = format == IMAGE_PIXEL_RGBA8 ? 4 : 3;
+
+    if (!stride)
+        stride = (size_t)width * channels;
+
+    switch (file_format) {
+    case IMAGE_FILE_PAM:
+        return write_pam(path, pixels, channels, width, height, stride);
+    case IMAGE_FILE_QOI:
+        return write_qoi(path, pixels, channels, width, height, stride);
+    case IMAGE_FILE_PNG:
+        return write_png(path, pixels, channels, width, height, stride);
+    case IMAGE_FILE_PPM:
+    default:
+        return image_writer_write_ppm(path, pixels, format, width, height, stride);
+    }
+}
+
+static const char *const format_names[] = {
+    [IMAGE_FILE_PPM] = "ppm",
+    [IMAGE_FILE_PAM] = "pam",
+    [IMAGE_FILE_QOI] = "qoi",
+    [IMAGE_FILE_PNG] = "png",
+};
+
+int
+image_writer_parse_format(const char *name, ImageFileFormat *file_format)
+{
+    for (size_t i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++) {
+        if (!strcasecmp(name, format_names[i])) {
+            *file_format = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+ImageFileFormat
+image_writer_format_from_env(void)
+{
+    const char *name = getenv("IMAGE_FORMAT");
+    ImageFileFormat file_format = IMAGE_FILE_PPM;
+
+    if (name && *name && image_writer_parse_format(name, &file_format))
+        fprintf(stderr, "Unknown IMAGE_FORMAT \"%s\", writing PPM\n", name);
+    return file_format;
+}
+
+const char *
+image_writer_format_extension(ImageFileFormat file_format)
+{
+    return file_format < sizeof(format_names) / sizeof(format_names[0]) ? format_names[file_format] : "ppm";
+}
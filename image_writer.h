@@ -0,0 +1,84 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Layout of the pixels handed to the writer.
+typedef enum ImagePixelFormat {
+    IMAGE_PIXEL_RGBA8, // 4 bytes per pixel, alpha is dropped on output
+    IMAGE_PIXEL_RGB8,  // 3 bytes per pixel, already in PPM order
+} ImagePixelFormat;
+
+// Container written by image_writer_write().
+typedef enum ImageFileFormat {
+    IMAGE_FILE_PPM, // P6, alpha dropped
+    IMAGE_FILE_PAM, // P7, channels written as they come in
+    IMAGE_FILE_QOI, // "Quite OK Image", single pass lossless
+    IMAGE_FILE_PNG, // row stripes deflated in parallel
+} ImageFileFormat;
+
+// Repack pixel_count RGBA8 pixels into tightly packed RGB24.
+// Uses AVX2 or SSSE3 shuffles when the CPU supports them.
+void image_writer_rgba_to_rgb(uint8_t *dst, const uint8_t *src, size_t pixel_count);
+
+// Write a binary P6 PPM. The header and the whole payload are handed to the
+// kernel with a single writev(), RGBA input is repacked into a per-thread
+// scratch buffer that is reused between calls.
+// stride is the distance in bytes between rows, 0 means tightly packed.
+// Returns 0 on success, -1 on failure (an error is printed to stderr).
+int image_writer_write_ppm(const char *path, const void *pixels, ImagePixelFormat format,
+                           uint32_t width, uint32_t height, size_t stride);
+
+// A PPM written a band of rows or a tile at a time, for images that never
+// exist in memory as a whole.
+typedef struct ImageStream {
+    int fd;
+    uint32_t width;
+    uint32_t height;
+    uint32_t rows_written;
+    size_t header_size;
+    uint64_t pixels_written;
+} ImageStream;
+
+// Create path and write the P6 header for width x height pixels.
+int image_writer_stream_open(ImageStream *stream, const char *path, uint32_t width, uint32_t height);
+
+// Append rows full-width rows, repacking RGBA input like
+// image_writer_write_ppm(). stride 0 means tightly packed.
+int image_writer_stream_write_rows(ImageStream *stream, const void *pixels, ImagePixelFormat format,
+                                   uint32_t rows, size_t stride);
+
+// Write a width x height tile at (x, y), each row with pwrite() at its place
+// in the file, so tiles may come in any order. Only a tile is ever repacked.
+// Use either this or image_writer_stream_write_rows() on a stream, not both.
+int image_writer_stream_write_tile(ImageStream *stream, const void *pixels, ImagePixelFormat format,
+                                   uint32_t x, uint32_t y, uint32_t width, uint32_t height, size_t stride);
+
+// Close the file. Fails if fewer pixels than the header promised were written.
+int image_writer_stream_close(ImageStream *stream);
+
+// Format a PAM (P7) header for width x height pixels with depth 3 (RGB) or
+// 4 (RGB_ALPHA) channels of 8 bits. When padded_size is not 0 a comment line
+// is inserted so the header ends exactly at padded_size, which lets the
+// payload start on a page boundary.
+// Returns the header length, or 0 if it does not fit in dst/padded_size.
+size_t image_writer_pam_header(char *dst, size_t dst_size, uint32_t width, uint32_t height,
+                               uint32_t depth, size_t padded_size);
+
+// Write pixels in file_format. PAM, QOI and PNG keep the alpha channel of
+// RGBA8 input. Same return convention as image_writer_write_ppm().
+int image_writer_write(const char *path, const void *pixels, ImagePixelFormat format,
+                       ImageFileFormat file_format, uint32_t width, uint32_t height, size_t stride);
+
+// Parse "ppm", "pam", "qoi" or "png". Returns 0 on success, -1 otherwise.
+int image_writer_parse_format(const char *name, ImageFileFormat *file_format);
+
+// Format named by the IMAGE_FORMAT environment variable, PPM when unset or
+// unknown (a warning is printed for the latter).
+ImageFileFormat image_writer_format_from_env(void);
+
+// File extension for file_format without the dot, e.g. "png".
+const char *image_writer_format_extension(ImageFileFormat file_format);
+
+#endif
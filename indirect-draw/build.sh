@@ -1,3 +1,5 @@
 glslc shader.vert -o vert.spv
 glslc shader.frag -o frag.spv
-gcc -o main.bin main.c -lvulkan
+glslc -mfmt=c shader.vert -o vert.spv.h
+glslc -mfmt=c shader.frag -o frag.spv.h
+gcc -O2 -o main.bin main.c ../image_writer.c ../pipeline_cache.c ../shader_code.c -lvulkan -pthread -lz
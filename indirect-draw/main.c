@@ -5,6 +5,20 @@
 #include <stdint.h>
 #include <assert.h>
 
+#include "../image_writer.h"
+#include "../pipeline_cache.h"
+#include "../shader_code.h"
+
+// Compiled in by build.sh
+static const uint32_t vertSpv[] =
+#include "vert.spv.h"
+;
+static const uint32_t fragSpv[] =
+#include "frag.spv.h"
+;
+static const ShaderCode vertShader = SHADER_CODE("vert.spv", vertSpv);
+static const ShaderCode fragShader = SHADER_CODE("frag.spv", fragSpv);
+
 #define WIDTH 512
 #define HEIGHT 512
 
@@ -48,19 +62,6 @@ uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, Vk
     exit(1);
 }
 
-// Helper: Read file
-char* readFile(const char* filename, size_t* size) {
-    FILE* file = fopen(filename, "rb");
-    if (!file) { printf("Failed to open %s\n", filename); exit(1); }
-    fseek(file, 0, SEEK_END);
-    *size = ftell(file);
-    rewind(file);
-    char* buffer = (char*)malloc(*size);
-    fread(buffer, 1, *size, file);
-    fclose(file);
-    return buffer;
-}
-
 int main() {
     VkInstance instance;
     VkApplicationInfo appInfo = { .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO, .apiVersion = VK_API_VERSION_1_0 };
@@ -92,10 +93,18 @@ int main() {
     VkPhysicalDeviceFeatures deviceFeatures = {0};
     deviceFeatures.multiDrawIndirect = VK_TRUE; 
 
-    VkDeviceCreateInfo deviceCreateInfo = { .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO, .queueCreateInfoCount = 1, .pQueueCreateInfos = &queueCreateInfo, .pEnabledFeatures = &deviceFeatures };
+    // Per-pipeline compile times and cache hits in the report.
+    const char *feedbackExtension = pipeline_cache_feedback_extension(physicalDevice);
+
+    VkDeviceCreateInfo deviceCreateInfo = { .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO, .queueCreateInfoCount = 1, .pQueueCreateInfos = &queueCreateInfo, .pEnabledFeatures = &deviceFeatures,
+                                            .enabledExtensionCount = feedbackExtension ? 1 : 0, .ppEnabledExtensionNames = &feedbackExtension };
     VkDevice device;
     VK_CHECK(vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL, &device));
 
+    // Pipelines compiled by an earlier run come out of the cache file.
+    PipelineCache pipelineCache;
+    VK_CHECK(pipeline_cache_open(&pipelineCache, physicalDevice, device, "indirect-draw", feedbackExtension != NULL));
+
     VkQueue queue;
     vkGetDeviceQueue(device, graphicsQueueFamily, 0, &queue);
 
@@ -134,15 +143,9 @@ int main() {
     VK_CHECK(vkCreateFramebuffer(device, &framebufferInfo, NULL, &framebuffer));
 
     // Shaders
-    size_t vertSize, fragSize;
-    char *vertCode = readFile("vert.spv", &vertSize);
-    char *fragCode = readFile("frag.spv", &fragSize);
-
-    VkShaderModuleCreateInfo vertModuleInfo = { .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO, .codeSize = vertSize, .pCode = (uint32_t*)vertCode };
-    VkShaderModuleCreateInfo fragModuleInfo = { .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO, .codeSize = fragSize, .pCode = (uint32_t*)fragCode };
     VkShaderModule vertModule, fragModule;
-    vkCreateShaderModule(device, &vertModuleInfo, NULL, &vertModule);
-    vkCreateShaderModule(device, &fragModuleInfo, NULL, &fragModule);
+    VK_CHECK(shader_code_create_module(device, &vertShader, &vertModule));
+    VK_CHECK(shader_code_create_module(device, &fragShader, &fragModule));
 
     // Pipeline
     VkPipelineShaderStageCreateInfo shaderStages[] = {
@@ -170,7 +173,8 @@ int main() {
 
     VkGraphicsPipelineCreateInfo pipelineInfo = { .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO, .stageCount = 2, .pStages = shaderStages, .pVertexInputState = &vertexInputInfo, .pInputAssemblyState = &inputAssembly, .pViewportState = &viewportState, .pRasterizationState = &rasterizer, .pMultisampleState = &multisampling, .pColorBlendState = &colorBlending, .layout = pipelineLayout, .renderPass = renderPass, .subpass = 0 };
     VkPipeline graphicsPipeline;
-    VK_CHECK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &graphicsPipeline));
+    VK_CHECK(pipeline_cache_create_graphics(&pipelineCache, "indirect-draw", &pipelineInfo, &graphicsPipeline));
+    pipeline_cache_close(&pipelineCache);
 
     // Create Buffers (Vertex, Indirect, and Readback)
     VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, .size = sizeof(vertices), .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT };
@@ -253,18 +257,8 @@ int main() {
 
     // Save Image to PPM
     vkMapMemory(device, readbackMemory, 0, imageSize, 0, &data);
-    uint8_t* pixels = (uint8_t*)data;
-    FILE* file = fopen("output.ppm", "wb");
-    fprintf(file, "P3\n%d %d\n255\n", WIDTH, HEIGHT);
-    for (int y = 0; y < HEIGHT; y++) {
-        for (int x = 0; x < WIDTH; x++) {
-            int index = (y * WIDTH + x) * 4;
-            // Reading out standard R8G8B8A8 unorm data
-            fprintf(file, "%d %d %d ", pixels[index], pixels[index+1], pixels[index+2]);
-        }
-        fprintf(file, "\n");
-    }
-    fclose(file);
+    // Reading out standard R8G8B8A8 unorm data
+    image_writer_write_ppm("output.ppm", data, IMAGE_PIXEL_RGBA8, WIDTH, HEIGHT, 0);
     vkUnmapMemory(device, readbackMemory);
 
     printf("Rendered to output.ppm successfully.\n");
@@ -290,8 +284,6 @@ int main() {
     vkDestroyDevice(device, NULL);
     vkDestroyInstance(instance, NULL);
     
-    free(vertCode);
-    free(fragCode);
     free(physicalDevices);
     free(queueFamilies);
 
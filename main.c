@@ -3,17 +3,306 @@
 #include <string.h>
 #include <vulkan/vulkan.h>
 
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 #include <stddef.h>
 
+#include "image_writer.h"
+#include "pipeline_cache.h"
+#include "pipeline_variants.h"
+#include "render_protocol.h"
+#include "shader_code.h"
+#include "spsc_queue.h"
+
 // Define the dimensions of the output image
+#ifndef IMAGE_WIDTH
 #define IMAGE_WIDTH 256
+#endif
+#ifndef IMAGE_HEIGHT
 #define IMAGE_HEIGHT 256
+#endif
 
 #define DO_COPY 1
 
+// Pack the image into a tightly packed RGB24 buffer with pack_rgb.comp and
+// read that back instead of the RGBA8 image: a quarter fewer bytes cross the
+// bus and the writer gets pixels it can hand to the kernel unchanged.
+#ifndef PACK_RGB24
+#define PACK_RGB24 0
+#endif
+#define READBACK_CHANNELS (PACK_RGB24 ? 3 : 4)
+
+// Number of frames rendered by one run. With more than one frame the images
+// are saved as output_NNNN.<ext> instead of output.<ext>. The format comes
+// from IMAGE_FORMAT (ppm, pam, qoi or png), PPM by default.
+//
+// Batch mode: `main.bin batch.txt` renders one frame per line of batch.txt
+// instead, against the same device and pipelines. A line overrides any of
+// the default push constants, e.g.
+//     vertex_offset=0.25,0,0,0 color_offset=1,0,0,0 color=0,1,0,1 test=24
+// Empty lines and lines starting with # are skipped. The check.comp results
+// of every frame are collected in results.csv.
+//
+// Server mode: `main.bin --serve /tmp/render.sock` sets everything up once
+// and then renders one frame per request from a Unix-domain socket, see
+// render_protocol.h and render_client.c. The frames go through the same ring
+// as FRAME_COUNT frames, so a request is read back and answered by the
+// writer thread while the next one renders.
+#ifndef FRAME_COUNT
+#define FRAME_COUNT 1
+#endif
+// Frame slots (command buffer, result and staging buffers) cycling between
+// the render loop, the GPU and the writer thread. With 3 the CPU records
+// frame N+2 while the GPU runs N+1 and the writer consumes N. Completion is
+// tracked with one timeline semaphore (Vulkan 1.2), per-slot fences when the
+// device lacks it.
+#ifndef FRAMES_IN_FLIGHT
+#define FRAMES_IN_FLIGHT 2
+#endif
+
+#if FRAMES_IN_FLIGHT < 1
+#error "FRAMES_IN_FLIGHT must be at least 1"
+#endif
+
+// Copy the image straight into a mapping of the output file, imported as
+// device memory with VK_EXT_external_memory_host, instead of going through a
+// staging buffer and write(). Only the header is written by the CPU. The file
+// is a PAM (output.pam), RGBA unless PACK_RGB24 already dropped the alpha.
+// Falls back to the staging path when the device lacks the extension.
+#ifndef READBACK_TO_FILE
+#define READBACK_TO_FILE 0
+#endif
+
+#if (READBACK_TO_FILE || PACK_RGB24) && !DO_COPY
+#error "READBACK_TO_FILE and PACK_RGB24 need DO_COPY"
+#endif
+
+// Run-length encode the image on the GPU (rle_count.comp, rle_scan.comp,
+// rle_emit.comp) and read back only the runs. Rows are encoded
+// independently: a prefix sum over the per-row run counts tells every row
+// where its runs go. The runs land in host-visible memory, so only the
+// encoded bytes cross the bus; the writer thread decodes them.
+#ifndef RLE_READBACK
+#define RLE_READBACK 0
+#endif
+
+#if RLE_READBACK && (READBACK_TO_FILE || PACK_RGB24 || !DO_COPY)
+#error "RLE_READBACK replaces the transfer readback, it excludes READBACK_TO_FILE and PACK_RGB24"
+#endif
+
+// Read the image back with vkCopyImageToMemoryEXT (VK_EXT_host_image_copy)
+// on the writer thread: no transfer commands and no staging buffers, the
+// pixels go from the image straight into one host buffer. Falls back to the
+// staging path when the device lacks the extension.
+#ifndef HOST_IMAGE_COPY
+#define HOST_IMAGE_COPY 0
+#endif
+
+#if HOST_IMAGE_COPY && (READBACK_TO_FILE || PACK_RGB24 || RLE_READBACK || !DO_COPY)
+#error "HOST_IMAGE_COPY replaces the transfer readback, it excludes READBACK_TO_FILE and PACK_RGB24"
+#endif
+
+// Only read back the 16x16 tiles (check.comp's workgroup size) that changed
+// since the previous frame. tile_diff.comp compares every pixel against a
+// device-local copy of the last frame and appends the tiles that differ to a
+// host-visible list. The render loop waits for that list, then submits one
+// vkCmdCopyImageToBuffer region per dirty tile, and the writer thread
+// patches them into a persistent framebuffer before writing it out. The
+// first frame has nothing to compare against and copies every tile.
+#ifndef DIRTY_TILES
+#define DIRTY_TILES 0
+#endif
+#define DIFF_TILE_SIZE 16
+#define DIFF_TILES_X ((IMAGE_WIDTH + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE)
+#define DIFF_TILES_Y ((IMAGE_HEIGHT + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE)
+#define DIFF_TILE_COUNT (DIFF_TILES_X * DIFF_TILES_Y)
+
+#if DIRTY_TILES && (READBACK_TO_FILE || PACK_RGB24 || RLE_READBACK || HOST_IMAGE_COPY || !DO_COPY)
+#error "DIRTY_TILES copies RGBA8 tiles through the staging buffers, it excludes the other readback modes"
+#endif
+
+// Record every slot's command buffer once and resubmit it for every frame
+// that lands in the slot. What varies per frame (the PushConstants) goes
+// through a host-visible uniform buffer per slot, written before the
+// submission, instead of vkCmdPushConstants; the triangle.vert and check.comp
+// variants built with -DPARAMS_UBO read it from there.
+#ifndef PRERECORDED
+#define PRERECORDED 0
+#endif
+
+#if PRERECORDED && (READBACK_TO_FILE || DIRTY_TILES)
+#error "PRERECORDED needs the same commands every frame, READBACK_TO_FILE and DIRTY_TILES change them"
+#endif
+
+// Render a POSTER_WIDTH x POSTER_HEIGHT output as IMAGE_WIDTH x IMAGE_HEIGHT
+// tiles, each one through the same offscreen image and frame ring with the
+// projection shifted onto it. The writer thread puts every finished tile at
+// its place in output.ppm with pwrite(), so memory stays at one tile whatever
+// the poster size, and the check counts are summed over every tile. 0 renders
+// single frames.
+#ifndef POSTER_WIDTH
+#define POSTER_WIDTH 0
+#endif
+#ifndef POSTER_HEIGHT
+#define POSTER_HEIGHT 0
+#endif
+#define TILED (POSTER_WIDTH && POSTER_HEIGHT)
+
+#if TILED
+#if POSTER_WIDTH % IMAGE_WIDTH || POSTER_HEIGHT % IMAGE_HEIGHT
+#error "POSTER_WIDTH/POSTER_HEIGHT must be multiples of IMAGE_WIDTH/IMAGE_HEIGHT"
+#endif
+#if READBACK_TO_FILE || DIRTY_TILES || !DO_COPY
+#error "Tiled rendering streams through the staging buffers"
+#endif
+#define TILES_X (POSTER_WIDTH / IMAGE_WIDTH)
+#define TILES_Y (POSTER_HEIGHT / IMAGE_HEIGHT)
+// Every tile goes through the frame ring as one frame.
+#undef FRAME_COUNT
+#define FRAME_COUNT (TILES_X * TILES_Y)
+#endif
+
+// Draw frame N with variant N % PIPELINE_VARIANT_COUNT of the triangle
+// pipeline, one of the cull mode x topology x blending combinations of
+// pipeline_variants.h, each made the first time a frame binds it. The value
+// picks how: PIPELINE_VARIANTS_MONOLITHIC (1) full pipelines,
+// PIPELINE_VARIANTS_LIBRARY (2) fast-linked VK_EXT_graphics_pipeline_library
+// parts, PIPELINE_VARIANTS_SHADER_OBJECT (3) VK_EXT_shader_object. The report
+// gives the latency of binding each variant the first time.
+#ifndef PIPELINE_VARIANTS
+#define PIPELINE_VARIANTS 0
+#endif
+
+#if PIPELINE_VARIANTS && (PRERECORDED || TILED)
+#error "PIPELINE_VARIANTS changes the pipeline every frame, PRERECORDED and tiled rendering keep one"
+#endif
+
+// Draw the triangle DRAW_COUNT times per frame, every copy shrunk into its
+// own cell of a square grid by a push of tile_transform before its draw, so
+// the CPU cost of recording a big draw list shows in the report.
+#ifndef DRAW_COUNT
+#define DRAW_COUNT 1
+#endif
+
+// Split the draws across $RECORD_THREADS worker threads (one per online CPU
+// when unset). Each has its own command pool and records its share into a
+// secondary command buffer of the slot, the primary executes them in order
+// inside the render pass.
+#ifndef SECONDARY_RECORDING
+#define SECONDARY_RECORDING 0
+#endif
+
+#if DRAW_COUNT < 1
+#error "DRAW_COUNT must be at least 1"
+#endif
+
+#if (DRAW_COUNT > 1 || SECONDARY_RECORDING) && PRERECORDED
+#error "PRERECORDED reads tile_transform from the uniform buffer, the per-draw pushes do not reach it"
+#endif
+
+#if SECONDARY_RECORDING && PIPELINE_VARIANTS
+#error "SECONDARY_RECORDING continues the render pass in its buffers, PIPELINE_VARIANTS may render without one"
+#endif
+
+// How check.comp adds up its counters. 0: one atomicAdd on the result buffer
+// per pixel and counter, every invocation of the image on the same four
+// addresses. 1: the workgroup adds its pixels up first (subgroupAdd() per
+// subgroup, then shared memory) and does one atomicAdd per counter. 2: the
+// workgroups write their counts to a buffer instead and check_sum.comp adds
+// those up in a second dispatch, for images with very many workgroups.
+// Without subgroup arithmetic in compute shaders the workgroups add up
+// through shared memory atomics alone. The report gives the GPU time of the
+// check either way.
+#ifndef CHECK_REDUCTION
+#define CHECK_REDUCTION 0
+#endif
+// Workgroups check_sum.comp runs with at most, each adds up a strided share.
+#define CHECK_SUM_GROUPS_MAX 64
+
+#if CHECK_REDUCTION && PRERECORDED
+#error "CHECK_REDUCTION has no PARAMS_UBO build of check.comp, PRERECORDED needs one"
+#endif
+
+// Count the triangle's pixels with an occlusion query around the draw
+// instead of check.comp. The rasterizer already knows how many samples
+// passed, vkCmdCopyQueryPoolResults() puts that into the result buffer
+// without the image barrier and the dispatch. 1 replaces the check with it:
+// the background and total counts follow from the image size, test is not
+// counted. 2 runs both and compares them every frame, check.comp stays the
+// check that looks at the colors. Without precise occlusion queries the
+// check stays check.comp.
+#ifndef OCCLUSION_CHECK
+#define OCCLUSION_CHECK 0
+#endif
+
+#if OCCLUSION_CHECK && (DRAW_COUNT > 1 || SECONDARY_RECORDING)
+#error "OCCLUSION_CHECK counts the samples of one draw recorded in the primary command buffer"
+#endif
+
+// Run the check as a second subpass of the render pass instead of a compute
+// dispatch after it: check_subpass.frag reads each pixel through an input
+// attachment behind a BY_REGION dependency, so on a tiler the color stays in
+// tile memory, and there is no image barrier or dispatch on any driver. It
+// adds its counts up per subgroup like CHECK_REDUCTION 1 where fragment
+// shaders have subgroup arithmetic. The report times the render pass and
+// the check together in both variants.
+#ifndef SUBPASS_CHECK
+#define SUBPASS_CHECK 0
+#endif
+
+#if SUBPASS_CHECK && (PIPELINE_VARIANTS || PRERECORDED)
+#error "SUBPASS_CHECK needs the render pass and the push constants, not PIPELINE_VARIANTS or PRERECORDED"
+#endif
+
+#if SUBPASS_CHECK && (CHECK_REDUCTION || OCCLUSION_CHECK)
+#error "SUBPASS_CHECK replaces check.comp, CHECK_REDUCTION and OCCLUSION_CHECK change what it does"
+#endif
+
+// Classify every pixel against a palette of up to PALETTE_MAX_CLASSES colors
+// with classify.comp, in one dispatch after the check. A pixel counts for
+// the first class whose color is within the class's tolerance (RGB
+// distance), or as unclassified. The palette comes from the file named by
+// $PALETTE, one class per line as `color=r,g,b tolerance=t` (0.1 when left
+// out), and is the triangle and clear colors when unset. 1 counts the pixels
+// of every class, 2 also finds their bounding boxes. The counters live in
+// shared memory per workgroup until it is done.
+#ifndef PALETTE_CLASSIFY
+#define PALETTE_CLASSIFY 0
+#endif
+#define PALETTE_MAX_CLASSES 256 // one per invocation of a classify.comp workgroup
+
+#if PALETTE_CLASSIFY && TILED
+#error "PALETTE_CLASSIFY prints the classes of whole frames, not of poster tiles"
+#endif
+
+// Histogram, min, max and mean of every channel with stats.comp, one more
+// dispatch after the check. Only the ImageStats of a frame, a few KB, are
+// read back for them instead of the image scanned on the CPU.
+#ifndef IMAGE_STATS
+#define IMAGE_STATS 0
+#endif
+
+#if IMAGE_STATS && TILED
+#error "IMAGE_STATS prints the statistics of whole frames, not of poster tiles"
+#endif
+
+// Timestamps per frame slot of the second pool: around the render pass and
+// the check, and around the readback commands.
+#define PASS_QUERIES 4
+
+// Timestamps per frame slot: around the check, then one after each of the
+// classification and the statistics that are on.
+#define CHECK_QUERIES (2 + (PALETTE_CLASSIFY != 0) + (IMAGE_STATS != 0))
+
 typedef struct Vertex {
     float pos[4];
     float color[4];
@@ -26,10 +315,225 @@ typedef struct PushConstants {
     float color_offset[4];  // Offset for color only//20+4=24
     uint32_t test;//24+1=25
     uint32_t use_buffer;//25+1=26
+    uint32_t pad[2];               // std430 puts the next vec4 at 28
+    float tile_transform[4];       // clip xy * .xy + w * .zw, identity without tiling//28+4=32
 } __attribute__((packed)) PushConstants;
 
 
-// Simple error checking macro
+// Everything one frame needs while it is in flight. The writer thread owns a
+// slot from the moment it is queued until its image is on disk.
+typedef struct FrameSlot {
+    VkCommandBuffer commandBuffer;
+    VkFence fence;          // only without timeline semaphores
+    uint64_t timelineValue; // the value the last submission of the frame signals
+    double startMs;         // when recording started, for the latency
+    VkBuffer resultBuffer;
+    VkDeviceMemory resultBufferMemory;
+    uint32_t *results; // check.comp's counters, then OCCLUSION_CHECK's samples
+    VkDescriptorSet descriptorSet;
+    VkDescriptorSet subpassSet; // SUBPASS_CHECK: the input attachment and results
+    uint32_t firstQuery;    // the two timestamps around the check, if timed
+    // CHECK_REDUCTION 2: device-local counts of every check.comp workgroup
+    VkBuffer partialsBuffer;
+    VkDeviceMemory partialsBufferMemory;
+    // PALETTE_CLASSIFY: the mapped ClassResults of the frame
+    VkBuffer classBuffer;
+    VkDeviceMemory classBufferMemory;
+    void *classes;
+    // IMAGE_STATS: the mapped ImageStats of the frame
+    VkBuffer statsBuffer;
+    VkDeviceMemory statsBufferMemory;
+    void *stats;
+#if DO_COPY
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    void *pixels;
+    // PACK_RGB24: device-local RGB24 copy of the image
+    VkBuffer packedBuffer;
+    VkDeviceMemory packedBufferMemory;
+    // RLE_READBACK: per-row run counts and offsets on the device, and the
+    // mapped runs (RleHeader followed by RleRun[runCount])
+    VkBuffer rleRowsBuffer;
+    VkDeviceMemory rleRowsBufferMemory;
+    VkBuffer rleBuffer;
+    VkDeviceMemory rleBufferMemory;
+    void *rle;
+    // DIRTY_TILES: mapped list of the tiles that differ from the previous
+    // frame (DirtyTileHeader followed by DirtyTile[tileCount]) and the
+    // command buffer that copies just those tiles out
+    VkBuffer dirtyBuffer;
+    VkDeviceMemory dirtyBufferMemory;
+    void *dirty;
+    VkCommandBuffer copyCommandBuffer;
+    // PRERECORDED: the frame parameters, mapped, and whether commandBuffer
+    // already holds the frame
+    VkBuffer paramsBuffer;
+    VkDeviceMemory paramsBufferMemory;
+    void *params;
+    VkDescriptorSet paramsSet;
+    int recorded;
+    // READBACK_TO_FILE: the output file of the frame in this slot, mapped
+    // and imported as the copy destination.
+    int outputFd;
+    uint8_t *outputMap;
+    size_t outputMapSize;
+    size_t outputFileSize;
+    VkBuffer outputBuffer;
+    VkDeviceMemory outputBufferMemory;
+#endif
+    // Server mode: the connection that gets the answer (-1 otherwise) and
+    // where the pixels go.
+    int clientFd;
+    uint32_t output;
+    int shmFd;
+    char outputPath[sizeof(((RenderRequest *)0)->path)];
+    uint32_t frameIndex;
+} FrameSlot;
+
+#if RLE_READBACK
+// Layout of the RLE buffer written by rle_scan.comp and rle_emit.comp.
+typedef struct RleHeader {
+    uint32_t runCount;
+    uint32_t pad;
+} RleHeader;
+
+typedef struct RleRun {
+    uint32_t length; // pixels, runs never cross a row
+    uint32_t rgba;   // packUnorm4x8, R in the low byte
+} RleRun;
+#endif
+
+#if PALETTE_CLASSIFY
+// Layout of the palette buffer read by classify.comp, followed by
+// float[classCount][4]: the color in rgb, the tolerance in a.
+typedef struct PaletteHeader {
+    uint32_t classCount;
+    uint32_t bounds; // also find the bounding boxes
+    uint32_t pad[2];
+} PaletteHeader;
+
+// Layout of the class buffer written by classify.comp.
+typedef struct ClassResult {
+    uint32_t count;
+    uint32_t pad[3];
+    uint32_t box[4]; // ~minX, ~minY, maxX, maxY, so zero is an empty box
+} ClassResult;
+
+typedef struct ClassResults {
+    uint32_t unclassified;
+    uint32_t pad[3];
+    ClassResult classes[PALETTE_MAX_CLASSES];
+} ClassResults;
+#endif
+
+#if IMAGE_STATS
+// Layout of the statistics buffer written by stats.comp, 4 channels RGBA.
+typedef struct ImageStats {
+    uint32_t minInv[4]; // ~min, so zero is no pixel
+    uint32_t maxValue[4];
+    uint32_t sumLow[4]; // the sums of the 0-255 values, 64 bits
+    uint32_t sumHigh[4];
+    uint32_t histogram[4][256];
+} ImageStats;
+#endif
+
+#if DIRTY_TILES
+// Layout of the dirty tile list written by tile_diff.comp.
+typedef struct DirtyTileHeader {
+    uint32_t tileCount;
+    uint32_t pad;
+} DirtyTileHeader;
+
+typedef struct DirtyTile {
+    uint32_t x; // in tiles
+    uint32_t y;
+} DirtyTile;
+#endif
+
+typedef struct FrameWriter {
+    VkDevice device;
+    uint32_t frameCount;
+    uint32_t (*results)[4]; // batch mode: check.comp counters of every frame
+    SpscQueue queue;  // FrameSlot* from the render loop, NULL stops the thread
+    sem_t freeSlots;  // slots the render loop may record into again
+    VkSemaphore timeline; // VK_NULL_HANDLE when frames signal their fences
+    double waitMs;    // time spent waiting on the GPU
+    double writeMs;   // time spent serializing frames
+    double latencyMs; // summed time from recording a frame until it is written
+    double maxLatencyMs;
+    ImageFileFormat fileFormat;
+    uint64_t cpuBytes; // bytes the CPU copied or wrote for the images
+    VkQueryPool checkQueries; // VK_NULL_HANDLE when the check is not timed
+    float timestampPeriod;    // ns per timestamp tick
+    double checkMs;           // GPU time of the check dispatches
+    double classifyMs;        // and of the PALETTE_CLASSIFY one
+    double statsMs;           // and of the IMAGE_STATS one
+    VkQueryPool passQueries;  // around the render pass and the check, and the readback
+    double passMs;
+    double readbackMs;
+    int occlusion;                // OCCLUSION_CHECK when the device can, 0 otherwise
+    uint32_t occlusionMismatches; // frames where it and check.comp disagree
+#if HOST_IMAGE_COPY
+    // Set when the device supports host image copies, NULL otherwise.
+    PFN_vkCopyImageToMemoryEXT copyImageToMemory;
+    VkImage image;
+    sem_t imageFree;    // the render loop may draw into the image again
+    void *hostPixels;   // the one readback buffer, reused by every frame
+    double copyMs;      // time spent in vkCopyImageToMemoryEXT
+#endif
+#if RLE_READBACK
+    uint32_t *rleDecoded; // the one decode buffer, reused by every frame
+    uint64_t rleBytes;    // encoded bytes read back
+    double decodeMs;
+#endif
+#if DIRTY_TILES
+    uint8_t *framebuffer;   // RGBA8, the last frame with every dirty tile patched in
+    uint64_t dirtyTiles;    // tiles read back over the whole run
+#endif
+#if PALETTE_CLASSIFY
+    uint32_t classCount;
+#endif
+#if TILED
+    ImageStream poster;
+    uint64_t totals[4]; // check.comp counters summed over every tile
+#endif
+} FrameWriter;
+
+#if SECONDARY_RECORDING
+#define RECORD_THREADS_MAX 64
+
+typedef struct RecordWorker {
+    struct Recorder *recorder;
+    uint32_t index;
+    pthread_t thread;
+    VkCommandPool commandPool; // only ever touched by this thread
+    VkCommandBuffer commandBuffers[FRAMES_IN_FLIGHT]; // secondary, one per slot
+    double busyMs;             // recording, summed over frames
+} RecordWorker;
+
+// The render loop posts a frame, every worker records its share of the
+// draws and the last one to finish wakes the loop up again. The frame's
+// fields are only written while no worker is recording.
+typedef struct Recorder {
+    pthread_mutex_t lock;
+    pthread_cond_t posted;   // a new frame, or stopping
+    pthread_cond_t finished; // the last worker is done with the frame
+    uint64_t frame;          // bumped for every frame posted
+    uint32_t remaining;      // workers still recording it
+    int stopping;
+    VkResult result;         // the first error of the frame
+    uint32_t slot;
+    VkCommandBufferInheritanceInfo inheritance;
+    VkPipeline pipeline;
+    VkPipelineLayout layout;
+    VkBuffer vertexBuffer;
+    PushConstants pushConstants;
+    RecordWorker *workers;
+    uint32_t workerCount;
+} Recorder;
+#endif
+
+
 #define VK_CHECK(x)                                                              \
     do {                                                                         \
         VkResult err = x;                                                        \
@@ -40,65 +544,734 @@ typedef struct PushConstants {
         }                                                                        \
     } while (0)
 
-static uint32_t *
-readFile(const char *file, uint32_t *buffer_len)
+// The shaders this configuration uses, compiled in by build.sh.
+#if PRERECORDED
+#include "triangle_ubo.vert.spv.h"
+#include "check_ubo.comp.spv.h"
+static const ShaderCode triangleVertShader = SHADER_CODE("triangle_ubo.vert.spv", triangle_ubo_vert_spv);
+static const ShaderCode checkShader = SHADER_CODE("check_ubo.comp.spv", check_ubo_comp_spv);
+#else
+#include "triangle.vert.spv.h"
+static const ShaderCode triangleVertShader = SHADER_CODE("triangle.vert.spv", triangle_vert_spv);
+#if CHECK_REDUCTION == 1
+#include "check_reduce.comp.spv.h"
+#include "check_reduce_shared.comp.spv.h"
+// With subgroupAdd(), then through shared memory atomics alone.
+static const ShaderCode checkShaders[2] = {
+    SHADER_CODE("check_reduce.comp.spv", check_reduce_comp_spv),
+    SHADER_CODE("check_reduce_shared.comp.spv", check_reduce_shared_comp_spv),
+};
+#elif CHECK_REDUCTION == 2
+#include "check_partials.comp.spv.h"
+#include "check_partials_shared.comp.spv.h"
+#include "check_sum.comp.spv.h"
+static const ShaderCode checkShaders[2] = {
+    SHADER_CODE("check_partials.comp.spv", check_partials_comp_spv),
+    SHADER_CODE("check_partials_shared.comp.spv", check_partials_shared_comp_spv),
+};
+static const ShaderCode sumShader = SHADER_CODE("check_sum.comp.spv", check_sum_comp_spv);
+#else
+#include "check.comp.spv.h"
+static const ShaderCode checkShader = SHADER_CODE("check.comp.spv", check_comp_spv);
+#endif
+#endif
+#if SUBPASS_CHECK
+#include "check_subpass.vert.spv.h"
+#include "check_subpass.frag.spv.h"
+#include "check_subpass_atomic.frag.spv.h"
+static const ShaderCode subpassVertShader = SHADER_CODE("check_subpass.vert.spv", check_subpass_vert_spv);
+// With subgroupAdd(), then an atomic per pixel.
+static const ShaderCode subpassFragShaders[2] = {
+    SHADER_CODE("check_subpass.frag.spv", check_subpass_frag_spv),
+    SHADER_CODE("check_subpass_atomic.frag.spv", check_subpass_atomic_frag_spv),
+};
+#endif
+#include "triangle.frag.spv.h"
+static const ShaderCode triangleFragShader = SHADER_CODE("triangle.frag.spv", triangle_frag_spv);
+#if PACK_RGB24
+#include "pack_rgb.comp.spv.h"
+static const ShaderCode packShader = SHADER_CODE("pack_rgb.comp.spv", pack_rgb_comp_spv);
+#endif
+#if RLE_READBACK
+#include "rle_count.comp.spv.h"
+#include "rle_scan.comp.spv.h"
+#include "rle_emit.comp.spv.h"
+// Count runs per row, prefix sum the counts, emit the runs.
+static const ShaderCode rleShaders[3] = {
+    SHADER_CODE("rle_count.comp.spv", rle_count_comp_spv),
+    SHADER_CODE("rle_scan.comp.spv", rle_scan_comp_spv),
+    SHADER_CODE("rle_emit.comp.spv", rle_emit_comp_spv),
+};
+#endif
+#if DIRTY_TILES
+#include "tile_diff.comp.spv.h"
+static const ShaderCode diffShader = SHADER_CODE("tile_diff.comp.spv", tile_diff_comp_spv);
+#endif
+#if PALETTE_CLASSIFY
+#include "classify.comp.spv.h"
+static const ShaderCode classifyShader = SHADER_CODE("classify.comp.spv", classify_comp_spv);
+#endif
+#if IMAGE_STATS
+#include "stats.comp.spv.h"
+static const ShaderCode statsShader = SHADER_CODE("stats.comp.spv", stats_comp_spv);
+#endif
+
+// The pipeline behind job, waiting for the worker pool if it is still being
+// created. The first frame blocks here instead of setup.
+static VkPipeline
+usePipeline(PipelineCache *cache, PipelineJob *job)
 {
-    uint8_t *buffer = NULL;
-    int fd, ret, len = 0, pos = 0;
+    VK_CHECK(pipeline_cache_wait(cache, job));
+    return job->pipeline;
+}
 
-    fd = open(file, O_RDONLY);
-    if (fd < 0)
-        return NULL;
+// Helper function to create a shader module from the embedded SPIR-V
+static VkShaderModule
+createShaderModule(VkDevice device, const ShaderCode *shader)
+{
+    VkShaderModule shaderModule;
+    VK_CHECK(shader_code_create_module(device, shader, &shaderModule));
+    return shaderModule;
+}
+
+static double
+nowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+#if RLE_READBACK
+// Expand runs into pixelCount RGBA8 pixels. Returns -1 if the runs do not add
+// up to exactly pixelCount.
+static int
+rleDecode(uint32_t *dst, const RleRun *runs, uint32_t runCount, size_t pixelCount)
+{
+    size_t written = 0;
+
+    for (uint32_t i = 0; i < runCount; i++) {
+        uint32_t length = runs[i].length;
+        uint32_t rgba = runs[i].rgba;
+
+        if (length > pixelCount - written)
+            return -1;
+        for (uint32_t j = 0; j < length; j++)
+            dst[written + j] = rgba;
+        written += length;
+    }
+    return written == pixelCount ? 0 : -1;
+}
+#endif
+
+#if DIRTY_TILES
+// Copy the tiles packed one after the other in staging, DIFF_TILE_SIZE rows
+// of DIFF_TILE_SIZE pixels each, into their place in the RGBA8 framebuffer.
+// Tiles on the right and bottom edges are cut to the image.
+static void
+patchDirtyTiles(uint8_t *framebuffer, const uint8_t *staging, const DirtyTile *tiles, uint32_t tileCount)
+{
+    const size_t tileBytes = DIFF_TILE_SIZE * DIFF_TILE_SIZE * 4;
+
+    for (uint32_t i = 0; i < tileCount; i++) {
+        uint32_t x0 = tiles[i].x * DIFF_TILE_SIZE, y0 = tiles[i].y * DIFF_TILE_SIZE;
+        uint32_t width = IMAGE_WIDTH - x0 < DIFF_TILE_SIZE ? IMAGE_WIDTH - x0 : DIFF_TILE_SIZE;
+        uint32_t height = IMAGE_HEIGHT - y0 < DIFF_TILE_SIZE ? IMAGE_HEIGHT - y0 : DIFF_TILE_SIZE;
+        const uint8_t *src = staging + i * tileBytes;
+
+        for (uint32_t y = 0; y < height; y++)
+            memcpy(framebuffer + ((size_t)(y0 + y) * IMAGE_WIDTH + x0) * 4,
+                   src + (size_t)y * DIFF_TILE_SIZE * 4, (size_t)width * 4);
+    }
+}
+#endif
+
+static void
+framePath(char *path, size_t size, uint32_t frame, uint32_t frameCount, const char *ext)
+{
+    if (frameCount == 1)
+        snprintf(path, size, "output.%s", ext);
+    else
+        snprintf(path, size, "output_%04u.%s", frame, ext);
+}
 
-    do {
-        if (len == pos) {
-            len += 512;
-            buffer = realloc(buffer, len);
-            if (!buffer)
-                goto realloc_error;
+// Parse "a,b,c" into up to 4 floats, the rest keep their value. dst is a
+// vec4 of the packed PushConstants, hence the memcpy.
+static int
+parseFloats(const char *value, void *dst)
+{
+    float v[4];
+    char *end;
+
+    memcpy(v, dst, sizeof(v));
+    for (uint32_t i = 0; i < 4; i++) {
+        v[i] = strtof(value, &end);
+        if (end == value)
+            return -1;
+        if (*end != ',') {
+            if (*end)
+                return -1;
+            memcpy(dst, v, sizeof(v));
+            return 0;
         }
+        value = end + 1;
+    }
+    return -1;
+}
 
-        ret = read(fd, buffer + pos, len - pos);
-        if (ret == 0)
-            break;
-        if (ret < 0)
-            goto error_reading;
+// Read the per-frame push constants of a batch file, see FRAME_COUNT.
+// Every frame starts out as defaults. Returns NULL on error.
+static PushConstants *
+loadBatch(const char *path, const PushConstants *defaults, uint32_t *count)
+{
+    FILE *fp = fopen(path, "r");
+    PushConstants *frames = NULL;
+    uint32_t capacity = 0, line = 0;
+    char buf[1024];
+
+    if (!fp) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    *count = 0;
+    while (fgets(buf, sizeof(buf), fp)) {
+        char *save, *field = strtok_r(buf, " \t\r\n", &save);
+        line++;
+
+        if (!field || field[0] == '#')
+            continue;
 
-        pos += ret;
-    } while (1);
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            PushConstants *grown = realloc(frames, sizeof(PushConstants) * capacity);
+            if (!grown)
+                goto error;
+            frames = grown;
+        }
 
-realloc_error:
-    close(fd);
-    *buffer_len = pos;
-    return (uint32_t *)buffer;
+        PushConstants *frame = &frames[(*count)++];
+        *frame = *defaults;
+
+        for (; field; field = strtok_r(NULL, " \t\r\n", &save)) {
+            char *value = strchr(field, '=');
+            uint32_t test;
+            int ret = -1;
+
+            if (value) {
+                *value++ = '\0';
+                if (!strcmp(field, "vertex_offset"))
+                    ret = parseFloats(value, frame->vertex_offset);
+                else if (!strcmp(field, "color_offset"))
+                    ret = parseFloats(value, frame->color_offset);
+                else if (!strcmp(field, "color"))
+                    ret = parseFloats(value, frame->color);
+                else if (!strcmp(field, "test") && sscanf(value, "%u", &test) == 1) {
+                    frame->test = test;
+                    ret = 0;
+                }
+            }
+            if (ret) {
+                fprintf(stderr, "%s:%u: invalid field \"%s\"\n", path, line, field);
+                goto error;
+            }
+        }
+    }
 
-error_reading:
-    free(buffer);
-    close(fd);
+    if (*count == 0) {
+        fprintf(stderr, "%s has no frames\n", path);
+        goto error;
+    }
+    fclose(fp);
+    return frames;
+
+error:
+    free(frames);
+    fclose(fp);
     return NULL;
 }
 
-// Helper function to create a shader module from SPIR-V bytecode
-VkShaderModule createShaderModule(VkDevice device, const char *file) {
-    VkShaderModuleCreateInfo createInfo = {};
-    uint32_t *buffer;
-    uint32_t buffer_len;
+#if PALETTE_CLASSIFY
+// Read the classes of a palette file, see PALETTE_CLASSIFY, into colors:
+// rgb and the tolerance in a. Returns the number of classes, 0 on error.
+static uint32_t
+loadPalette(const char *path, float (*colors)[4])
+{
+    FILE *fp = fopen(path, "r");
+    uint32_t count = 0, line = 0;
+    char buf[1024];
 
-    buffer = readFile(file, &buffer_len);
-    if (!buffer) {
-        printf("Failed to read shader bytecode!\n");
-        return NULL;
+    if (!fp) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 0;
     }
 
-    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = buffer_len;
-    createInfo.pCode = buffer;
+    while (fgets(buf, sizeof(buf), fp)) {
+        char *save, *field = strtok_r(buf, " \t\r\n", &save);
+        line++;
 
-    VkShaderModule shaderModule;
-    VK_CHECK(vkCreateShaderModule(device, &createInfo, NULL, &shaderModule));
-    return shaderModule;
+        if (!field || field[0] == '#')
+            continue;
+
+        if (count == PALETTE_MAX_CLASSES) {
+            fprintf(stderr, "%s:%u: more than %u classes\n", path, line, PALETTE_MAX_CLASSES);
+            goto error;
+        }
+
+        float *class = colors[count++];
+        float tolerance = 0.1f;
+        memset(class, 0, sizeof(float) * 4);
+
+        for (; field; field = strtok_r(NULL, " \t\r\n", &save)) {
+            char *value = strchr(field, '=');
+            int ret = -1;
+
+            if (value) {
+                *value++ = '\0';
+                if (!strcmp(field, "color"))
+                    ret = parseFloats(value, class);
+                else if (!strcmp(field, "tolerance") && sscanf(value, "%f", &tolerance) == 1)
+                    ret = 0;
+            }
+            if (ret) {
+                fprintf(stderr, "%s:%u: invalid field \"%s\"\n", path, line, field);
+                goto error;
+            }
+        }
+        class[3] = tolerance;
+    }
+
+    if (count == 0)
+        fprintf(stderr, "%s has no classes\n", path);
+    fclose(fp);
+    return count;
+
+error:
+    fclose(fp);
+    return 0;
+}
+
+// Print the classes of a frame that have any pixels.
+static void
+printClasses(uint32_t frame, const ClassResults *results, uint32_t classCount)
+{
+    printf("Frame %u classes: %u pixels unclassified\n", frame, results->unclassified);
+    for (uint32_t i = 0; i < classCount; i++) {
+        const ClassResult *class = &results->classes[i];
+        if (!class->count)
+            continue;
+        if (PALETTE_CLASSIFY == 2)
+            printf("  class %u: %u pixels in (%u,%u)-(%u,%u)\n", i, class->count,
+                   ~class->box[0], ~class->box[1], class->box[2], class->box[3]);
+        else
+            printf("  class %u: %u pixels\n", i, class->count);
+    }
+}
+#endif
+
+#if IMAGE_STATS
+// Print the statistics of a frame, one line per channel. The median is the
+// first histogram bin that reaches half of the pixels.
+static void
+printStats(uint32_t frame, const ImageStats *stats)
+{
+    static const char channels[4] = { 'R', 'G', 'B', 'A' };
+    const uint64_t pixels = (uint64_t)IMAGE_WIDTH * IMAGE_HEIGHT;
+
+    for (uint32_t c = 0; c < 4; c++) {
+        uint64_t sum = (uint64_t)stats->sumHigh[c] << 32 | stats->sumLow[c];
+        uint64_t seen = 0;
+        uint32_t median = 0;
+
+        for (; median < 255; median++) {
+            seen += stats->histogram[c][median];
+            if (seen * 2 >= pixels)
+                break;
+        }
+        printf("Frame %u %c: min %u max %u mean %.2f median %u\n", frame, channels[c],
+               ~stats->minInv[c], stats->maxValue[c], (double)sum / pixels, median);
+    }
+}
+#endif
+
+// The GPU already wrote the pixels into the page cache, drop the import and
+// the mapping and trim the alignment slack off the end of the file.
+static int
+finishOutputFile(VkDevice device, FrameSlot *slot, const char *path)
+{
+    int ret = 0;
+
+    // The import has to go before the pages it points at.
+    vkDestroyBuffer(device, slot->outputBuffer, NULL);
+    vkFreeMemory(device, slot->outputBufferMemory, NULL);
+    munmap(slot->outputMap, slot->outputMapSize);
+
+    if (ftruncate(slot->outputFd, slot->outputFileSize)) {
+        fprintf(stderr, "Failed to truncate %s: %s\n", path, strerror(errno));
+        ret = -1;
+    }
+    close(slot->outputFd);
+
+    slot->outputBuffer = VK_NULL_HANDLE;
+    slot->outputBufferMemory = VK_NULL_HANDLE;
+    slot->outputMap = NULL;
+    return ret;
+}
+
+// Submit commandBuffer as (the next step of) the frame in slot. With a
+// timeline it signals the next value, which becomes the one the frame is
+// waited on with; otherwise the slot's fence is reset and signaled.
+static void
+submitFrame(VkDevice device, VkQueue queue, VkCommandBuffer commandBuffer, FrameSlot *slot,
+            VkSemaphore timeline, uint64_t *timelineValue)
+{
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+
+    if (timeline) {
+        slot->timelineValue = ++*timelineValue;
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &slot->timelineValue;
+
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &timeline;
+        VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+    } else {
+        VK_CHECK(vkResetFences(device, 1, &slot->fence));
+        VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, slot->fence));
+    }
+}
+
+// Block until the last submission of the frame in slot has finished.
+static void
+waitForFrame(VkDevice device, VkSemaphore timeline, const FrameSlot *slot)
+{
+    if (timeline) {
+        VkSemaphoreWaitInfo waitInfo = {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &timeline;
+        waitInfo.pValues = &slot->timelineValue;
+        VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+    } else {
+        VK_CHECK(vkWaitForFences(device, 1, &slot->fence, VK_TRUE, UINT64_MAX));
+    }
+}
+
+// Server mode: hand the frame in slot to where its request asked for it and
+// send the check.comp counts back. Closes the slot's descriptors.
+static void
+answerRequest(FrameWriter *writer, FrameSlot *slot, const void *pixels)
+{
+    const size_t size = (size_t)IMAGE_WIDTH * IMAGE_HEIGHT * READBACK_CHANNELS;
+    RenderResponse response = {};
+    response.width = IMAGE_WIDTH;
+    response.height = IMAGE_HEIGHT;
+    response.channels = READBACK_CHANNELS;
+    memcpy(response.counts, slot->results, sizeof(response.counts));
+
+    if (slot->output == RENDER_OUTPUT_FILE) {
+        if (image_writer_write(slot->outputPath, pixels, PACK_RGB24 ? IMAGE_PIXEL_RGB8 : IMAGE_PIXEL_RGBA8,
+                               writer->fileFormat, IMAGE_WIDTH, IMAGE_HEIGHT, 0))
+            response.status = -EIO;
+        writer->cpuBytes += (uint64_t)IMAGE_WIDTH * IMAGE_HEIGHT * 3 * (PACK_RGB24 ? 1 : 2);
+    } else if (slot->output == RENDER_OUTPUT_SHM) {
+        struct stat st;
+        void *map = MAP_FAILED;
+
+        if (fstat(slot->shmFd, &st) || (size_t)st.st_size < size)
+            response.status = -EINVAL;
+        else if ((map = mmap(NULL, size, PROT_WRITE, MAP_SHARED, slot->shmFd, 0)) == MAP_FAILED)
+            response.status = -errno;
+        if (map != MAP_FAILED) {
+            memcpy(map, pixels, size);
+            munmap(map, size);
+            writer->cpuBytes += size;
+        }
+        close(slot->shmFd);
+    }
+
+    if (render_send(slot->clientFd, &response, sizeof(response), -1))
+        fprintf(stderr, "Frame %u: failed to answer the request: %s\n", slot->frameIndex, strerror(errno));
+    close(slot->clientFd);
+    slot->clientFd = -1;
+    slot->shmFd = -1;
+}
+
+static void *
+frameWriterThread(void *arg)
+{
+    FrameWriter *writer = arg;
+    FrameSlot *slot;
+
+    while ((slot = spsc_queue_pop(&writer->queue))) {
+        double start = nowMs();
+        waitForFrame(writer->device, writer->timeline, slot);
+        double ready = nowMs();
+
+        uint64_t timestamps[CHECK_QUERIES];
+        if (writer->checkQueries &&
+            vkGetQueryPoolResults(writer->device, writer->checkQueries, slot->firstQuery, CHECK_QUERIES,
+                                  sizeof(timestamps), timestamps, sizeof(timestamps[0]),
+                                  VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            writer->checkMs += (timestamps[1] - timestamps[0]) * writer->timestampPeriod / 1000000.0;
+            if (PALETTE_CLASSIFY)
+                writer->classifyMs += (timestamps[2] - timestamps[1]) * writer->timestampPeriod / 1000000.0;
+            if (IMAGE_STATS)
+                writer->statsMs += (timestamps[CHECK_QUERIES - 1] - timestamps[CHECK_QUERIES - 2]) *
+                                   writer->timestampPeriod / 1000000.0;
+        }
+
+        uint64_t passTimestamps[PASS_QUERIES];
+        if (writer->passQueries &&
+            vkGetQueryPoolResults(writer->device, writer->passQueries, slot->firstQuery / CHECK_QUERIES * PASS_QUERIES,
+                                  PASS_QUERIES, sizeof(passTimestamps), passTimestamps, sizeof(passTimestamps[0]),
+                                  VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            writer->passMs += (passTimestamps[1] - passTimestamps[0]) * writer->timestampPeriod / 1000000.0;
+            writer->readbackMs += (passTimestamps[3] - passTimestamps[2]) * writer->timestampPeriod / 1000000.0;
+        }
+
+        if (writer->occlusion == 1) {
+            // No check.comp ran, the samples are the triangle.
+            slot->results[0] = slot->results[4];
+            slot->results[1] = IMAGE_WIDTH * IMAGE_HEIGHT - slot->results[4];
+            slot->results[2] = IMAGE_WIDTH * IMAGE_HEIGHT;
+        } else if (writer->occlusion == 2 && slot->results[0] != slot->results[4]) {
+            printf("Frame %u: occlusion query counted %u samples, check.comp %u pixels\n", slot->frameIndex,
+                   slot->results[4], slot->results[0]);
+            writer->occlusionMismatches++;
+        }
+
+#if HOST_IMAGE_COPY
+        if (writer->copyImageToMemory) {
+            VkImageToMemoryCopyEXT region = {};
+            region.sType = VK_STRUCTURE_TYPE_IMAGE_TO_MEMORY_COPY_EXT;
+            region.pHostPointer = writer->hostPixels;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.layerCount = 1;
+            region.imageExtent.width = IMAGE_WIDTH;
+            region.imageExtent.height = IMAGE_HEIGHT;
+            region.imageExtent.depth = 1;
+
+            VkCopyImageToMemoryInfoEXT copyInfo = {};
+            copyInfo.sType = VK_STRUCTURE_TYPE_COPY_IMAGE_TO_MEMORY_INFO_EXT;
+            copyInfo.srcImage = writer->image;
+            copyInfo.srcImageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            copyInfo.regionCount = 1;
+            copyInfo.pRegions = &region;
+
+            VK_CHECK(writer->copyImageToMemory(writer->device, &copyInfo));
+            writer->copyMs += nowMs() - ready;
+            sem_post(&writer->imageFree);
+            slot->pixels = writer->hostPixels;
+        }
+#endif
+#if RLE_READBACK
+        const RleHeader *rleHeader = slot->rle;
+        size_t rleBytes = sizeof(RleHeader) + (size_t)rleHeader->runCount * sizeof(RleRun);
+        double decodeStart = nowMs();
+        if (rleDecode(writer->rleDecoded, (const RleRun *)(rleHeader + 1), rleHeader->runCount,
+                      (size_t)IMAGE_WIDTH * IMAGE_HEIGHT))
+            fprintf(stderr, "Frame %u: RLE stream does not cover the image!\n", slot->frameIndex);
+        writer->decodeMs += nowMs() - decodeStart;
+        writer->rleBytes += rleBytes;
+        slot->pixels = writer->rleDecoded;
+#if !TILED
+        printf("Frame %u RLE: %u runs, %zu bytes read back, %.2f%% of RGBA8\n", slot->frameIndex,
+               rleHeader->runCount, rleBytes, 100.0 * rleBytes / ((size_t)IMAGE_WIDTH * IMAGE_HEIGHT * 4));
+#endif
+#endif
+
+#if DIRTY_TILES
+        const DirtyTileHeader *dirtyHeader = slot->dirty;
+        patchDirtyTiles(writer->framebuffer, slot->pixels, (const DirtyTile *)(dirtyHeader + 1),
+                        dirtyHeader->tileCount);
+        writer->dirtyTiles += dirtyHeader->tileCount;
+        writer->cpuBytes += (uint64_t)dirtyHeader->tileCount * DIFF_TILE_SIZE * DIFF_TILE_SIZE * 4;
+        printf("Frame %u: %u of %u tiles dirty, %zu bytes read back\n", slot->frameIndex,
+               dirtyHeader->tileCount, DIFF_TILE_COUNT,
+               (size_t)dirtyHeader->tileCount * DIFF_TILE_SIZE * DIFF_TILE_SIZE * 4);
+#endif
+
+#if TILED
+        uint32_t tileX = slot->frameIndex % TILES_X;
+        uint32_t tileY = slot->frameIndex / TILES_X;
+
+        for (uint32_t i = 0; i < 4; i++)
+            writer->totals[i] += slot->results[i];
+
+        image_writer_stream_write_tile(&writer->poster, slot->pixels, PACK_RGB24 ? IMAGE_PIXEL_RGB8 : IMAGE_PIXEL_RGBA8,
+                                       tileX * IMAGE_WIDTH, tileY * IMAGE_HEIGHT, IMAGE_WIDTH, IMAGE_HEIGHT, 0);
+        writer->cpuBytes += (uint64_t)IMAGE_WIDTH * IMAGE_HEIGHT * 3 * (PACK_RGB24 ? 1 : 2);
+#else
+        if (writer->results)
+            memcpy(writer->results[slot->frameIndex], slot->results, sizeof(writer->results[0]));
+        printf("Frame %u Compute Shader Result: triangleCount: %u backgroundCount: %u totalCount: %u test: %u\n",
+               slot->frameIndex, slot->results[0], slot->results[1], slot->results[2], slot->results[3]);
+#if PALETTE_CLASSIFY
+        printClasses(slot->frameIndex, slot->classes, writer->classCount);
+#endif
+#if IMAGE_STATS
+        printStats(slot->frameIndex, slot->stats);
+#endif
+#endif
+
+#if DO_COPY && !TILED
+#if DIRTY_TILES
+        // The staging buffer only holds the tiles of this frame.
+        const void *pixels = writer->framebuffer;
+#else
+        const void *pixels = slot->pixels;
+#endif
+        char path[64];
+        if (slot->outputMap) {
+            framePath(path, sizeof(path), slot->frameIndex, writer->frameCount, "pam");
+            if (finishOutputFile(writer->device, slot, path) == 0)
+                printf("Rendered image saved to %s\n", path);
+        } else if (slot->clientFd >= 0) {
+            answerRequest(writer, slot, pixels);
+        } else {
+            framePath(path, sizeof(path), slot->frameIndex, writer->frameCount,
+                      image_writer_format_extension(writer->fileFormat));
+
+            if (image_writer_write(path, pixels, PACK_RGB24 ? IMAGE_PIXEL_RGB8 : IMAGE_PIXEL_RGBA8, writer->fileFormat,
+                                   IMAGE_WIDTH, IMAGE_HEIGHT, 0) == 0)
+                printf("Rendered image saved to %s\n", path);
+            // Repacked or encoded into a scratch buffer, then copied into
+            // the page cache by write(). Packed RGB24 skips the repack.
+            writer->cpuBytes += (uint64_t)IMAGE_WIDTH * IMAGE_HEIGHT * 3 * (PACK_RGB24 ? 1 : 2);
+        }
+#endif
+
+        double done = nowMs();
+        writer->waitMs += ready - start;
+        writer->writeMs += done - ready;
+        writer->latencyMs += done - slot->startMs;
+        if (done - slot->startMs > writer->maxLatencyMs)
+            writer->maxLatencyMs = done - slot->startMs;
+        sem_post(&writer->freeSlots);
+    }
+    return NULL;
+}
+
+#if DRAW_COUNT > 1 || SECONDARY_RECORDING
+// Record draws [first, end) of the DRAW_COUNT grid. Each one puts the
+// triangle into its cell through tile_transform, composed with the frame's
+// transform so tiled rendering still works.
+static void
+recordDraws(VkCommandBuffer commandBuffer, VkPipelineLayout layout, const PushConstants *frameConstants,
+            uint32_t first, uint32_t end)
+{
+    float frameTransform[4];
+    memcpy(frameTransform, frameConstants->tile_transform, sizeof(frameTransform)); // packed
+    uint32_t side = 1;
+    while ((uint64_t)side * side < DRAW_COUNT)
+        side++;
+    float scale = 1.0f / side;
+
+    for (uint32_t i = first; i < end; i++) {
+        float cellX = -1.0f + (2.0f * (i % side) + 1.0f) * scale;
+        float cellY = -1.0f + (2.0f * (i / side) + 1.0f) * scale;
+        float transform[4] = {
+            scale * frameTransform[0],
+            scale * frameTransform[1],
+            cellX * frameTransform[0] + frameTransform[2],
+            cellY * frameTransform[1] + frameTransform[3],
+        };
+        vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                           offsetof(PushConstants, tile_transform), sizeof(transform), transform);
+        vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+    }
+}
+#endif
+
+#if SECONDARY_RECORDING
+// Record this worker's share of the posted frame into its buffer of the
+// slot. Secondaries inherit no state, so each one binds everything itself.
+static VkResult
+recordShare(RecordWorker *worker)
+{
+    Recorder *recorder = worker->recorder;
+    uint32_t first = (uint64_t)DRAW_COUNT * worker->index / recorder->workerCount;
+    uint32_t end = (uint64_t)DRAW_COUNT * (worker->index + 1) / recorder->workerCount;
+    VkCommandBuffer commandBuffer = worker->commandBuffers[recorder->slot];
+    double start = nowMs();
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &recorder->inheritance;
+
+    VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    if (result != VK_SUCCESS)
+        return result;
+
+    VkDeviceSize offset = 0;
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, recorder->pipeline);
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &recorder->vertexBuffer, &offset);
+    vkCmdPushConstants(commandBuffer, recorder->layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                       0, sizeof(PushConstants), &recorder->pushConstants);
+    recordDraws(commandBuffer, recorder->layout, &recorder->pushConstants, first, end);
+
+    result = vkEndCommandBuffer(commandBuffer);
+    worker->busyMs += nowMs() - start;
+    return result;
 }
 
+static void *
+recordWorkerThread(void *arg)
+{
+    RecordWorker *worker = arg;
+    Recorder *recorder = worker->recorder;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&recorder->lock);
+    for (;;) {
+        while (recorder->frame == seen && !recorder->stopping)
+            pthread_cond_wait(&recorder->posted, &recorder->lock);
+        if (recorder->stopping)
+            break;
+        seen = recorder->frame;
+        pthread_mutex_unlock(&recorder->lock);
+
+        VkResult result = recordShare(worker);
+
+        pthread_mutex_lock(&recorder->lock);
+        if (result != VK_SUCCESS && recorder->result == VK_SUCCESS)
+            recorder->result = result;
+        if (--recorder->remaining == 0)
+            pthread_cond_signal(&recorder->finished);
+    }
+    pthread_mutex_unlock(&recorder->lock);
+    return NULL;
+}
+
+// Have the workers record the draws of the frame in slot and wait for them.
+static VkResult
+recordSecondaries(Recorder *recorder, uint32_t slot, VkPipeline pipeline, const PushConstants *pushConstants)
+{
+    pthread_mutex_lock(&recorder->lock);
+    recorder->slot = slot;
+    recorder->pipeline = pipeline;
+    recorder->pushConstants = *pushConstants;
+    recorder->result = VK_SUCCESS;
+    recorder->remaining = recorder->workerCount;
+    recorder->frame++;
+    pthread_cond_broadcast(&recorder->posted);
+    while (recorder->remaining)
+        pthread_cond_wait(&recorder->finished, &recorder->lock);
+    VkResult result = recorder->result;
+    pthread_mutex_unlock(&recorder->lock);
+    return result;
+}
+#endif
+
 // Helper function to find a memory type index
 uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
     VkPhysicalDeviceMemoryProperties memProperties;
@@ -115,7 +1288,278 @@ uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, Vk
     abort();
 }
 
-int main() {
+static int
+hasDeviceExtension(VkPhysicalDevice physicalDevice, const char *name)
+{
+    uint32_t count = 0;
+    int found = 0;
+
+    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &count, NULL);
+    VkExtensionProperties *extensions = malloc(sizeof(VkExtensionProperties) * count);
+    if (!extensions)
+        return 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &count, extensions);
+
+    for (uint32_t i = 0; i < count && !found; i++)
+        found = !strcmp(extensions[i].extensionName, name);
+
+    free(extensions);
+    return found;
+}
+
+// Size path for a PAM header padded to one alignment unit plus the
+// payload, map it, write the header and import the rest as the buffer the
+// image is copied into.
+static int
+importOutputFile(VkDevice device, VkPhysicalDevice physicalDevice,
+                 PFN_vkGetMemoryHostPointerPropertiesEXT getMemoryHostPointerProperties,
+                 VkDeviceSize alignment, FrameSlot *slot, const char *path)
+{
+    const size_t payloadSize = (size_t)IMAGE_WIDTH * IMAGE_HEIGHT * READBACK_CHANNELS;
+    const size_t importSize = (payloadSize + alignment - 1) & ~(alignment - 1);
+    const size_t mapSize = alignment + importSize;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s for writing: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, mapSize)) {
+        fprintf(stderr, "Failed to size %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    uint8_t *map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    // mmap only guarantees page alignment.
+    if ((uintptr_t)map & (alignment - 1)) {
+        fprintf(stderr, "Mapping of %s is not aligned to %llu bytes\n", path, (unsigned long long)alignment);
+        munmap(map, mapSize);
+        close(fd);
+        return -1;
+    }
+
+    if (!image_writer_pam_header((char *)map, alignment, IMAGE_WIDTH, IMAGE_HEIGHT, READBACK_CHANNELS, alignment)) {
+        fprintf(stderr, "PAM header does not fit in %llu bytes\n", (unsigned long long)alignment);
+        munmap(map, mapSize);
+        close(fd);
+        return -1;
+    }
+
+    VkMemoryHostPointerPropertiesEXT hostPointerProperties = {};
+    hostPointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+    VK_CHECK(getMemoryHostPointerProperties(device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+                                            map + alignment, &hostPointerProperties));
+
+    VkExternalMemoryBufferCreateInfo externalBufferInfo = {};
+    externalBufferInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+    externalBufferInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.pNext = &externalBufferInfo;
+    bufferInfo.size = payloadSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VK_CHECK(vkCreateBuffer(device, &bufferInfo, NULL, &slot->outputBuffer));
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, slot->outputBuffer, &memRequirements);
+
+    VkImportMemoryHostPointerInfoEXT importInfo = {};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    importInfo.pHostPointer = map + alignment;
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = &importInfo;
+    allocInfo.allocationSize = importSize;
+    allocInfo.memoryTypeIndex = findMemoryType(physicalDevice,
+                                               memRequirements.memoryTypeBits & hostPointerProperties.memoryTypeBits,
+                                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    VK_CHECK(vkAllocateMemory(device, &allocInfo, NULL, &slot->outputBufferMemory));
+    vkBindBufferMemory(device, slot->outputBuffer, slot->outputBufferMemory, 0);
+
+    slot->outputFd = fd;
+    slot->outputMap = map;
+    slot->outputMapSize = mapSize;
+    slot->outputFileSize = alignment + payloadSize;
+    return 0;
+}
+
+// Timeline semaphores are core in Vulkan 1.2, but still an optional feature
+// there.
+static int
+timelineSemaphoreUsable(VkPhysicalDevice physicalDevice)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    if (properties.apiVersion < VK_API_VERSION_1_2)
+        return 0;
+
+    VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &vulkan12Features;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+    return vulkan12Features.timelineSemaphore;
+}
+
+// check.comp's subgroupAdd() needs arithmetic subgroup operations in compute
+// shaders, check_subpass.frag's also ballots in fragment shaders. Vulkan 1.1
+// only guarantees the basic ones in compute.
+static int
+subgroupOperationsUsable(VkPhysicalDevice physicalDevice, VkShaderStageFlags stage, VkSubgroupFeatureFlags operations)
+{
+    VkPhysicalDeviceSubgroupProperties subgroupProperties = {};
+    subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties2 = {};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &subgroupProperties;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+    return (subgroupProperties.supportedStages & stage) &&
+           (subgroupProperties.supportedOperations & operations) == operations;
+}
+
+// An occlusion query only counts the samples when it can be precise,
+// otherwise any nonzero number may come back.
+static int
+occlusionQueryUsable(VkPhysicalDevice physicalDevice)
+{
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+    return features.occlusionQueryPrecise;
+}
+
+// VK_EXT_host_image_copy is only used when the device can copy the offscreen
+// image out of VK_IMAGE_LAYOUT_GENERAL, which is where the frame leaves it.
+static int
+hostImageCopyUsable(VkPhysicalDevice physicalDevice)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    if (properties.apiVersion < VK_API_VERSION_1_3 ||
+        !hasDeviceExtension(physicalDevice, VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME))
+        return 0;
+
+    VkPhysicalDeviceHostImageCopyFeaturesEXT hostImageCopyFeatures = {};
+    hostImageCopyFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &hostImageCopyFeatures;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+    if (!hostImageCopyFeatures.hostImageCopy)
+        return 0;
+
+    VkImageLayout srcLayouts[64];
+    VkPhysicalDeviceHostImageCopyPropertiesEXT hostImageCopyProperties = {};
+    hostImageCopyProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT;
+    hostImageCopyProperties.copySrcLayoutCount = 64;
+    hostImageCopyProperties.pCopySrcLayouts = srcLayouts;
+    VkPhysicalDeviceProperties2 properties2 = {};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &hostImageCopyProperties;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+    int general = 0;
+    for (uint32_t i = 0; i < hostImageCopyProperties.copySrcLayoutCount; i++)
+        general |= srcLayouts[i] == VK_IMAGE_LAYOUT_GENERAL;
+    if (!general)
+        return 0;
+
+    VkPhysicalDeviceImageFormatInfo2 formatInfo = {};
+    formatInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2;
+    formatInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    formatInfo.type = VK_IMAGE_TYPE_2D;
+    formatInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    formatInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+                       VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+    VkImageFormatProperties2 formatProperties = {};
+    formatProperties.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
+    return vkGetPhysicalDeviceImageFormatProperties2(physicalDevice, &formatInfo, &formatProperties) == VK_SUCCESS;
+}
+
+// Wait until every slot is back from the GPU and the writer.
+static void
+drainFrameWriter(FrameWriter *writer)
+{
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++)
+        while (sem_wait(&writer->freeSlots) && errno == EINTR)
+            ;
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++)
+        sem_post(&writer->freeSlots);
+}
+
+// Server mode: block until the next valid render request arrives, accepting
+// a new connection whenever the current one is closed. Requests that are
+// not rendered are answered right here, after the frames still in flight so
+// the answers stay in order. Returns 0 for a frame to render, 1 once a
+// client asked for a shutdown and -1 if the socket failed.
+static int
+nextRenderRequest(int listenFd, int *clientFd, RenderRequest *request, int *shmFd, FrameWriter *writer)
+{
+    for (;;) {
+        if (*clientFd < 0) {
+            *clientFd = accept(listenFd, NULL, NULL);
+            if (*clientFd < 0) {
+                if (errno == EINTR)
+                    continue;
+                fprintf(stderr, "Failed to accept a connection: %s\n", strerror(errno));
+                return -1;
+            }
+        }
+
+        *shmFd = -1;
+        if (render_recv(*clientFd, request, sizeof(*request), shmFd) <= 0) {
+            // Closed or broken, the slots hold their own descriptors.
+            if (*shmFd >= 0)
+                close(*shmFd);
+            close(*clientFd);
+            *clientFd = -1;
+            continue;
+        }
+
+        RenderResponse response = {};
+        response.width = IMAGE_WIDTH;
+        response.height = IMAGE_HEIGHT;
+        response.channels = READBACK_CHANNELS;
+
+        if (request->magic != RENDER_PROTOCOL_MAGIC || request->output > RENDER_SHUTDOWN)
+            response.status = -EPROTO;
+        else if ((request->width || request->height) &&
+                 (request->width != IMAGE_WIDTH || request->height != IMAGE_HEIGHT))
+            response.status = -EINVAL; // the offscreen image is sized at build time
+        else if (request->output == RENDER_OUTPUT_SHM && *shmFd < 0)
+            response.status = -EBADF;
+        else if (request->output != RENDER_SHUTDOWN) {
+            request->path[sizeof(request->path) - 1] = '\0';
+            return 0;
+        }
+
+        drainFrameWriter(writer);
+        render_send(*clientFd, &response, sizeof(response), -1);
+        if (*shmFd >= 0)
+            close(*shmFd);
+        if (request->output == RENDER_SHUTDOWN && response.status == 0) {
+            close(*clientFd);
+            *clientFd = -1;
+            return 1;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    double setupStart = nowMs();
+
     // 1. Vulkan Instance Creation
     VkApplicationInfo appInfo = {};
     appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -123,7 +1567,10 @@ int main() {
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    // Timeline semaphores are core in 1.2, external memory and
+    // vkGetPhysicalDeviceProperties2 in 1.1. VK_EXT_host_image_copy builds on
+    // 1.3 (copy_commands2, format_feature_flags2).
+    appInfo.apiVersion = HOST_IMAGE_COPY ? VK_API_VERSION_1_3 : VK_API_VERSION_1_2;
 
     VkInstanceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -185,12 +1632,115 @@ int main() {
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
     deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pEnabledFeatures = NULL; // No specific device features needed
+    VkPhysicalDeviceFeatures enabledFeatures = {};
+    deviceCreateInfo.pEnabledFeatures = &enabledFeatures;
+
+    const char *deviceExtensions[5];
+    uint32_t deviceExtensionCount = 0;
+
+    const char *hostMemoryExtension = VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME;
+    int useFileImport = READBACK_TO_FILE && hasDeviceExtension(physicalDevice, hostMemoryExtension);
+    if (useFileImport)
+        deviceExtensions[deviceExtensionCount++] = hostMemoryExtension;
+    else if (READBACK_TO_FILE)
+        printf("%s not supported, reading back through a staging buffer.\n", hostMemoryExtension);
+
+    VkPhysicalDeviceHostImageCopyFeaturesEXT hostImageCopyFeatures = {};
+    hostImageCopyFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+    hostImageCopyFeatures.hostImageCopy = VK_TRUE;
+
+    int useHostImageCopy = HOST_IMAGE_COPY && hostImageCopyUsable(physicalDevice);
+    if (useHostImageCopy) {
+        deviceExtensions[deviceExtensionCount++] = VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME;
+        deviceCreateInfo.pNext = &hostImageCopyFeatures;
+    } else if (HOST_IMAGE_COPY) {
+        printf("%s not usable, reading back through a staging buffer.\n", VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+    }
+
+    VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan12Features.timelineSemaphore = VK_TRUE;
+
+    int useTimeline = timelineSemaphoreUsable(physicalDevice);
+    if (useTimeline) {
+        vulkan12Features.pNext = (void *)deviceCreateInfo.pNext;
+        deviceCreateInfo.pNext = &vulkan12Features;
+    } else {
+        printf("Timeline semaphores not supported, synchronizing frames with fences.\n");
+    }
+
+    int useSubgroups = CHECK_REDUCTION && subgroupOperationsUsable(physicalDevice, VK_SHADER_STAGE_COMPUTE_BIT,
+                                                                   VK_SUBGROUP_FEATURE_ARITHMETIC_BIT);
+    if (CHECK_REDUCTION && !useSubgroups)
+        printf("Subgroup arithmetic not supported in compute shaders, check.comp reduces through shared memory.\n");
+
+    int useOcclusion = OCCLUSION_CHECK && occlusionQueryUsable(physicalDevice);
+    if (useOcclusion)
+        enabledFeatures.occlusionQueryPrecise = VK_TRUE;
+    else if (OCCLUSION_CHECK)
+        printf("Precise occlusion queries not supported, checking with check.comp.\n");
+
+#if SUBPASS_CHECK
+    // The fragment shader counts with atomics on the result buffer.
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    if (!supportedFeatures.fragmentStoresAndAtomics) {
+        fprintf(stderr, "SUBPASS_CHECK needs fragmentStoresAndAtomics!\n");
+        return -1;
+    }
+    enabledFeatures.fragmentStoresAndAtomics = VK_TRUE;
+
+    int useFragmentSubgroups = subgroupOperationsUsable(physicalDevice, VK_SHADER_STAGE_FRAGMENT_BIT,
+                                                        VK_SUBGROUP_FEATURE_ARITHMETIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT);
+    if (!useFragmentSubgroups)
+        printf("Subgroup arithmetic not supported in fragment shaders, check_subpass.frag adds per pixel.\n");
+#endif
+    // check.comp still runs for the colors, or in place of the query.
+    int checkDispatch = (!useOcclusion || OCCLUSION_CHECK == 2) && !SUBPASS_CHECK;
+    // Anything but the copy that reads the image on the GPU.
+    int computeReadsImage = checkDispatch || PALETTE_CLASSIFY || IMAGE_STATS || PACK_RGB24 || RLE_READBACK ||
+                            DIRTY_TILES;
+
+    // Per-pipeline compile times and cache hits in the report.
+    const char *feedbackExtension = pipeline_cache_feedback_extension(physicalDevice);
+    if (feedbackExtension)
+        deviceExtensions[deviceExtensionCount++] = feedbackExtension;
+
+#if PIPELINE_VARIANTS
+    PipelineVariantFeatures variantFeatures;
+    int variantBackend = pipeline_variants_enable(physicalDevice, PIPELINE_VARIANTS, &variantFeatures,
+                                                  deviceExtensions, &deviceExtensionCount, &deviceCreateInfo.pNext);
+#endif
+
+    deviceCreateInfo.enabledExtensionCount = deviceExtensionCount;
+    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions;
 
     VkDevice device;
     VK_CHECK(vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL, &device));
     printf("Logical Device created successfully.\n");
 
+    // Pipelines compiled by an earlier run come out of the cache file.
+    PipelineCache pipelineCache;
+    VK_CHECK(pipeline_cache_open(&pipelineCache, physicalDevice, device, "main", feedbackExtension != NULL));
+
+    VkDeviceSize hostPointerAlignment = 0;
+    PFN_vkGetMemoryHostPointerPropertiesEXT getMemoryHostPointerProperties = NULL;
+    if (useFileImport) {
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostMemoryProperties = {};
+        hostMemoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+
+        VkPhysicalDeviceProperties2 properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &hostMemoryProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+        hostPointerAlignment = hostMemoryProperties.minImportedHostPointerAlignment;
+        getMemoryHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT)
+            vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT");
+        printf("Reading back into the output file, import alignment %llu bytes.\n",
+               (unsigned long long)hostPointerAlignment);
+    }
+
     VkQueue queue;
     vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
     printf("Graphics & Compute Queue obtained.\n");
@@ -243,6 +1793,10 @@ int main() {
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    if (useHostImageCopy)
+        imageInfo.usage |= VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+    if (SUBPASS_CHECK)
+        imageInfo.usage |= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 
@@ -316,6 +1870,33 @@ int main() {
     renderPassInfo.dependencyCount = 1;
     renderPassInfo.pDependencies = &dependency;
 
+#if SUBPASS_CHECK
+    // Subpass 1 reads what subpass 0 wrote at the same pixel only, which is
+    // what lets a tiler keep it on chip.
+    VkAttachmentReference inputAttachmentRef = {};
+    inputAttachmentRef.attachment = 0;
+    inputAttachmentRef.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkSubpassDescription subpasses[2] = { subpass, {} };
+    subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpasses[1].inputAttachmentCount = 1;
+    subpasses[1].pInputAttachments = &inputAttachmentRef;
+
+    VkSubpassDependency dependencies[2] = { dependency, {} };
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = 1;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+    dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+    renderPassInfo.subpassCount = 2;
+    renderPassInfo.pSubpasses = subpasses;
+    renderPassInfo.dependencyCount = 2;
+    renderPassInfo.pDependencies = dependencies;
+#endif
+
     VkRenderPass renderPass;
     VK_CHECK(vkCreateRenderPass(device, &renderPassInfo, NULL, &renderPass));
     printf("Render Pass created.\n");
@@ -335,10 +1916,10 @@ int main() {
     printf("Framebuffer created.\n");
 
     // 8. Graphics Pipeline Creation
-    printf("Will call createShaderModule(device, triangle.vert.spv)\n");
-    VkShaderModule vertShaderModule = createShaderModule(device, "triangle.vert.spv");
-    printf("Will call createShaderModule(device, triangle.frag.spv)\n");
-    VkShaderModule fragShaderModule = createShaderModule(device, "triangle.frag.spv");
+    printf("Will call createShaderModule(device, %s)\n", triangleVertShader.name);
+    VkShaderModule vertShaderModule = createShaderModule(device, &triangleVertShader);
+    printf("Will call createShaderModule(device, %s)\n", triangleFragShader.name);
+    VkShaderModule fragShaderModule = createShaderModule(device, &triangleFragShader);
 
     VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
     vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -419,80 +2000,395 @@ int main() {
     multisampling.sampleShadingEnable = VK_FALSE;
     multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 
-    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
+    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = VK_FALSE;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending = {};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(PushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+#if PRERECORDED
+    // Set 0 of the graphics and set 1 of the compute pipelines: the frame
+    // parameters, one uniform buffer per slot.
+    VkDescriptorSetLayoutBinding paramsBinding = {};
+    paramsBinding.binding = 0;
+    paramsBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    paramsBinding.descriptorCount = 1;
+    paramsBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo paramsLayoutInfo = {};
+    paramsLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    paramsLayoutInfo.bindingCount = 1;
+    paramsLayoutInfo.pBindings = &paramsBinding;
+
+    VkDescriptorSetLayout paramsSetLayout;
+    VK_CHECK(vkCreateDescriptorSetLayout(device, &paramsLayoutInfo, NULL, &paramsSetLayout));
+
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &paramsSetLayout;
+#endif
+
+    VkPipelineLayout graphicsPipelineLayout;
+    VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &graphicsPipelineLayout));
+    printf("Graphics Pipeline Layout created.\n");
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.layout = graphicsPipelineLayout;
+    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.subpass = 0;
+
+    // Every pipeline is created on the pipeline cache's worker pool while
+    // setup carries on, the shader modules and everything pipelineInfo
+    // points to stay alive until pipeline_cache_close().
+    PipelineJob graphicsJob;
+    pipeline_cache_queue_graphics(&pipelineCache, &graphicsJob, "triangle", &pipelineInfo);
+    printf("Graphics Pipeline queued.\n");
+
+#if PIPELINE_VARIANTS
+    // The variants start from pipelineInfo. Libraries and shader objects are
+    // made here, the variants themselves by the frames that need them.
+    PipelineVariants pipelineVariants;
+    VK_CHECK(pipeline_variants_open(&pipelineVariants, variantBackend, &pipelineCache, &pipelineInfo,
+                                    &pipelineLayoutInfo, &triangleVertShader, &triangleFragShader));
+    printf("Pipeline variants prepared, %s.\n", pipeline_variants_backend_name(variantBackend));
+#endif
+
+
+    // START: >>>>>>>>>> NEW COMPUTE SETUP SECTION <<<<<<<<<<
+
+    // 8a. Create one Compute Result Buffer per frame in flight
+    FrameSlot frames[FRAMES_IN_FLIGHT] = {};
+
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        FrameSlot *slot = &frames[i];
+
+        VkBufferCreateInfo computeBufferInfo = {};
+        computeBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        computeBufferInfo.size = sizeof(uint32_t) * 5;
+        // TRANSFER_DST so every frame can clear the counters before the dispatch
+        computeBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        computeBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VK_CHECK(vkCreateBuffer(device, &computeBufferInfo, NULL, &slot->resultBuffer));
+
+        VkMemoryRequirements computeMemReqs;
+        vkGetBufferMemoryRequirements(device, slot->resultBuffer, &computeMemReqs);
+
+        VkMemoryAllocateInfo computeAllocInfo = {};
+        computeAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        computeAllocInfo.allocationSize = computeMemReqs.size;
+        computeAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, computeMemReqs.memoryTypeBits,
+                                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        VK_CHECK(vkAllocateMemory(device, &computeAllocInfo, NULL, &slot->resultBufferMemory));
+        vkBindBufferMemory(device, slot->resultBuffer, slot->resultBufferMemory, 0);
+        VK_CHECK(vkMapMemory(device, slot->resultBufferMemory, 0, sizeof(uint32_t) * 5, 0, (void *)&slot->results));
+    }
+    printf("Compute result buffers created.\n");
+
+#if PACK_RGB24
+    // Whole words of 4 pixels, the tail past IMAGE_WIDTH * IMAGE_HEIGHT * 3
+    // is never copied out.
+    const VkDeviceSize packedSize = ((VkDeviceSize)IMAGE_WIDTH * IMAGE_HEIGHT + 3) / 4 * 12;
+
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        FrameSlot *slot = &frames[i];
+
+        VkBufferCreateInfo packedBufferInfo = {};
+        packedBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        packedBufferInfo.size = packedSize;
+        packedBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        packedBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VK_CHECK(vkCreateBuffer(device, &packedBufferInfo, NULL, &slot->packedBuffer));
+
+        VkMemoryRequirements packedMemReqs;
+        vkGetBufferMemoryRequirements(device, slot->packedBuffer, &packedMemReqs);
+
+        VkMemoryAllocateInfo packedAllocInfo = {};
+        packedAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        packedAllocInfo.allocationSize = packedMemReqs.size;
+        packedAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, packedMemReqs.memoryTypeBits,
+                                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        VK_CHECK(vkAllocateMemory(device, &packedAllocInfo, NULL, &slot->packedBufferMemory));
+        vkBindBufferMemory(device, slot->packedBuffer, slot->packedBufferMemory, 0);
+    }
+    printf("RGB24 pack buffers created.\n");
+#endif
+
+#if RLE_READBACK
+    // Worst case is one run per pixel. The buffer is host-visible so the
+    // emit pass writes the runs straight to where the writer reads them.
+    const VkDeviceSize rleSize = sizeof(RleHeader) + (VkDeviceSize)IMAGE_WIDTH * IMAGE_HEIGHT * sizeof(RleRun);
+
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        FrameSlot *slot = &frames[i];
+
+        VkBufferCreateInfo rleBufferInfo = {};
+        rleBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        rleBufferInfo.size = sizeof(uint32_t) * 2 * IMAGE_HEIGHT; // run counts, then offsets
+        rleBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        rleBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VK_CHECK(vkCreateBuffer(device, &rleBufferInfo, NULL, &slot->rleRowsBuffer));
+
+        VkMemoryRequirements rleMemReqs;
+        vkGetBufferMemoryRequirements(device, slot->rleRowsBuffer, &rleMemReqs);
+
+        VkMemoryAllocateInfo rleAllocInfo = {};
+        rleAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        rleAllocInfo.allocationSize = rleMemReqs.size;
+        rleAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, rleMemReqs.memoryTypeBits,
+                                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        VK_CHECK(vkAllocateMemory(device, &rleAllocInfo, NULL, &slot->rleRowsBufferMemory));
+        vkBindBufferMemory(device, slot->rleRowsBuffer, slot->rleRowsBufferMemory, 0);
+
+        rleBufferInfo.size = rleSize;
+        VK_CHECK(vkCreateBuffer(device, &rleBufferInfo, NULL, &slot->rleBuffer));
+        vkGetBufferMemoryRequirements(device, slot->rleBuffer, &rleMemReqs);
+
+        rleAllocInfo.allocationSize = rleMemReqs.size;
+        rleAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, rleMemReqs.memoryTypeBits,
+                                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        VK_CHECK(vkAllocateMemory(device, &rleAllocInfo, NULL, &slot->rleBufferMemory));
+        vkBindBufferMemory(device, slot->rleBuffer, slot->rleBufferMemory, 0);
+        VK_CHECK(vkMapMemory(device, slot->rleBufferMemory, 0, rleSize, 0, &slot->rle));
+    }
+    printf("RLE buffers created.\n");
+#endif
+
+#if DIRTY_TILES
+    // One copy of the last frame shared by every slot: the queue runs the
+    // diffs in frame order. It starts out undefined, which only affects the
+    // list of the first frame, and that one is replaced by every tile.
+    VkBuffer previousBuffer;
+    VkDeviceMemory previousBufferMemory;
+    const VkDeviceSize dirtySize = sizeof(DirtyTileHeader) + (VkDeviceSize)DIFF_TILE_COUNT * sizeof(DirtyTile);
+
+    VkBufferCreateInfo diffBufferInfo = {};
+    diffBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    diffBufferInfo.size = (VkDeviceSize)IMAGE_WIDTH * IMAGE_HEIGHT * 4;
+    diffBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    diffBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VK_CHECK(vkCreateBuffer(device, &diffBufferInfo, NULL, &previousBuffer));
+
+    VkMemoryRequirements diffMemReqs;
+    vkGetBufferMemoryRequirements(device, previousBuffer, &diffMemReqs);
+
+    VkMemoryAllocateInfo diffAllocInfo = {};
+    diffAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    diffAllocInfo.allocationSize = diffMemReqs.size;
+    diffAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, diffMemReqs.memoryTypeBits,
+                                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VK_CHECK(vkAllocateMemory(device, &diffAllocInfo, NULL, &previousBufferMemory));
+    vkBindBufferMemory(device, previousBuffer, previousBufferMemory, 0);
+
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        FrameSlot *slot = &frames[i];
+
+        // TRANSFER_DST so every frame can reset the tile count
+        diffBufferInfo.size = dirtySize;
+        diffBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        VK_CHECK(vkCreateBuffer(device, &diffBufferInfo, NULL, &slot->dirtyBuffer));
+        vkGetBufferMemoryRequirements(device, slot->dirtyBuffer, &diffMemReqs);
+
+        diffAllocInfo.allocationSize = diffMemReqs.size;
+        diffAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, diffMemReqs.memoryTypeBits,
+                                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        VK_CHECK(vkAllocateMemory(device, &diffAllocInfo, NULL, &slot->dirtyBufferMemory));
+        vkBindBufferMemory(device, slot->dirtyBuffer, slot->dirtyBufferMemory, 0);
+        VK_CHECK(vkMapMemory(device, slot->dirtyBufferMemory, 0, dirtySize, 0, &slot->dirty));
+    }
+    printf("Dirty tile buffers created.\n");
+#endif
+
+#if PRERECORDED
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        FrameSlot *slot = &frames[i];
 
-    VkPipelineColorBlendStateCreateInfo colorBlending = {};
-    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
+        VkBufferCreateInfo paramsBufferInfo = {};
+        paramsBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        paramsBufferInfo.size = sizeof(PushConstants);
+        paramsBufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+        paramsBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    VkPushConstantRange pushConstantRange = {};
-    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-    pushConstantRange.offset = 0;
-    pushConstantRange.size = sizeof(PushConstants);
+        VK_CHECK(vkCreateBuffer(device, &paramsBufferInfo, NULL, &slot->paramsBuffer));
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.pushConstantRangeCount = 1;
-    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+        VkMemoryRequirements paramsMemReqs;
+        vkGetBufferMemoryRequirements(device, slot->paramsBuffer, &paramsMemReqs);
 
-    VkPipelineLayout graphicsPipelineLayout;
-    VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &graphicsPipelineLayout));
-    printf("Graphics Pipeline Layout created.\n");
+        VkMemoryAllocateInfo paramsAllocInfo = {};
+        paramsAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        paramsAllocInfo.allocationSize = paramsMemReqs.size;
+        paramsAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, paramsMemReqs.memoryTypeBits,
+                                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    VkGraphicsPipelineCreateInfo pipelineInfo = {};
-    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &inputAssembly;
-    pipelineInfo.pViewportState = &viewportState;
-    pipelineInfo.pRasterizationState = &rasterizer;
-    pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.layout = graphicsPipelineLayout;
-    pipelineInfo.renderPass = renderPass;
-    pipelineInfo.subpass = 0;
+        VK_CHECK(vkAllocateMemory(device, &paramsAllocInfo, NULL, &slot->paramsBufferMemory));
+        vkBindBufferMemory(device, slot->paramsBuffer, slot->paramsBufferMemory, 0);
+        VK_CHECK(vkMapMemory(device, slot->paramsBufferMemory, 0, sizeof(PushConstants), 0, &slot->params));
+    }
+    printf("Frame parameter buffers created.\n");
+#endif
 
-    VkPipeline graphicsPipeline;
-    VK_CHECK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &graphicsPipeline));
-    printf("Graphics Pipeline created.\n");
+#if CHECK_REDUCTION == 2
+    const uint32_t checkGroups = ((IMAGE_WIDTH + 15) / 16) * ((IMAGE_HEIGHT + 15) / 16);
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        FrameSlot *slot = &frames[i];
 
-    vkDestroyShaderModule(device, fragShaderModule, NULL);
-    vkDestroyShaderModule(device, vertShaderModule, NULL);
+        VkBufferCreateInfo partialsBufferInfo = {};
+        partialsBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        partialsBufferInfo.size = (VkDeviceSize)checkGroups * sizeof(uint32_t) * 4;
+        partialsBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        partialsBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+        VK_CHECK(vkCreateBuffer(device, &partialsBufferInfo, NULL, &slot->partialsBuffer));
 
-    // START: >>>>>>>>>> NEW COMPUTE SETUP SECTION <<<<<<<<<<
+        VkMemoryRequirements partialsMemReqs;
+        vkGetBufferMemoryRequirements(device, slot->partialsBuffer, &partialsMemReqs);
 
-    // 8a. Create Compute Result Buffer
-    VkBufferCreateInfo computeBufferInfo = {};
-    computeBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    computeBufferInfo.size = sizeof(uint32_t) * 4;
-    computeBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    computeBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VkMemoryAllocateInfo partialsAllocInfo = {};
+        partialsAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        partialsAllocInfo.allocationSize = partialsMemReqs.size;
+        partialsAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, partialsMemReqs.memoryTypeBits,
+                                                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    VkBuffer computeResultBuffer;
-    VK_CHECK(vkCreateBuffer(device, &computeBufferInfo, NULL, &computeResultBuffer));
+        VK_CHECK(vkAllocateMemory(device, &partialsAllocInfo, NULL, &slot->partialsBufferMemory));
+        vkBindBufferMemory(device, slot->partialsBuffer, slot->partialsBufferMemory, 0);
+    }
+    printf("Check partials buffers created, %u workgroups.\n", checkGroups);
+#endif
 
-    VkMemoryRequirements computeMemReqs;
-    vkGetBufferMemoryRequirements(device, computeResultBuffer, &computeMemReqs);
+#if PALETTE_CLASSIFY
+    // One palette for every frame, written once here.
+    float (*paletteColors)[4] = calloc(PALETTE_MAX_CLASSES, sizeof(*paletteColors));
+    if (!paletteColors) {
+        fprintf(stderr, "Failed to allocate the palette!\n");
+        return -1;
+    }
+    uint32_t classCount;
+    const char *palettePath = getenv("PALETTE");
+    if (palettePath && *palettePath) {
+        classCount = loadPalette(palettePath, paletteColors);
+        if (!classCount)
+            return -1;
+    } else {
+        // The triangle and the clear color.
+        memcpy(paletteColors[0], vertices[0].color, sizeof(paletteColors[0]));
+        paletteColors[0][3] = 0.1f;
+        paletteColors[1][3] = 0.1f;
+        classCount = 2;
+    }
 
-    VkMemoryAllocateInfo computeAllocInfo = {};
-    computeAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    computeAllocInfo.allocationSize = computeMemReqs.size;
-    computeAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, computeMemReqs.memoryTypeBits,
-                                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    VkBuffer paletteBuffer;
+    VkDeviceMemory paletteBufferMemory;
+    const VkDeviceSize paletteSize = sizeof(PaletteHeader) + sizeof(float) * 4 * classCount;
+
+    VkBufferCreateInfo classBufferInfo = {};
+    classBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    classBufferInfo.size = paletteSize;
+    classBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    classBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VK_CHECK(vkCreateBuffer(device, &classBufferInfo, NULL, &paletteBuffer));
+
+    VkMemoryRequirements classMemReqs;
+    vkGetBufferMemoryRequirements(device, paletteBuffer, &classMemReqs);
+
+    VkMemoryAllocateInfo classAllocInfo = {};
+    classAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    classAllocInfo.allocationSize = classMemReqs.size;
+    classAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, classMemReqs.memoryTypeBits,
+                                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    VK_CHECK(vkAllocateMemory(device, &classAllocInfo, NULL, &paletteBufferMemory));
+    vkBindBufferMemory(device, paletteBuffer, paletteBufferMemory, 0);
+
+    PaletteHeader *palette;
+    VK_CHECK(vkMapMemory(device, paletteBufferMemory, 0, paletteSize, 0, (void **)&palette));
+    palette->classCount = classCount;
+    palette->bounds = PALETTE_CLASSIFY == 2;
+    memcpy(palette + 1, paletteColors, sizeof(float) * 4 * classCount);
+    vkUnmapMemory(device, paletteBufferMemory);
+    free(paletteColors);
+
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        FrameSlot *slot = &frames[i];
+
+        // TRANSFER_DST so every frame can clear the counters
+        classBufferInfo.size = sizeof(ClassResults);
+        classBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        VK_CHECK(vkCreateBuffer(device, &classBufferInfo, NULL, &slot->classBuffer));
+        vkGetBufferMemoryRequirements(device, slot->classBuffer, &classMemReqs);
+
+        classAllocInfo.allocationSize = classMemReqs.size;
+        classAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, classMemReqs.memoryTypeBits,
+                                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        VK_CHECK(vkAllocateMemory(device, &classAllocInfo, NULL, &slot->classBufferMemory));
+        vkBindBufferMemory(device, slot->classBuffer, slot->classBufferMemory, 0);
+        VK_CHECK(vkMapMemory(device, slot->classBufferMemory, 0, sizeof(ClassResults), 0, &slot->classes));
+    }
+    printf("Palette of %u classes and class buffers created.\n", classCount);
+#endif
 
-    VkDeviceMemory computeResultBufferMemory;
-    VK_CHECK(vkAllocateMemory(device, &computeAllocInfo, NULL, &computeResultBufferMemory));
-    vkBindBufferMemory(device, computeResultBuffer, computeResultBufferMemory, 0);
-    printf("Compute result buffer created.\n");
+#if IMAGE_STATS
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        FrameSlot *slot = &frames[i];
+
+        // TRANSFER_DST so every frame can clear them
+        VkBufferCreateInfo statsBufferInfo = {};
+        statsBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        statsBufferInfo.size = sizeof(ImageStats);
+        statsBufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        statsBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VK_CHECK(vkCreateBuffer(device, &statsBufferInfo, NULL, &slot->statsBuffer));
+
+        VkMemoryRequirements statsMemReqs;
+        vkGetBufferMemoryRequirements(device, slot->statsBuffer, &statsMemReqs);
+
+        VkMemoryAllocateInfo statsAllocInfo = {};
+        statsAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        statsAllocInfo.allocationSize = statsMemReqs.size;
+        statsAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, statsMemReqs.memoryTypeBits,
+                                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        VK_CHECK(vkAllocateMemory(device, &statsAllocInfo, NULL, &slot->statsBufferMemory));
+        vkBindBufferMemory(device, slot->statsBuffer, slot->statsBufferMemory, 0);
+        VK_CHECK(vkMapMemory(device, slot->statsBufferMemory, 0, sizeof(ImageStats), 0, &slot->stats));
+    }
+    printf("Stats buffers created, %zu bytes each.\n", sizeof(ImageStats));
+#endif
 
     // 8b. Create Compute Descriptor Set Layout
-    VkDescriptorSetLayoutBinding bindings[2] = {};
+    VkDescriptorSetLayoutBinding bindings[11] = {};
     // Input image
     bindings[0].binding = 0;
     bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
@@ -503,67 +2399,194 @@ int main() {
     bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     bindings[1].descriptorCount = 1;
     bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    // Readback encoders: 2 is the packed RGB24 output of pack_rgb.comp, 3 and
+    // 4 the per-row run counts/offsets and the runs of the rle_*.comp passes,
+    // 5 and 6 the previous frame and the dirty tile list of tile_diff.comp,
+    // 7 the per-workgroup counts of CHECK_REDUCTION 2, 8 and 9 the palette
+    // and the class counts of classify.comp, 10 the statistics of stats.comp.
+    // They stay unwritten unless their mode is on, which is fine as long as
+    // no bound pipeline uses them.
+    for (uint32_t i = 2; i < 11; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
 
     VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
     setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    setLayoutInfo.bindingCount = 2;
+    setLayoutInfo.bindingCount = 11;
     setLayoutInfo.pBindings = bindings;
 
     VkDescriptorSetLayout computeSetLayout;
     VK_CHECK(vkCreateDescriptorSetLayout(device, &setLayoutInfo, NULL, &computeSetLayout));
 
-    // 8c. Create Compute Descriptor Pool and Set
-    VkDescriptorPoolSize poolSizes[2] = {};
+    // 8c. Create Compute Descriptor Pool and one Set per frame in flight
+    VkDescriptorPoolSize poolSizes[3] = {};
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    poolSizes[0].descriptorCount = 1;
+    poolSizes[0].descriptorCount = FRAMES_IN_FLIGHT;
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    poolSizes[1].descriptorCount = 1;
+    poolSizes[1].descriptorCount = FRAMES_IN_FLIGHT * 10;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; // PRERECORDED frame parameters
+    poolSizes[2].descriptorCount = FRAMES_IN_FLIGHT;
 
     VkDescriptorPoolCreateInfo poolInfo = {};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = 2;
+    poolInfo.poolSizeCount = PRERECORDED ? 3 : 2;
     poolInfo.pPoolSizes = poolSizes;
-    poolInfo.maxSets = 1;
+    poolInfo.maxSets = FRAMES_IN_FLIGHT * (PRERECORDED ? 2 : 1);
 
     VkDescriptorPool computeDescriptorPool;
     VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, NULL, &computeDescriptorPool));
 
-    VkDescriptorSetAllocateInfo setAllocInfo = {};
-    setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    setAllocInfo.descriptorPool = computeDescriptorPool;
-    setAllocInfo.descriptorSetCount = 1;
-    setAllocInfo.pSetLayouts = &computeSetLayout;
-
-    VkDescriptorSet computeDescriptorSet;
-    VK_CHECK(vkAllocateDescriptorSets(device, &setAllocInfo, &computeDescriptorSet));
-
-    // 8d. Update Descriptor Set
-    VkDescriptorImageInfo descImageInfo = {};
-    descImageInfo.imageView = offscreenImageView;
-    descImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-
-    VkDescriptorBufferInfo descBufferInfo = {};
-    descBufferInfo.buffer = computeResultBuffer;
-    descBufferInfo.offset = 0;
-    descBufferInfo.range = VK_WHOLE_SIZE;
-
-    VkWriteDescriptorSet writeSets[2] = {};
-    writeSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writeSets[0].dstSet = computeDescriptorSet;
-    writeSets[0].dstBinding = 0;
-    writeSets[0].descriptorCount = 1;
-    writeSets[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    writeSets[0].pImageInfo = &descImageInfo;
-
-    writeSets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writeSets[1].dstSet = computeDescriptorSet;
-    writeSets[1].dstBinding = 1;
-    writeSets[1].descriptorCount = 1;
-    writeSets[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    writeSets[1].pBufferInfo = &descBufferInfo;
-
-    vkUpdateDescriptorSets(device, 2, writeSets, 0, NULL);
-    printf("Compute descriptor set created and updated.\n");
+    // 8d. Allocate and Update the Descriptor Sets
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        VkDescriptorSetAllocateInfo setAllocInfo = {};
+        setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        setAllocInfo.descriptorPool = computeDescriptorPool;
+        setAllocInfo.descriptorSetCount = 1;
+        setAllocInfo.pSetLayouts = &computeSetLayout;
+
+        VK_CHECK(vkAllocateDescriptorSets(device, &setAllocInfo, &frames[i].descriptorSet));
+
+        VkDescriptorImageInfo descImageInfo = {};
+        descImageInfo.imageView = offscreenImageView;
+        descImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkDescriptorBufferInfo descBufferInfo = {};
+        descBufferInfo.buffer = frames[i].resultBuffer;
+        descBufferInfo.offset = 0;
+        descBufferInfo.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet writeSets[11] = {};
+        uint32_t writeCount = 2;
+        writeSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeSets[0].dstSet = frames[i].descriptorSet;
+        writeSets[0].dstBinding = 0;
+        writeSets[0].descriptorCount = 1;
+        writeSets[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        writeSets[0].pImageInfo = &descImageInfo;
+
+        writeSets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeSets[1].dstSet = frames[i].descriptorSet;
+        writeSets[1].dstBinding = 1;
+        writeSets[1].descriptorCount = 1;
+        writeSets[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writeSets[1].pBufferInfo = &descBufferInfo;
+
+#if PACK_RGB24
+        VkDescriptorBufferInfo descPackedInfo = {};
+        descPackedInfo.buffer = frames[i].packedBuffer;
+        descPackedInfo.offset = 0;
+        descPackedInfo.range = VK_WHOLE_SIZE;
+
+        writeSets[writeCount].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeSets[writeCount].dstSet = frames[i].descriptorSet;
+        writeSets[writeCount].dstBinding = 2;
+        writeSets[writeCount].descriptorCount = 1;
+        writeSets[writeCount].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writeSets[writeCount].pBufferInfo = &descPackedInfo;
+        writeCount++;
+#endif
+#if RLE_READBACK
+        VkDescriptorBufferInfo descRleInfo[2] = {};
+        descRleInfo[0].buffer = frames[i].rleRowsBuffer;
+        descRleInfo[0].range = VK_WHOLE_SIZE;
+        descRleInfo[1].buffer = frames[i].rleBuffer;
+        descRleInfo[1].range = VK_WHOLE_SIZE;
+
+        for (uint32_t j = 0; j < 2; j++) {
+            writeSets[writeCount].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writeSets[writeCount].dstSet = frames[i].descriptorSet;
+            writeSets[writeCount].dstBinding = 3 + j;
+            writeSets[writeCount].descriptorCount = 1;
+            writeSets[writeCount].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writeSets[writeCount].pBufferInfo = &descRleInfo[j];
+            writeCount++;
+        }
+#endif
+#if DIRTY_TILES
+        VkDescriptorBufferInfo descDiffInfo[2] = {};
+        descDiffInfo[0].buffer = previousBuffer;
+        descDiffInfo[0].range = VK_WHOLE_SIZE;
+        descDiffInfo[1].buffer = frames[i].dirtyBuffer;
+        descDiffInfo[1].range = VK_WHOLE_SIZE;
+
+        for (uint32_t j = 0; j < 2; j++) {
+            writeSets[writeCount].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writeSets[writeCount].dstSet = frames[i].descriptorSet;
+            writeSets[writeCount].dstBinding = 5 + j;
+            writeSets[writeCount].descriptorCount = 1;
+            writeSets[writeCount].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writeSets[writeCount].pBufferInfo = &descDiffInfo[j];
+            writeCount++;
+        }
+#endif
+#if CHECK_REDUCTION == 2
+        VkDescriptorBufferInfo descPartialsInfo = {};
+        descPartialsInfo.buffer = frames[i].partialsBuffer;
+        descPartialsInfo.range = VK_WHOLE_SIZE;
+
+        writeSets[writeCount].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeSets[writeCount].dstSet = frames[i].descriptorSet;
+        writeSets[writeCount].dstBinding = 7;
+        writeSets[writeCount].descriptorCount = 1;
+        writeSets[writeCount].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writeSets[writeCount].pBufferInfo = &descPartialsInfo;
+        writeCount++;
+#endif
+#if PALETTE_CLASSIFY
+        VkDescriptorBufferInfo descClassInfo[2] = {};
+        descClassInfo[0].buffer = paletteBuffer;
+        descClassInfo[0].range = VK_WHOLE_SIZE;
+        descClassInfo[1].buffer = frames[i].classBuffer;
+        descClassInfo[1].range = VK_WHOLE_SIZE;
+
+        for (uint32_t j = 0; j < 2; j++) {
+            writeSets[writeCount].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writeSets[writeCount].dstSet = frames[i].descriptorSet;
+            writeSets[writeCount].dstBinding = 8 + j;
+            writeSets[writeCount].descriptorCount = 1;
+            writeSets[writeCount].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writeSets[writeCount].pBufferInfo = &descClassInfo[j];
+            writeCount++;
+        }
+#endif
+#if IMAGE_STATS
+        VkDescriptorBufferInfo descStatsInfo = {};
+        descStatsInfo.buffer = frames[i].statsBuffer;
+        descStatsInfo.range = VK_WHOLE_SIZE;
+
+        writeSets[writeCount].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeSets[writeCount].dstSet = frames[i].descriptorSet;
+        writeSets[writeCount].dstBinding = 10;
+        writeSets[writeCount].descriptorCount = 1;
+        writeSets[writeCount].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writeSets[writeCount].pBufferInfo = &descStatsInfo;
+        writeCount++;
+#endif
+
+        vkUpdateDescriptorSets(device, writeCount, writeSets, 0, NULL);
+
+#if PRERECORDED
+        setAllocInfo.pSetLayouts = &paramsSetLayout;
+        VK_CHECK(vkAllocateDescriptorSets(device, &setAllocInfo, &frames[i].paramsSet));
+
+        VkDescriptorBufferInfo descParamsInfo = {};
+        descParamsInfo.buffer = frames[i].paramsBuffer;
+        descParamsInfo.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet paramsWrite = {};
+        paramsWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        paramsWrite.dstSet = frames[i].paramsSet;
+        paramsWrite.dstBinding = 0;
+        paramsWrite.descriptorCount = 1;
+        paramsWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        paramsWrite.pBufferInfo = &descParamsInfo;
+        vkUpdateDescriptorSets(device, 1, &paramsWrite, 0, NULL);
+#endif
+    }
+    printf("Compute descriptor sets created and updated.\n");
 
     VkPushConstantRange computePushConstantRange = {};
     computePushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
@@ -577,11 +2600,20 @@ int main() {
     computePipelineLayoutInfo.pSetLayouts = &computeSetLayout;
     computePipelineLayoutInfo.pushConstantRangeCount = 1;
     computePipelineLayoutInfo.pPushConstantRanges = &computePushConstantRange;
+#if PRERECORDED
+    VkDescriptorSetLayout computeSetLayouts[2] = { computeSetLayout, paramsSetLayout };
+    computePipelineLayoutInfo.setLayoutCount = 2;
+    computePipelineLayoutInfo.pSetLayouts = computeSetLayouts;
+#endif
 
     VkPipelineLayout computePipelineLayout;
     VK_CHECK(vkCreatePipelineLayout(device, &computePipelineLayoutInfo, NULL, &computePipelineLayout));
 
-    VkShaderModule computeShaderModule = createShaderModule(device, "check.comp.spv");
+#if CHECK_REDUCTION
+    VkShaderModule computeShaderModule = createShaderModule(device, &checkShaders[useSubgroups ? 0 : 1]);
+#else
+    VkShaderModule computeShaderModule = createShaderModule(device, &checkShader);
+#endif
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -594,15 +2626,202 @@ int main() {
     computePipelineInfo.stage = computeShaderStageInfo;
     computePipelineInfo.layout = computePipelineLayout;
 
-    VkPipeline computePipeline;
-    VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineInfo, NULL, &computePipeline));
-    printf("Compute pipeline created.\n");
+    // The job keeps its own copy of computePipelineInfo, the variants below
+    // only swap the module.
+    PipelineJob computeJob;
+    pipeline_cache_queue_compute(&pipelineCache, &computeJob, "check", &computePipelineInfo);
+    printf("Compute pipeline queued.\n");
 
-    vkDestroyShaderModule(device, computeShaderModule, NULL);
+#if CHECK_REDUCTION == 2
+    // Same layout, it reads binding 7 and adds to the result buffer.
+    VkShaderModule sumShaderModule = createShaderModule(device, &sumShader);
+    computePipelineInfo.stage.module = sumShaderModule;
+
+    PipelineJob sumJob;
+    pipeline_cache_queue_compute(&pipelineCache, &sumJob, "check_sum", &computePipelineInfo);
+    printf("Check sum pipeline queued.\n");
+#endif
+
+#if PACK_RGB24
+    // Same layout and push constant range as the check pipeline.
+    VkShaderModule packShaderModule = createShaderModule(device, &packShader);
+    computePipelineInfo.stage.module = packShaderModule;
+
+    PipelineJob packJob;
+    pipeline_cache_queue_compute(&pipelineCache, &packJob, "pack_rgb", &computePipelineInfo);
+    printf("RGB24 pack pipeline queued.\n");
+#endif
+
+#if RLE_READBACK
+    VkShaderModule rleShaderModules[3];
+    PipelineJob rleJobs[3];
+
+    for (uint32_t i = 0; i < 3; i++) {
+        rleShaderModules[i] = createShaderModule(device, &rleShaders[i]);
+        computePipelineInfo.stage.module = rleShaderModules[i];
+        pipeline_cache_queue_compute(&pipelineCache, &rleJobs[i], rleShaders[i].name, &computePipelineInfo);
+    }
+    printf("RLE pipelines queued.\n");
+#endif
+
+#if DIRTY_TILES
+    VkShaderModule diffShaderModule = createShaderModule(device, &diffShader);
+    computePipelineInfo.stage.module = diffShaderModule;
+
+    PipelineJob diffJob;
+    pipeline_cache_queue_compute(&pipelineCache, &diffJob, "tile_diff", &computePipelineInfo);
+    printf("Tile diff pipeline queued.\n");
+#endif
+
+#if PALETTE_CLASSIFY
+    VkShaderModule classifyShaderModule = createShaderModule(device, &classifyShader);
+    computePipelineInfo.stage.module = classifyShaderModule;
+
+    PipelineJob classifyJob;
+    pipeline_cache_queue_compute(&pipelineCache, &classifyJob, "classify", &computePipelineInfo);
+    printf("Classify pipeline queued.\n");
+#endif
+
+#if IMAGE_STATS
+    VkShaderModule statsShaderModule = createShaderModule(device, &statsShader);
+    computePipelineInfo.stage.module = statsShaderModule;
+
+    PipelineJob statsJob;
+    pipeline_cache_queue_compute(&pipelineCache, &statsJob, "stats", &computePipelineInfo);
+    printf("Stats pipeline queued.\n");
+#endif
+
+#if SUBPASS_CHECK
+    // 8f. The check as subpass 1: its own set with the input attachment and
+    // the result buffer, one per slot, and a pipeline without vertex input.
+    VkDescriptorSetLayoutBinding subpassBindings[2] = {};
+    subpassBindings[0].binding = 0;
+    subpassBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    subpassBindings[0].descriptorCount = 1;
+    subpassBindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    subpassBindings[1].binding = 1;
+    subpassBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    subpassBindings[1].descriptorCount = 1;
+    subpassBindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayoutCreateInfo subpassSetLayoutInfo = {};
+    subpassSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    subpassSetLayoutInfo.bindingCount = 2;
+    subpassSetLayoutInfo.pBindings = subpassBindings;
+
+    VkDescriptorSetLayout subpassSetLayout;
+    VK_CHECK(vkCreateDescriptorSetLayout(device, &subpassSetLayoutInfo, NULL, &subpassSetLayout));
+
+    VkDescriptorPoolSize subpassPoolSizes[2] = {};
+    subpassPoolSizes[0].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    subpassPoolSizes[0].descriptorCount = FRAMES_IN_FLIGHT;
+    subpassPoolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    subpassPoolSizes[1].descriptorCount = FRAMES_IN_FLIGHT;
+
+    VkDescriptorPoolCreateInfo subpassPoolInfo = {};
+    subpassPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    subpassPoolInfo.poolSizeCount = 2;
+    subpassPoolInfo.pPoolSizes = subpassPoolSizes;
+    subpassPoolInfo.maxSets = FRAMES_IN_FLIGHT;
+
+    VkDescriptorPool subpassDescriptorPool;
+    VK_CHECK(vkCreateDescriptorPool(device, &subpassPoolInfo, NULL, &subpassDescriptorPool));
+
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        VkDescriptorSetAllocateInfo setAllocInfo = {};
+        setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        setAllocInfo.descriptorPool = subpassDescriptorPool;
+        setAllocInfo.descriptorSetCount = 1;
+        setAllocInfo.pSetLayouts = &subpassSetLayout;
+        VK_CHECK(vkAllocateDescriptorSets(device, &setAllocInfo, &frames[i].subpassSet));
+
+        VkDescriptorImageInfo descInputInfo = {};
+        descInputInfo.imageView = offscreenImageView;
+        descInputInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkDescriptorBufferInfo descResultInfo = {};
+        descResultInfo.buffer = frames[i].resultBuffer;
+        descResultInfo.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet subpassWrites[2] = {};
+        subpassWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        subpassWrites[0].dstSet = frames[i].subpassSet;
+        subpassWrites[0].dstBinding = 0;
+        subpassWrites[0].descriptorCount = 1;
+        subpassWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+        subpassWrites[0].pImageInfo = &descInputInfo;
+        subpassWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        subpassWrites[1].dstSet = frames[i].subpassSet;
+        subpassWrites[1].dstBinding = 1;
+        subpassWrites[1].descriptorCount = 1;
+        subpassWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        subpassWrites[1].pBufferInfo = &descResultInfo;
+        vkUpdateDescriptorSets(device, 2, subpassWrites, 0, NULL);
+    }
+
+    VkPushConstantRange subpassPushConstantRange = {};
+    subpassPushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    subpassPushConstantRange.size = sizeof(PushConstants);
+
+    VkPipelineLayoutCreateInfo subpassLayoutInfo = {};
+    subpassLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    subpassLayoutInfo.setLayoutCount = 1;
+    subpassLayoutInfo.pSetLayouts = &subpassSetLayout;
+    subpassLayoutInfo.pushConstantRangeCount = 1;
+    subpassLayoutInfo.pPushConstantRanges = &subpassPushConstantRange;
+
+    VkPipelineLayout subpassPipelineLayout;
+    VK_CHECK(vkCreatePipelineLayout(device, &subpassLayoutInfo, NULL, &subpassPipelineLayout));
+
+    VkShaderModule subpassVertModule = createShaderModule(device, &subpassVertShader);
+    VkShaderModule subpassFragModule = createShaderModule(device, &subpassFragShaders[useFragmentSubgroups ? 0 : 1]);
+
+    VkPipelineShaderStageCreateInfo subpassStages[2] = { vertShaderStageInfo, fragShaderStageInfo };
+    subpassStages[0].module = subpassVertModule;
+    subpassStages[1].module = subpassFragModule;
+
+    VkPipelineVertexInputStateCreateInfo subpassVertexInput = {};
+    subpassVertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    VkPipelineRasterizationStateCreateInfo subpassRasterizer = rasterizer;
+    subpassRasterizer.cullMode = VK_CULL_MODE_NONE;
+
+    // No color attachment to write in subpass 1.
+    VkPipelineColorBlendStateCreateInfo subpassBlending = colorBlending;
+    subpassBlending.attachmentCount = 0;
+    subpassBlending.pAttachments = NULL;
+
+    VkGraphicsPipelineCreateInfo subpassPipelineInfo = pipelineInfo;
+    subpassPipelineInfo.pStages = subpassStages;
+    subpassPipelineInfo.pVertexInputState = &subpassVertexInput;
+    subpassPipelineInfo.pRasterizationState = &subpassRasterizer;
+    subpassPipelineInfo.pColorBlendState = &subpassBlending;
+    subpassPipelineInfo.layout = subpassPipelineLayout;
+    subpassPipelineInfo.subpass = 1;
+
+    PipelineJob subpassJob;
+    pipeline_cache_queue_graphics(&pipelineCache, &subpassJob, "check_subpass", &subpassPipelineInfo);
+    printf("Subpass check pipeline queued, %s.\n", useFragmentSubgroups ? "subgroupAdd()" : "atomics per pixel");
+#endif
 
     // END: >>>>>>>>>> NEW COMPUTE SETUP SECTION <<<<<<<<<<
 
-    // 9. Command Pool and Command Buffer Creation
+    // 9. Command Pool and per-frame Command Buffers, Fences and Staging Buffers
+    VkSemaphore timeline = VK_NULL_HANDLE;
+    uint64_t timelineValue = 0;
+    if (useTimeline) {
+        VkSemaphoreTypeCreateInfo semaphoreTypeInfo = {};
+        semaphoreTypeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        semaphoreTypeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        semaphoreTypeInfo.initialValue = 0;
+
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &semaphoreTypeInfo;
+        VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, NULL, &timeline));
+        printf("Timeline semaphore created.\n");
+    }
+
     VkCommandPoolCreateInfo cmdPoolInfo = {};
     cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
@@ -612,41 +2831,97 @@ int main() {
     VK_CHECK(vkCreateCommandPool(device, &cmdPoolInfo, NULL, &commandPool));
     printf("Command Pool created.\n");
 
-    VkCommandBufferAllocateInfo allocCmdBufferInfo = {};
-    allocCmdBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocCmdBufferInfo.commandPool = commandPool;
-    allocCmdBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocCmdBufferInfo.commandBufferCount = 1;
+    // Two timestamps per slot around the check dispatches, and one after the
+    // classification, for their GPU time in the report.
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    VkQueryPool checkQueries = VK_NULL_HANDLE;
+    if (deviceProperties.limits.timestampComputeAndGraphics) {
+        VkQueryPoolCreateInfo queryPoolInfo = {};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = FRAMES_IN_FLIGHT * CHECK_QUERIES;
+        VK_CHECK(vkCreateQueryPool(device, &queryPoolInfo, NULL, &checkQueries));
+    } else {
+        printf("Timestamps not supported, the check is not timed.\n");
+    }
 
-    VkCommandBuffer commandBuffer;
-    VK_CHECK(vkAllocateCommandBuffers(device, &allocCmdBufferInfo, &commandBuffer));
-    printf("Command Buffer allocated.\n");
+    // More around the render pass and the check, to compare the check
+    // variants including what they cost the render pass, and around the
+    // readback commands, to compare the readback modes.
+    VkQueryPool passQueries = VK_NULL_HANDLE;
+    if (checkQueries) {
+        VkQueryPoolCreateInfo queryPoolInfo = {};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = FRAMES_IN_FLIGHT * PASS_QUERIES;
+        VK_CHECK(vkCreateQueryPool(device, &queryPoolInfo, NULL, &passQueries));
+    }
 
-    // 10. Recording Commands
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    // One occlusion query per slot around the draw.
+    VkQueryPool occlusionQueries = VK_NULL_HANDLE;
+    if (useOcclusion) {
+        VkQueryPoolCreateInfo queryPoolInfo = {};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_OCCLUSION;
+        queryPoolInfo.queryCount = FRAMES_IN_FLIGHT;
+        VK_CHECK(vkCreateQueryPool(device, &queryPoolInfo, NULL, &occlusionQueries));
+    }
+
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        FrameSlot *slot = &frames[i];
+
+        VkCommandBufferAllocateInfo allocCmdBufferInfo = {};
+        allocCmdBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocCmdBufferInfo.commandPool = commandPool;
+        allocCmdBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocCmdBufferInfo.commandBufferCount = 1;
 
-    VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
-    printf("Command Buffer recording started.\n");
+        VK_CHECK(vkAllocateCommandBuffers(device, &allocCmdBufferInfo, &slot->commandBuffer));
+        slot->firstQuery = i * CHECK_QUERIES;
+#if DIRTY_TILES
+        VK_CHECK(vkAllocateCommandBuffers(device, &allocCmdBufferInfo, &slot->copyCommandBuffer));
+#endif
 
-    // ---- Graphics Pass ----
-    VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f}; // black color
-    VkRenderPassBeginInfo renderPassBeginInfo = {};
-    renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassBeginInfo.renderPass = renderPass;
-    renderPassBeginInfo.framebuffer = framebuffer;
-    renderPassBeginInfo.renderArea.extent.width = IMAGE_WIDTH;
-    renderPassBeginInfo.renderArea.extent.height = IMAGE_HEIGHT;
-    renderPassBeginInfo.clearValueCount = 1;
-    renderPassBeginInfo.pClearValues = &clearColor;
+        if (!useTimeline) {
+            VkFenceCreateInfo fenceInfo = {};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            VK_CHECK(vkCreateFence(device, &fenceInfo, NULL, &slot->fence));
+        }
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+        slot->clientFd = -1;
+        slot->shmFd = -1;
 
-    VkBuffer vertexBuffers[] = {vertexBuffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+#if DO_COPY
+        if (useFileImport || useHostImageCopy || RLE_READBACK)
+            continue; // every frame imports its own output file, or nothing is staged
+
+        // Create a host-visible buffer to copy image data to
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = IMAGE_WIDTH * IMAGE_HEIGHT * READBACK_CHANNELS; // RGBA or packed RGB
+        if (DIRTY_TILES) // whole tiles, edge tiles included
+            bufferInfo.size = DIFF_TILE_COUNT * DIFF_TILE_SIZE * DIFF_TILE_SIZE * 4;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VK_CHECK(vkCreateBuffer(device, &bufferInfo, NULL, &slot->stagingBuffer));
+
+        VkMemoryRequirements stagingMemRequirements;
+        vkGetBufferMemoryRequirements(device, slot->stagingBuffer, &stagingMemRequirements);
+
+        VkMemoryAllocateInfo stagingAllocInfo = {};
+        stagingAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        stagingAllocInfo.allocationSize = stagingMemRequirements.size;
+        stagingAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, stagingMemRequirements.memoryTypeBits,
+                                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        VK_CHECK(vkAllocateMemory(device, &stagingAllocInfo, NULL, &slot->stagingBufferMemory));
+        vkBindBufferMemory(device, slot->stagingBuffer, slot->stagingBufferMemory, 0);
+        // Stays mapped for the whole run, the writer thread reads it directly.
+        VK_CHECK(vkMapMemory(device, slot->stagingBufferMemory, 0, bufferInfo.size, 0, &slot->pixels));
+#endif
+    }
+    printf("%u frame slots allocated.\n", FRAMES_IN_FLIGHT);
 
     PushConstants push_constants = {};
     // Path 1 (use_buffer = 0): Color data for compute shader to check against
@@ -679,197 +2954,1047 @@ int main() {
     push_constants.color_offset[2] = 0.0f; // red
     push_constants.color_offset[3] = 0.0f; // alpha
 
-    vkCmdPushConstants(commandBuffer,
-                       graphicsPipelineLayout,
-                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-                       0,
-                       sizeof(PushConstants),
-                       &push_constants);
-
-    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
-    vkCmdEndRenderPass(commandBuffer);
-
-    printf("Preparing for compute shader dispatch.\n");
-
-    // The render pass automatically transitioned the image to VK_IMAGE_LAYOUT_GENERAL.
-    // We add a barrier to ensure the graphics writes are finished before compute reads start.
-    VkImageMemoryBarrier imageMemoryBarrier = {};
-    imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarrier.image = offscreenImage;
-    imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageMemoryBarrier.subresourceRange.levelCount = 1;
-    imageMemoryBarrier.subresourceRange.layerCount = 1;
-    imageMemoryBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-    imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL; // From render pass
-    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL; // Stays general
-
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, // Wait for graphics to finish
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,          // Before compute starts
-        0,
-        0, NULL,
-        0, NULL,
-        1, &imageMemoryBarrier);
-
-    // ---- Compute Pass ----
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &computeDescriptorSet, 0, NULL);
-
-    vkCmdPushConstants(commandBuffer,
-                       computePipelineLayout,
-                       VK_SHADER_STAGE_COMPUTE_BIT,
-                       0,
-                       sizeof(PushConstants),
-                       &push_constants);
-
-    // Dispatch the compute shader
-    uint32_t groupCountX = (IMAGE_WIDTH + 15) / 16; // 16 is local_size_x
-    uint32_t groupCountY = (IMAGE_HEIGHT + 15) / 16; // 16 is local_size_y
-    vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
-    printf("Compute shader dispatched.\n");
-
-    // Add a barrier to ensure compute shader writes are visible to the host
-    VkMemoryBarrier memoryBarrier = {};
-    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-    memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
-
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, // After compute shader
-        VK_PIPELINE_STAGE_HOST_BIT,           // Before host read
-        0,
-        1, &memoryBarrier,
-        0, NULL,
-        0, NULL);
+    // Full frame: leave clip space alone. Tiles set their own per frame.
+    push_constants.tile_transform[0] = 1.0f;
+    push_constants.tile_transform[1] = 1.0f;
+    push_constants.tile_transform[2] = 0.0f;
+    push_constants.tile_transform[3] = 0.0f;
+
+    uint32_t frameCount = FRAME_COUNT;
+    PushConstants *batch = NULL;
+    const PushConstants defaults = push_constants;
+    const char *socketPath = NULL;
+    if (argc > 2 && !strcmp(argv[1], "--serve")) {
+        if (TILED || useFileImport) {
+            fprintf(stderr, "Server mode reads frames back through memory, it does not combine with "
+                            "tiled rendering or READBACK_TO_FILE!\n");
+            return -1;
+        }
+        socketPath = argv[2];
+    } else if (argc > 1) {
+        if (TILED) {
+            fprintf(stderr, "Batch mode does not combine with tiled rendering!\n");
+            return -1;
+        }
+        batch = loadBatch(argv[1], &push_constants, &frameCount);
+        if (!batch)
+            return -1;
+        printf("Batch of %u frames loaded from %s.\n", frameCount, argv[1]);
+    }
 
-#if DO_COPY
-    // Image layout transition for offscreenImage from GENERAL to TRANSFER_SRC_OPTIMAL
-    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL; // It's now in GENERAL layout
-    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-    imageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT; // From compute read
-    imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT; // For copy command
-
-    vkCmdPipelineBarrier(commandBuffer,
-                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         0,
-                         0, NULL,
-                         0, NULL,
-                         1, &imageMemoryBarrier);
-
-    // Create a host-visible buffer to copy image data to
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = IMAGE_WIDTH * IMAGE_HEIGHT * 4; // RGBA, 4 bytes per pixel
-    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // 10. Writer thread: waits for each frame to finish on the GPU and
+    // serializes it while the GPU is already working on the next one.
+    FrameWriter writer = {};
+    writer.device = device;
+    writer.timeline = timeline;
+    writer.frameCount = frameCount;
+    if (batch) {
+        writer.results = calloc(frameCount, sizeof(writer.results[0]));
+        if (!writer.results) {
+            fprintf(stderr, "Failed to allocate the batch results!\n");
+            return -1;
+        }
+    }
+    writer.fileFormat = image_writer_format_from_env();
+    writer.checkQueries = checkQueries;
+    writer.timestampPeriod = deviceProperties.limits.timestampPeriod;
+    writer.occlusion = useOcclusion ? OCCLUSION_CHECK : 0;
+    writer.passQueries = passQueries;
+#if PALETTE_CLASSIFY
+    writer.classCount = classCount;
+#endif
+    if (spsc_queue_init(&writer.queue, FRAMES_IN_FLIGHT + 1) ||
+        sem_init(&writer.freeSlots, 0, FRAMES_IN_FLIGHT)) {
+        fprintf(stderr, "Failed to initialize the frame writer!\n");
+        return -1;
+    }
 
-    VkBuffer stagingBuffer;
-    VK_CHECK(vkCreateBuffer(device, &bufferInfo, NULL, &stagingBuffer));
+#if HOST_IMAGE_COPY
+    if (useHostImageCopy) {
+        writer.copyImageToMemory = (PFN_vkCopyImageToMemoryEXT)vkGetDeviceProcAddr(device, "vkCopyImageToMemoryEXT");
+        writer.image = offscreenImage;
+        writer.hostPixels = malloc((size_t)IMAGE_WIDTH * IMAGE_HEIGHT * 4);
+        if (!writer.copyImageToMemory || !writer.hostPixels || sem_init(&writer.imageFree, 0, 1)) {
+            fprintf(stderr, "Failed to set up host image copies!\n");
+            return -1;
+        }
+        printf("Reading back with vkCopyImageToMemoryEXT.\n");
+    }
+#endif
 
-    VkMemoryRequirements stagingMemRequirements;
-    vkGetBufferMemoryRequirements(device, stagingBuffer, &stagingMemRequirements);
+#if RLE_READBACK
+    writer.rleDecoded = malloc((size_t)IMAGE_WIDTH * IMAGE_HEIGHT * 4);
+    if (!writer.rleDecoded) {
+        fprintf(stderr, "Failed to allocate the RLE decode buffer!\n");
+        return -1;
+    }
+#endif
 
-    VkMemoryAllocateInfo stagingAllocInfo = {};
-    stagingAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    stagingAllocInfo.allocationSize = stagingMemRequirements.size;
-    stagingAllocInfo.memoryTypeIndex = findMemoryType(physicalDevice, stagingMemRequirements.memoryTypeBits,
-                                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+#if TILED
+    if (image_writer_stream_open(&writer.poster, "output.ppm", POSTER_WIDTH, POSTER_HEIGHT)) {
+        fprintf(stderr, "Failed to set up the %ux%u poster!\n", POSTER_WIDTH, POSTER_HEIGHT);
+        return -1;
+    }
+    printf("Rendering a %ux%u poster as %ux%u tiles of %ux%u.\n",
+           POSTER_WIDTH, POSTER_HEIGHT, TILES_X, TILES_Y, IMAGE_WIDTH, IMAGE_HEIGHT);
+#endif
 
-    VkDeviceMemory stagingBufferMemory;
-    VK_CHECK(vkAllocateMemory(device, &stagingAllocInfo, NULL, &stagingBufferMemory));
-    vkBindBufferMemory(device, stagingBuffer, stagingBufferMemory, 0);
-    printf("Staging buffer created and memory allocated.\n");
-
-    // Copy image to buffer
-    VkBufferImageCopy region = {};
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.layerCount = 1;
-    region.imageExtent.width = IMAGE_WIDTH;
-    region.imageExtent.height = IMAGE_HEIGHT;
-    region.imageExtent.depth = 1;
-
-    printf("vkCmdCopyImageToBuffer()\n");
-    vkCmdCopyImageToBuffer(commandBuffer,
-                           offscreenImage,
-                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                           stagingBuffer,
-                           1, &region);
-#endif
-    VK_CHECK(vkEndCommandBuffer(commandBuffer));
-    printf("Command Buffer recording ended.\n");
-
-    // 11. Submission and Synchronization
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
+#if DIRTY_TILES
+    writer.framebuffer = malloc((size_t)IMAGE_WIDTH * IMAGE_HEIGHT * 4);
+    VkBufferImageCopy *tileRegions = malloc(sizeof(VkBufferImageCopy) * DIFF_TILE_COUNT);
+    if (!writer.framebuffer || !tileRegions) {
+        fprintf(stderr, "Failed to allocate the dirty tile framebuffer!\n");
+        return -1;
+    }
+    double diffWaitMs = 0.0;
+#endif
 
-    VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
-    VK_CHECK(vkQueueWaitIdle(queue));
-    printf("Command Buffer submitted and queue idle.\n");
+    int listenFd = -1, clientFd = -1;
+    if (socketPath) {
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Socket path %s is too long!\n", socketPath);
+            return -1;
+        }
+        strcpy(addr.sun_path, socketPath);
+        unlink(socketPath);
 
-    uint32_t *computeData;
-    VK_CHECK(vkMapMemory(device, computeResultBufferMemory, 0, sizeof(uint32_t) * 4, 0, (void *)&computeData));
-    uint32_t triangleCount = computeData[0];
-    uint32_t backgroundCount = computeData[1];
-    uint32_t totalCount = computeData[2];
-    uint32_t testCount = computeData[3];
-    vkUnmapMemory(device, computeResultBufferMemory);
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listenFd, 16)) {
+            fprintf(stderr, "Failed to listen on %s: %s\n", socketPath, strerror(errno));
+            return -1;
+        }
+        printf("Serving render requests on %s.\n", socketPath);
+    }
 
-    printf("----------------------------------------\n");
-    printf("Compute Shader Result: triangleCount: %u backgroundCount: %u totalCount: %u test: %u\n",
-           triangleCount, backgroundCount, totalCount, testCount);
-    printf("----------------------------------------\n");
+#if SECONDARY_RECORDING
+    // Command pools are not thread safe, every recording thread gets its own
+    // with one secondary command buffer per slot.
+    const char *recordThreadsEnv = getenv("RECORD_THREADS");
+    long recordThreads = recordThreadsEnv && *recordThreadsEnv ? atol(recordThreadsEnv) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (recordThreads < 1)
+        recordThreads = 1;
+    if (recordThreads > RECORD_THREADS_MAX)
+        recordThreads = RECORD_THREADS_MAX;
+
+    Recorder recorder = {};
+    pthread_mutex_init(&recorder.lock, NULL);
+    pthread_cond_init(&recorder.posted, NULL);
+    pthread_cond_init(&recorder.finished, NULL);
+    recorder.inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    recorder.inheritance.renderPass = renderPass;
+    recorder.inheritance.subpass = 0;
+    recorder.inheritance.framebuffer = framebuffer;
+    recorder.layout = graphicsPipelineLayout;
+    recorder.vertexBuffer = vertexBuffer;
+    recorder.workers = calloc(recordThreads, sizeof(RecordWorker));
+    if (!recorder.workers) {
+        fprintf(stderr, "Failed to allocate the recording threads!\n");
+        return -1;
+    }
 
-#if DO_COPY
-    // 12. Readback and Save to PPM
-    VK_CHECK(vkMapMemory(device, stagingBufferMemory, 0, bufferInfo.size, 0, &data));
+    for (uint32_t i = 0; i < recordThreads; i++) {
+        RecordWorker *worker = &recorder.workers[i];
+        worker->recorder = &recorder;
+        worker->index = i;
+        VK_CHECK(vkCreateCommandPool(device, &cmdPoolInfo, NULL, &worker->commandPool));
+
+        VkCommandBufferAllocateInfo secondaryInfo = {};
+        secondaryInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        secondaryInfo.commandPool = worker->commandPool;
+        secondaryInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        secondaryInfo.commandBufferCount = FRAMES_IN_FLIGHT;
+        VK_CHECK(vkAllocateCommandBuffers(device, &secondaryInfo, worker->commandBuffers));
+    }
+    // Every worker splits DRAW_COUNT by workerCount, it is final before the
+    // first one starts.
+    recorder.workerCount = recordThreads;
+    for (uint32_t i = 0; i < recorder.workerCount; i++) {
+        if (pthread_create(&recorder.workers[i].thread, NULL, recordWorkerThread, &recorder.workers[i])) {
+            fprintf(stderr, "Failed to start recording thread %u!\n", i);
+            return -1;
+        }
+    }
+    printf("%u recording threads started.\n", recorder.workerCount);
+#endif
 
-    FILE* fp = fopen("output.ppm", "wb");
-    if (!fp) {
-        fprintf(stderr, "Failed to open output.ppm for writing!\n");
+    pthread_t writerThread;
+    if (pthread_create(&writerThread, NULL, frameWriterThread, &writer)) {
+        fprintf(stderr, "Failed to start the frame writer thread!\n");
         return -1;
     }
 
-    fprintf(fp, "P6\n%d %d\n255\n", IMAGE_WIDTH, IMAGE_HEIGHT);
-    // Write pixel data (RGBA to RGB for PPM)
-    for (int y = 0; y < IMAGE_HEIGHT; y++) {
-        for (int x = 0; x < IMAGE_WIDTH; x++) {
-            unsigned char* pixel = (unsigned char*)data + (y * IMAGE_WIDTH + x) * 4;
-            fwrite(pixel, 1, 3, fp); // Write R, G, B channels
+    // 11. Recording and Submission, one slot per frame in a ring
+    double renderStart = nowMs();
+    double setupMs = renderStart - setupStart;
+    double recordMs = 0.0;
+    double importMs = 0.0;
+
+    uint32_t frame;
+    for (frame = 0; listenFd >= 0 || frame < frameCount; frame++) {
+        RenderRequest request;
+        int shmFd = -1;
+
+        if (listenFd >= 0) {
+            if (nextRenderRequest(listenFd, &clientFd, &request, &shmFd, &writer))
+                break;
+            push_constants = defaults;
+            memcpy(push_constants.vertex_offset, request.vertex_offset, sizeof(request.vertex_offset));
+            memcpy(push_constants.color_offset, request.color_offset, sizeof(request.color_offset));
+            memcpy(push_constants.color, request.color, sizeof(request.color));
+            push_constants.test = request.test;
+        }
+
+        FrameSlot *slot = &frames[frame % FRAMES_IN_FLIGHT];
+        VkCommandBuffer commandBuffer = slot->commandBuffer;
+
+        // Slots come back in order, this only blocks when every one of them
+        // is still on the GPU or with the writer.
+        while (sem_wait(&writer.freeSlots) && errno == EINTR)
+            ;
+        slot->startMs = nowMs();
+
+        if (batch)
+            push_constants = batch[frame];
+
+#if TILED
+        // Scale the poster up so this tile fills clip space. Tile (x, y)
+        // covers [-1 + 2x / TILES_X, -1 + 2(x + 1) / TILES_X] of the
+        // poster's clip space horizontally, and the same vertically.
+        uint32_t tileX = frame % TILES_X, tileY = frame / TILES_X;
+        push_constants.tile_transform[0] = (float)TILES_X;
+        push_constants.tile_transform[1] = (float)TILES_Y;
+        push_constants.tile_transform[2] = TILES_X - 1.0f - 2.0f * tileX;
+        push_constants.tile_transform[3] = TILES_Y - 1.0f - 2.0f * tileY;
+#endif
+
+#if DO_COPY
+        VkBuffer readbackBuffer = slot->stagingBuffer;
+        if (useFileImport) {
+            char path[64];
+            framePath(path, sizeof(path), frame, frameCount, "pam");
+
+            double importStart = nowMs();
+            if (importOutputFile(device, physicalDevice, getMemoryHostPointerProperties,
+                                 hostPointerAlignment, slot, path))
+                return -1;
+            importMs += nowMs() - importStart;
+            writer.cpuBytes += hostPointerAlignment; // the padded header
+            readbackBuffer = slot->outputBuffer;
+        }
+#endif
+
+        double recordStart = nowMs();
+#if PRERECORDED
+        // The parameters are all that changes, the slot is idle so its
+        // buffer can be rewritten.
+        memcpy(slot->params, &push_constants, sizeof(PushConstants));
+        if (slot->recorded)
+            goto submit;
+        slot->recorded = 1;
+#endif
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = PRERECORDED ? 0 : VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+        // The counters are reused by every frame that lands in this slot.
+        vkCmdFillBuffer(commandBuffer, slot->resultBuffer, 0, VK_WHOLE_SIZE, 0);
+        if (checkQueries) {
+            vkCmdResetQueryPool(commandBuffer, checkQueries, slot->firstQuery, CHECK_QUERIES);
+            vkCmdResetQueryPool(commandBuffer, passQueries, frame % FRAMES_IN_FLIGHT * PASS_QUERIES, PASS_QUERIES);
+        }
+        if (useOcclusion)
+            vkCmdResetQueryPool(commandBuffer, occlusionQueries, frame % FRAMES_IN_FLIGHT, 1);
+#if DIRTY_TILES
+        vkCmdFillBuffer(commandBuffer, slot->dirtyBuffer, 0, sizeof(DirtyTileHeader), 0);
+#endif
+#if PALETTE_CLASSIFY
+        vkCmdFillBuffer(commandBuffer, slot->classBuffer, 0, VK_WHOLE_SIZE, 0);
+#endif
+#if IMAGE_STATS
+        vkCmdFillBuffer(commandBuffer, slot->statsBuffer, 0, VK_WHOLE_SIZE, 0);
+#endif
+
+        VkMemoryBarrier clearBarrier = {};
+        clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+                                     (useOcclusion ? VK_ACCESS_TRANSFER_WRITE_BIT : 0);
+
+        // The query copy and the subpass check write the cleared result
+        // buffer too.
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | (useOcclusion ? VK_PIPELINE_STAGE_TRANSFER_BIT : 0) |
+                                 (SUBPASS_CHECK ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : 0),
+                             0,
+                             1, &clearBarrier,
+                             0, NULL,
+                             0, NULL);
+
+        if (checkQueries)
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, passQueries,
+                                frame % FRAMES_IN_FLIGHT * PASS_QUERIES);
+
+        // ---- Graphics Pass ----
+        VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f}; // black color
+        VkRenderPassBeginInfo renderPassBeginInfo = {};
+        renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassBeginInfo.renderPass = renderPass;
+        renderPassBeginInfo.framebuffer = framebuffer;
+        renderPassBeginInfo.renderArea.extent.width = IMAGE_WIDTH;
+        renderPassBeginInfo.renderArea.extent.height = IMAGE_HEIGHT;
+        renderPassBeginInfo.clearValueCount = 1;
+        renderPassBeginInfo.pClearValues = &clearColor;
+
+#if SECONDARY_RECORDING
+        // The recording threads fill the pass, the primary only runs what
+        // they recorded.
+        VK_CHECK(recordSecondaries(&recorder, frame % FRAMES_IN_FLIGHT, usePipeline(&pipelineCache, &graphicsJob),
+                                   &push_constants));
+        VkCommandBuffer secondaries[RECORD_THREADS_MAX];
+        for (uint32_t i = 0; i < recorder.workerCount; i++)
+            secondaries[i] = recorder.workers[i].commandBuffers[frame % FRAMES_IN_FLIGHT];
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        vkCmdExecuteCommands(commandBuffer, recorder.workerCount, secondaries);
+#else
+#if PIPELINE_VARIANTS
+        // Shader objects render without the render pass.
+        pipeline_variants_begin_rendering(&pipelineVariants, commandBuffer, &renderPassBeginInfo,
+                                          offscreenImage, offscreenImageView);
+        VK_CHECK(pipeline_variants_bind(&pipelineVariants, commandBuffer, frame % PIPELINE_VARIANT_COUNT));
+#else
+        vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, usePipeline(&pipelineCache, &graphicsJob));
+#endif
+
+        VkBuffer vertexBuffers[] = {vertexBuffer};
+        VkDeviceSize offsets[] = {0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+#if PRERECORDED
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &slot->paramsSet, 0, NULL);
+#else
+        vkCmdPushConstants(commandBuffer,
+                           graphicsPipelineLayout,
+                           VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                           0,
+                           sizeof(PushConstants),
+                           &push_constants);
+#endif
+
+#if DRAW_COUNT > 1
+        recordDraws(commandBuffer, graphicsPipelineLayout, &push_constants, 0, DRAW_COUNT);
+#else
+        if (useOcclusion)
+            vkCmdBeginQuery(commandBuffer, occlusionQueries, frame % FRAMES_IN_FLIGHT, VK_QUERY_CONTROL_PRECISE_BIT);
+        vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+        if (useOcclusion)
+            vkCmdEndQuery(commandBuffer, occlusionQueries, frame % FRAMES_IN_FLIGHT);
+#endif
+#endif
+#if SUBPASS_CHECK
+        // ---- Check Subpass ----
+        // One triangle over the whole image, a fragment per pixel.
+        vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, usePipeline(&pipelineCache, &subpassJob));
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, subpassPipelineLayout, 0, 1,
+                                &slot->subpassSet, 0, NULL);
+        vkCmdPushConstants(commandBuffer, subpassPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstants),
+                           &push_constants);
+        vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+#endif
+#if PIPELINE_VARIANTS
+        pipeline_variants_end_rendering(&pipelineVariants, commandBuffer, offscreenImage);
+#else
+        vkCmdEndRenderPass(commandBuffer);
+#endif
+
+        // The render pass automatically transitioned the image to VK_IMAGE_LAYOUT_GENERAL.
+        // We add a barrier to ensure the graphics writes are finished before compute reads start.
+        VkImageMemoryBarrier imageMemoryBarrier = {};
+        imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageMemoryBarrier.image = offscreenImage;
+        imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageMemoryBarrier.subresourceRange.levelCount = 1;
+        imageMemoryBarrier.subresourceRange.layerCount = 1;
+        imageMemoryBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL; // From render pass
+        imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL; // Stays general
+
+        if (computeReadsImage)
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, // Wait for graphics to finish
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,          // Before compute starts
+                0,
+                0, NULL,
+                0, NULL,
+                1, &imageMemoryBarrier);
+
+        // ---- Compute Pass ----
+        // Once the render pass is done, so the check is timed alone.
+        if (checkQueries)
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, checkQueries, slot->firstQuery);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &slot->descriptorSet, 0, NULL);
+
+        // Dispatch the compute shader
+        uint32_t groupCountX = (IMAGE_WIDTH + 15) / 16; // 16 is local_size_x
+        uint32_t groupCountY = (IMAGE_HEIGHT + 15) / 16; // 16 is local_size_y
+        if (checkDispatch) {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, usePipeline(&pipelineCache, &computeJob));
+#if PRERECORDED
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 1, 1, &slot->paramsSet, 0, NULL);
+#else
+            vkCmdPushConstants(commandBuffer,
+                               computePipelineLayout,
+                               VK_SHADER_STAGE_COMPUTE_BIT,
+                               0,
+                               sizeof(PushConstants),
+                               &push_constants);
+#endif
+            vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+
+#if CHECK_REDUCTION == 2
+            // Every workgroup's counts are written before the sum reads them.
+            VkMemoryBarrier partialsBarrier = {};
+            partialsBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            partialsBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            partialsBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0,
+                                 1, &partialsBarrier,
+                                 0, NULL,
+                                 0, NULL);
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, usePipeline(&pipelineCache, &sumJob));
+            uint32_t sumGroups = (checkGroups + 255) / 256;
+            vkCmdDispatch(commandBuffer, sumGroups < CHECK_SUM_GROUPS_MAX ? sumGroups : CHECK_SUM_GROUPS_MAX, 1, 1);
+#endif
+        }
+        if (useOcclusion) {
+            // Samples that passed, next to check.comp's counters.
+            vkCmdCopyQueryPoolResults(commandBuffer, occlusionQueries, frame % FRAMES_IN_FLIGHT, 1, slot->resultBuffer,
+                                      sizeof(uint32_t) * 4, sizeof(uint32_t), VK_QUERY_RESULT_WAIT_BIT);
+
+            VkMemoryBarrier queryBarrier = {};
+            queryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            queryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            queryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_HOST_BIT,
+                                 0,
+                                 1, &queryBarrier,
+                                 0, NULL,
+                                 0, NULL);
+        }
+        if (checkQueries)
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, checkQueries, slot->firstQuery + 1);
+        if (checkQueries)
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, passQueries,
+                                frame % FRAMES_IN_FLIGHT * PASS_QUERIES + 1);
+
+#if PALETTE_CLASSIFY
+        // Reads the image in GENERAL like the check, through the same set.
+        // When timed, it waits for the check to finish, otherwise the two
+        // overlap and the timestamps only catch the part of it after the
+        // check.
+        if (checkQueries)
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0,
+                                 0, NULL,
+                                 0, NULL,
+                                 0, NULL);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, usePipeline(&pipelineCache, &classifyJob));
+        vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+        if (checkQueries)
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, checkQueries, slot->firstQuery + 2);
+#endif
+#if IMAGE_STATS
+        // Timed alone like the classification: after the dispatches before.
+        if (checkQueries)
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0,
+                                 0, NULL,
+                                 0, NULL,
+                                 0, NULL);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, usePipeline(&pipelineCache, &statsJob));
+        vkCmdDispatch(commandBuffer, groupCountX, groupCountY, 1);
+        if (checkQueries)
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, checkQueries,
+                                slot->firstQuery + CHECK_QUERIES - 1);
+#endif
+
+        // Add a barrier to ensure compute shader writes are visible to the host
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | // After compute shader
+                (SUBPASS_CHECK ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : 0), // or the check subpass
+            VK_PIPELINE_STAGE_HOST_BIT,           // Before host read
+            0,
+            1, &memoryBarrier,
+            0, NULL,
+            0, NULL);
+
+        // Once everything before has finished, so the readback is timed alone.
+        if (checkQueries)
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, passQueries,
+                                frame % FRAMES_IN_FLIGHT * PASS_QUERIES + 2);
+
+#if PACK_RGB24
+        // The image stays in GENERAL, both dispatches only read it.
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, usePipeline(&pipelineCache, &packJob));
+        // A row of workgroups covers at least one image row of 4-pixel quads.
+        vkCmdDispatch(commandBuffer, ((IMAGE_WIDTH + 3) / 4 + 63) / 64, IMAGE_HEIGHT, 1);
+
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0,
+                             1, &memoryBarrier,
+                             0, NULL,
+                             0, NULL);
+
+        // Copy the packed pixels to this slot's staging buffer or the file
+        VkBufferCopy packedRegion = {};
+        packedRegion.size = (VkDeviceSize)IMAGE_WIDTH * IMAGE_HEIGHT * 3;
+        vkCmdCopyBuffer(commandBuffer, slot->packedBuffer, readbackBuffer, 1, &packedRegion);
+#elif RLE_READBACK
+        // Every pass reads what the previous one wrote, the image stays in
+        // GENERAL and is only read.
+        (void)readbackBuffer; // nothing is copied, the runs are written in place
+        uint32_t rowGroups = (IMAGE_HEIGHT + 63) / 64;
+        uint32_t rleGroups[3] = { rowGroups, 1, rowGroups };
+
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        for (uint32_t i = 0; i < 3; i++) {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, usePipeline(&pipelineCache, &rleJobs[i]));
+            vkCmdDispatch(commandBuffer, rleGroups[i], 1, 1);
+            if (i < 2)
+                vkCmdPipelineBarrier(commandBuffer,
+                                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                     0,
+                                     1, &memoryBarrier,
+                                     0, NULL,
+                                     0, NULL);
+        }
+
+        // The writer thread reads the runs once the fence signals.
+        memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                             0,
+                             1, &memoryBarrier,
+                             0, NULL,
+                             0, NULL);
+#elif DIRTY_TILES
+        // The diff of the previous frame wrote previousBuffer, check.comp
+        // only read the image: order both before this frame's diff.
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             1, &memoryBarrier,
+                             0, NULL,
+                             0, NULL);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, usePipeline(&pipelineCache, &diffJob));
+        vkCmdDispatch(commandBuffer, DIFF_TILES_X, DIFF_TILES_Y, 1);
+
+        // The render loop reads the tile list once the fence signals.
+        memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                             0,
+                             1, &memoryBarrier,
+                             0, NULL,
+                             0, NULL);
+#elif DO_COPY
+        if (useHostImageCopy) {
+            // Nothing to copy on the GPU, the image stays in GENERAL and the
+            // writer thread copies it out once the fence signals.
+            imageMemoryBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            imageMemoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                 VK_PIPELINE_STAGE_HOST_BIT,
+                                 0,
+                                 0, NULL,
+                                 0, NULL,
+                                 1, &imageMemoryBarrier);
+        } else {
+            // Image layout transition for offscreenImage from GENERAL to TRANSFER_SRC_OPTIMAL
+            imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL; // It's now in GENERAL layout
+            imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT; // For copy command
+
+            // Straight after the render pass when nothing read the image in between.
+            if (computeReadsImage)
+                imageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT; // From compute read
+            vkCmdPipelineBarrier(commandBuffer,
+                                 computeReadsImage ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                                                   : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                                         (SUBPASS_CHECK ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : 0),
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 0,
+                                 0, NULL,
+                                 0, NULL,
+                                 1, &imageMemoryBarrier);
+
+            // Copy image to this slot's staging buffer or straight into the file
+            VkBufferImageCopy region = {};
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.layerCount = 1;
+            region.imageExtent.width = IMAGE_WIDTH;
+            region.imageExtent.height = IMAGE_HEIGHT;
+            region.imageExtent.depth = 1;
+
+            vkCmdCopyImageToBuffer(commandBuffer,
+                                   offscreenImage,
+                                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                   readbackBuffer,
+                                   1, &region);
+        }
+#endif
+        if (checkQueries)
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, passQueries,
+                                frame % FRAMES_IN_FLIGHT * PASS_QUERIES + 3);
+
+#if DO_COPY && !RLE_READBACK && !DIRTY_TILES
+        // The writer thread maps the staging buffer once the fence signals.
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        if (!useHostImageCopy)
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_HOST_BIT,
+                                 0,
+                                 1, &memoryBarrier,
+                                 0, NULL,
+                                 0, NULL);
+#endif
+        VK_CHECK(vkEndCommandBuffer(commandBuffer));
+#if PRERECORDED
+submit:
+#endif
+        recordMs += nowMs() - recordStart;
+
+#if HOST_IMAGE_COPY
+        // The writer copies the previous frame out of offscreenImage on the
+        // CPU, that has to finish before the GPU draws over it again. The
+        // disk write still overlaps with this frame.
+        if (useHostImageCopy)
+            while (sem_wait(&writer.imageFree) && errno == EINTR)
+                ;
+#endif
+        submitFrame(device, queue, commandBuffer, slot, timeline, &timelineValue);
+
+#if DIRTY_TILES
+        // The copy regions depend on the diff, so wait for it before
+        // recording the copy. The writer keeps working on the previous frame
+        // meanwhile, and the copy is queued before the next frame's draw.
+        double diffStart = nowMs();
+        waitForFrame(device, timeline, slot);
+        diffWaitMs += nowMs() - diffStart;
+
+        DirtyTileHeader *dirtyHeader = slot->dirty;
+        DirtyTile *dirtyTiles = (DirtyTile *)(dirtyHeader + 1);
+        if (frame == 0) {
+            dirtyHeader->tileCount = DIFF_TILE_COUNT;
+            for (uint32_t i = 0; i < DIFF_TILE_COUNT; i++) {
+                dirtyTiles[i].x = i % DIFF_TILES_X;
+                dirtyTiles[i].y = i / DIFF_TILES_X;
+            }
+        }
+
+        for (uint32_t i = 0; i < dirtyHeader->tileCount; i++) {
+            uint32_t x0 = dirtyTiles[i].x * DIFF_TILE_SIZE, y0 = dirtyTiles[i].y * DIFF_TILE_SIZE;
+            VkBufferImageCopy *region = &tileRegions[i];
+
+            memset(region, 0, sizeof(*region));
+            region->bufferOffset = (VkDeviceSize)i * DIFF_TILE_SIZE * DIFF_TILE_SIZE * 4;
+            region->bufferRowLength = DIFF_TILE_SIZE;
+            region->bufferImageHeight = DIFF_TILE_SIZE;
+            region->imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region->imageSubresource.layerCount = 1;
+            region->imageOffset.x = x0;
+            region->imageOffset.y = y0;
+            region->imageExtent.width = IMAGE_WIDTH - x0 < DIFF_TILE_SIZE ? IMAGE_WIDTH - x0 : DIFF_TILE_SIZE;
+            region->imageExtent.height = IMAGE_HEIGHT - y0 < DIFF_TILE_SIZE ? IMAGE_HEIGHT - y0 : DIFF_TILE_SIZE;
+            region->imageExtent.depth = 1;
+        }
+
+        VK_CHECK(vkBeginCommandBuffer(slot->copyCommandBuffer, &beginInfo));
+
+        // Image layout transition for offscreenImage from GENERAL to TRANSFER_SRC_OPTIMAL
+        imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        imageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        vkCmdPipelineBarrier(slot->copyCommandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0,
+                             0, NULL,
+                             0, NULL,
+                             1, &imageMemoryBarrier);
+
+        if (dirtyHeader->tileCount)
+            vkCmdCopyImageToBuffer(slot->copyCommandBuffer,
+                                   offscreenImage,
+                                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                   readbackBuffer,
+                                   dirtyHeader->tileCount, tileRegions);
+
+        // The writer thread maps the staging buffer once the fence signals.
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        vkCmdPipelineBarrier(slot->copyCommandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                             0,
+                             1, &memoryBarrier,
+                             0, NULL,
+                             0, NULL);
+        VK_CHECK(vkEndCommandBuffer(slot->copyCommandBuffer));
+
+        submitFrame(device, queue, slot->copyCommandBuffer, slot, timeline, &timelineValue);
+#endif
+
+        slot->frameIndex = frame;
+        if (listenFd >= 0) {
+            // The writer answers on its own descriptor, this one may be
+            // closed before the frame leaves the ring.
+            slot->clientFd = fcntl(clientFd, F_DUPFD_CLOEXEC, 0);
+            slot->output = request.output;
+            slot->shmFd = shmFd;
+            memcpy(slot->outputPath, request.path, sizeof(slot->outputPath));
         }
+        spsc_queue_push(&writer.queue, slot);
     }
-    fclose(fp);
-    printf("Rendered image saved to output.ppm\n");
 
-    vkUnmapMemory(device, stagingBufferMemory);
+    if (listenFd >= 0) {
+        frameCount = frame; // the number of requests rendered
+        close(listenFd);
+        unlink(socketPath);
+    }
+
+    // 12. Drain the writer and report throughput
+    spsc_queue_push(&writer.queue, NULL);
+    pthread_join(writerThread, NULL);
+    double renderMs = nowMs() - renderStart;
+
+    // Every pipeline has been used, save what was compiled for the next run.
+    pipeline_cache_close(&pipelineCache);
+    double firstPipelineMs = graphicsJob.done_ms - setupStart;
+#if PIPELINE_VARIANTS
+    pipeline_variants_close(&pipelineVariants);
 #endif
 
-    // 13. Cleanup
-    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-    vkDestroyCommandPool(device, commandPool, NULL);
+    vkDestroyShaderModule(device, fragShaderModule, NULL);
+    vkDestroyShaderModule(device, vertShaderModule, NULL);
+    vkDestroyShaderModule(device, computeShaderModule, NULL);
+#if SUBPASS_CHECK
+    vkDestroyShaderModule(device, subpassVertModule, NULL);
+    vkDestroyShaderModule(device, subpassFragModule, NULL);
+#endif
+#if CHECK_REDUCTION == 2
+    vkDestroyShaderModule(device, sumShaderModule, NULL);
+#endif
+#if PACK_RGB24
+    vkDestroyShaderModule(device, packShaderModule, NULL);
+#endif
+#if RLE_READBACK
+    for (uint32_t i = 0; i < 3; i++)
+        vkDestroyShaderModule(device, rleShaderModules[i], NULL);
+#endif
+#if DIRTY_TILES
+    vkDestroyShaderModule(device, diffShaderModule, NULL);
+#endif
+#if PALETTE_CLASSIFY
+    vkDestroyShaderModule(device, classifyShaderModule, NULL);
+#endif
+#if IMAGE_STATS
+    vkDestroyShaderModule(device, statsShaderModule, NULL);
+#endif
+
+    printf("----------------------------------------\n");
+    printf("setup: %.2f ms, once per process, %s pipeline cache\n", setupMs, pipelineCache.warm ? "warm" : "cold");
+    const char *shaderDir = getenv("SHADER_DIR");
+    printf("first pipeline: %.2f ms, shaders %s\n", firstPipelineMs,
+           shaderDir && *shaderDir ? "mapped from SHADER_DIR" : "embedded");
+    printf("%u frames, %u in flight: %.2f ms total, %.1f frames/s\n",
+           frameCount, FRAMES_IN_FLIGHT, renderMs, frameCount * 1000.0 / renderMs);
+    printf("writer thread: %.3f ms/frame waiting for the GPU, %.3f ms/frame writing\n",
+           writer.waitMs / frameCount, writer.writeMs / frameCount);
+    printf("latency: %.3f ms/frame mean, %.3f ms max from recording until written, synchronized with %s\n",
+           writer.latencyMs / frameCount, writer.maxLatencyMs, timeline ? "a timeline semaphore" : "fences");
+    if (checkQueries)
+        printf("render pass + check: %.4f ms/frame on the GPU, the check %s\n", writer.passMs / frameCount,
+               SUBPASS_CHECK ? "in a second subpass" : checkDispatch ? "as a compute dispatch" : "as an occlusion query");
+    if (checkQueries)
+        printf("readback: %.4f ms/frame on the GPU, %s\n", writer.readbackMs / frameCount,
+               RLE_READBACK ? "rle_*.comp passes writing the runs" :
+               PACK_RGB24 ? "RGB24 pack and copy" :
+               DIRTY_TILES ? "tile diff" :
+               useFileImport ? "copy of the RGBA8 image into the imported file" :
+               useHostImageCopy ? "nothing, the host copies the image" : "staging copy of the RGBA8 image");
+#if SUBPASS_CHECK
+    if (checkQueries)
+        printf("check: in the render pass, %s\n",
+               useFragmentSubgroups ? "reduced with subgroupAdd()" : "atomics per pixel");
+#else
+    if (checkQueries && writer.occlusion == 1)
+        printf("check: %.4f ms/frame on the GPU copying the occlusion query, no dispatch\n",
+               writer.checkMs / frameCount);
+    else if (checkQueries)
+        printf("check: %.4f ms/frame on the GPU for %ux%u pixels, %s%s\n", writer.checkMs / frameCount,
+               IMAGE_WIDTH, IMAGE_HEIGHT,
+               CHECK_REDUCTION == 0 ? "atomics per pixel" :
+               CHECK_REDUCTION == 1 ? "atomics per workgroup" : "partials per workgroup and a sum pass",
+               !CHECK_REDUCTION ? "" : useSubgroups ? ", reduced with subgroupAdd()" : ", reduced in shared memory");
+#endif
+    if (writer.occlusion == 2)
+        printf("occlusion query: agreed with check.comp on %u of %u frames\n",
+               frameCount - writer.occlusionMismatches, frameCount);
+#if PALETTE_CLASSIFY
+    if (checkQueries)
+        printf("classify: %.4f ms/frame on the GPU for %u classes%s\n", writer.classifyMs / frameCount,
+               classCount, PALETTE_CLASSIFY == 2 ? " with bounding boxes" : "");
+#endif
+#if IMAGE_STATS
+    if (checkQueries)
+        printf("stats: %.4f ms/frame on the GPU, %zu bytes/frame read back for them instead of %zu\n",
+               writer.statsMs / frameCount, sizeof(ImageStats), (size_t)IMAGE_WIDTH * IMAGE_HEIGHT * 4);
+#endif
+    printf("recording: %.4f ms/frame for %u draws, %s\n", recordMs / frameCount, DRAW_COUNT,
+           PRERECORDED ? "recorded once per slot, parameters through a uniform buffer" :
+           SECONDARY_RECORDING ? "recorded every frame into secondary command buffers" : "recorded every frame");
+#if SECONDARY_RECORDING
+    double busyMs = 0.0, maxBusyMs = 0.0;
+    for (uint32_t i = 0; i < recorder.workerCount; i++) {
+        busyMs += recorder.workers[i].busyMs;
+        if (recorder.workers[i].busyMs > maxBusyMs)
+            maxBusyMs = recorder.workers[i].busyMs;
+    }
+    printf("recording threads: %u, %.4f ms/frame busy on average, %.4f ms/frame on the busiest\n",
+           recorder.workerCount, busyMs / recorder.workerCount / frameCount, maxBusyMs / frameCount);
+#endif
+#if DO_COPY
+    printf("readback via %s: %llu bytes/frame from the GPU (%s), %llu bytes/frame through the CPU, %.3f ms/frame importing\n",
+           useFileImport ? "file import" : useHostImageCopy ? "host image copy" :
+           DIRTY_TILES ? "dirty tiles" : "staging buffer",
+           (unsigned long long)IMAGE_WIDTH * IMAGE_HEIGHT * READBACK_CHANNELS, PACK_RGB24 ? "RGB24" : "RGBA8",
+           (unsigned long long)(writer.cpuBytes / frameCount), importMs / frameCount);
+#endif
+#if TILED
+    if (image_writer_stream_close(&writer.poster) == 0)
+        printf("Rendered poster saved to output.ppm\n");
+    printf("Poster Compute Shader Result: triangleCount: %llu backgroundCount: %llu totalCount: %llu test: %llu\n",
+           (unsigned long long)writer.totals[0], (unsigned long long)writer.totals[1],
+           (unsigned long long)writer.totals[2], (unsigned long long)writer.totals[3]);
+#endif
+#if RLE_READBACK
+    printf("RLE: %.1f bytes/frame read back, %.2f%% of RGBA8 (%.1fx), %.3f ms/frame decoding\n",
+           (double)writer.rleBytes / frameCount,
+           100.0 * writer.rleBytes / ((double)IMAGE_WIDTH * IMAGE_HEIGHT * 4 * frameCount),
+           (double)IMAGE_WIDTH * IMAGE_HEIGHT * 4 * frameCount / writer.rleBytes,
+           writer.decodeMs / frameCount);
+    free(writer.rleDecoded);
+#endif
+#if DIRTY_TILES
+    printf("dirty tiles: %.1f of %u tiles/frame, %.1f bytes/frame read back (%.2f%% of RGBA8), %.3f ms/frame waiting for the diff\n",
+           (double)writer.dirtyTiles / frameCount, DIFF_TILE_COUNT,
+           (double)writer.dirtyTiles * DIFF_TILE_SIZE * DIFF_TILE_SIZE * 4 / frameCount,
+           100.0 * writer.dirtyTiles * DIFF_TILE_SIZE * DIFF_TILE_SIZE / ((double)IMAGE_WIDTH * IMAGE_HEIGHT * frameCount),
+           diffWaitMs / frameCount);
+    free(writer.framebuffer);
+    free(tileRegions);
+#endif
+#if HOST_IMAGE_COPY
+    if (useHostImageCopy) {
+        printf("host image copy: %.3f ms/frame in vkCopyImageToMemoryEXT\n", writer.copyMs / frameCount);
+        sem_destroy(&writer.imageFree);
+        free(writer.hostPixels);
+    }
+#endif
+    printf("----------------------------------------\n");
+
+    if (batch) {
+        FILE *fp = fopen("results.csv", "w");
+        if (fp) {
+            fprintf(fp, "frame,triangle,background,total,test\n");
+            for (uint32_t i = 0; i < frameCount; i++)
+                fprintf(fp, "%u,%u,%u,%u,%u\n", i, writer.results[i][0], writer.results[i][1],
+                        writer.results[i][2], writer.results[i][3]);
+            fclose(fp);
+            printf("Batch results saved to results.csv\n");
+        } else {
+            fprintf(stderr, "Failed to open results.csv: %s\n", strerror(errno));
+        }
+        free(writer.results);
+        free(batch);
+    }
+
+    spsc_queue_destroy(&writer.queue);
+    sem_destroy(&writer.freeSlots);
 
+    // 13. Cleanup
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        FrameSlot *slot = &frames[i];
+
+        vkFreeCommandBuffers(device, commandPool, 1, &slot->commandBuffer);
+#if DIRTY_TILES
+        vkFreeCommandBuffers(device, commandPool, 1, &slot->copyCommandBuffer);
+        vkUnmapMemory(device, slot->dirtyBufferMemory);
+        vkDestroyBuffer(device, slot->dirtyBuffer, NULL);
+        vkFreeMemory(device, slot->dirtyBufferMemory, NULL);
+#endif
+#if PALETTE_CLASSIFY
+        vkUnmapMemory(device, slot->classBufferMemory);
+        vkDestroyBuffer(device, slot->classBuffer, NULL);
+        vkFreeMemory(device, slot->classBufferMemory, NULL);
+#endif
+#if IMAGE_STATS
+        vkUnmapMemory(device, slot->statsBufferMemory);
+        vkDestroyBuffer(device, slot->statsBuffer, NULL);
+        vkFreeMemory(device, slot->statsBufferMemory, NULL);
+#endif
+        if (slot->fence)
+            vkDestroyFence(device, slot->fence, NULL);
 #if DO_COPY
-    vkDestroyBuffer(device, stagingBuffer, NULL);
-    vkFreeMemory(device, stagingBufferMemory, NULL);
+        if (slot->stagingBuffer) {
+            vkUnmapMemory(device, slot->stagingBufferMemory);
+            vkDestroyBuffer(device, slot->stagingBuffer, NULL);
+            vkFreeMemory(device, slot->stagingBufferMemory, NULL);
+        }
+#endif
+#if PACK_RGB24
+        vkDestroyBuffer(device, slot->packedBuffer, NULL);
+        vkFreeMemory(device, slot->packedBufferMemory, NULL);
 #endif
+#if RLE_READBACK
+        vkDestroyBuffer(device, slot->rleRowsBuffer, NULL);
+        vkFreeMemory(device, slot->rleRowsBufferMemory, NULL);
+        vkUnmapMemory(device, slot->rleBufferMemory);
+        vkDestroyBuffer(device, slot->rleBuffer, NULL);
+        vkFreeMemory(device, slot->rleBufferMemory, NULL);
+#endif
+#if PRERECORDED
+        vkUnmapMemory(device, slot->paramsBufferMemory);
+        vkDestroyBuffer(device, slot->paramsBuffer, NULL);
+        vkFreeMemory(device, slot->paramsBufferMemory, NULL);
+#endif
+#if CHECK_REDUCTION == 2
+        vkDestroyBuffer(device, slot->partialsBuffer, NULL);
+        vkFreeMemory(device, slot->partialsBufferMemory, NULL);
+#endif
+        vkUnmapMemory(device, slot->resultBufferMemory);
+        vkDestroyBuffer(device, slot->resultBuffer, NULL);
+        vkFreeMemory(device, slot->resultBufferMemory, NULL);
+    }
+    vkDestroyCommandPool(device, commandPool, NULL);
+    if (checkQueries)
+        vkDestroyQueryPool(device, checkQueries, NULL);
+    if (occlusionQueries)
+        vkDestroyQueryPool(device, occlusionQueries, NULL);
+    if (passQueries)
+        vkDestroyQueryPool(device, passQueries, NULL);
+#if SECONDARY_RECORDING
+    pthread_mutex_lock(&recorder.lock);
+    recorder.stopping = 1;
+    pthread_cond_broadcast(&recorder.posted);
+    pthread_mutex_unlock(&recorder.lock);
+    for (uint32_t i = 0; i < recorder.workerCount; i++) {
+        pthread_join(recorder.workers[i].thread, NULL);
+        vkFreeCommandBuffers(device, recorder.workers[i].commandPool, FRAMES_IN_FLIGHT, recorder.workers[i].commandBuffers);
+        vkDestroyCommandPool(device, recorder.workers[i].commandPool, NULL);
+    }
+    free(recorder.workers);
+    pthread_cond_destroy(&recorder.finished);
+    pthread_cond_destroy(&recorder.posted);
+    pthread_mutex_destroy(&recorder.lock);
+#endif
+    if (timeline)
+        vkDestroySemaphore(device, timeline, NULL);
 
     // NEW: Cleanup compute resources
-    vkDestroyPipeline(device, computePipeline, NULL);
+    vkDestroyPipeline(device, computeJob.pipeline, NULL);
+#if CHECK_REDUCTION == 2
+    vkDestroyPipeline(device, sumJob.pipeline, NULL);
+#endif
+#if PACK_RGB24
+    vkDestroyPipeline(device, packJob.pipeline, NULL);
+#endif
+#if RLE_READBACK
+    for (uint32_t i = 0; i < 3; i++)
+        vkDestroyPipeline(device, rleJobs[i].pipeline, NULL);
+#endif
+#if DIRTY_TILES
+    vkDestroyPipeline(device, diffJob.pipeline, NULL);
+    vkDestroyBuffer(device, previousBuffer, NULL);
+    vkFreeMemory(device, previousBufferMemory, NULL);
+#endif
+#if PALETTE_CLASSIFY
+    vkDestroyPipeline(device, classifyJob.pipeline, NULL);
+    vkDestroyBuffer(device, paletteBuffer, NULL);
+    vkFreeMemory(device, paletteBufferMemory, NULL);
+#endif
+#if IMAGE_STATS
+    vkDestroyPipeline(device, statsJob.pipeline, NULL);
+#endif
     vkDestroyPipelineLayout(device, computePipelineLayout, NULL);
     vkDestroyDescriptorSetLayout(device, computeSetLayout, NULL);
+#if PRERECORDED
+    vkDestroyDescriptorSetLayout(device, paramsSetLayout, NULL);
+#endif
     vkDestroyDescriptorPool(device, computeDescriptorPool, NULL);
-    vkDestroyBuffer(device, computeResultBuffer, NULL);
-    vkFreeMemory(device, computeResultBufferMemory, NULL);
+#if SUBPASS_CHECK
+    vkDestroyPipeline(device, subpassJob.pipeline, NULL);
+    vkDestroyPipelineLayout(device, subpassPipelineLayout, NULL);
+    vkDestroyDescriptorSetLayout(device, subpassSetLayout, NULL);
+    vkDestroyDescriptorPool(device, subpassDescriptorPool, NULL);
+#endif
 
     vkDestroyFramebuffer(device, framebuffer, NULL);
     vkDestroyRenderPass(device, renderPass, NULL);
-    vkDestroyPipeline(device, graphicsPipeline, NULL);
+    vkDestroyPipeline(device, graphicsJob.pipeline, NULL);
     vkDestroyPipelineLayout(device, graphicsPipelineLayout, NULL);
 
     vkDestroyBuffer(device, vertexBuffer, NULL);
@@ -884,4 +4009,4 @@ int main() {
     printf("Vulkan resources cleaned up. Exiting.\n");
 
     return 0;
-}
\ No newline at end of file
+}
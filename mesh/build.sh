@@ -1,3 +1,5 @@
 glslc --target-env=vulkan1.3 triangle.mesh -o mesh.spv
 glslc --target-env=vulkan1.3 triangle.frag -o frag.spv
-gcc main.c -o main.bin -lvulkan
+glslc --target-env=vulkan1.3 -mfmt=c triangle.mesh -o mesh.spv.h
+glslc --target-env=vulkan1.3 -mfmt=c triangle.frag -o frag.spv.h
+gcc -O2 main.c ../image_writer.c ../pipeline_cache.c ../shader_code.c -o main.bin -lvulkan -pthread -lz
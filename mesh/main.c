@@ -3,6 +3,20 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../image_writer.h"
+#include "../pipeline_cache.h"
+#include "../shader_code.h"
+
+// Compiled in by build.sh
+static const uint32_t meshSpv[] =
+#include "mesh.spv.h"
+;
+static const uint32_t fragSpv[] =
+#include "frag.spv.h"
+;
+static const ShaderCode meshShader = SHADER_CODE("mesh.spv", meshSpv);
+static const ShaderCode fragShader = SHADER_CODE("frag.spv", fragSpv);
+
 #define WIDTH 512
 #define HEIGHT 512
 
@@ -19,22 +33,6 @@ typedef struct {
     float color[4];
 } UniformBufferObject;
 
-// Utility: Read file contents
-char* read_file(const char* filename, size_t* out_size) {
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-        fprintf(stderr, "Failed to open file: %s\n", filename);
-        exit(1);
-    }
-    fseek(file, 0, SEEK_END);
-    *out_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    char* buffer = (char*)malloc(*out_size);
-    fread(buffer, 1, *out_size, file);
-    fclose(file);
-    return buffer;
-}
-
 // Utility: Find memory type
 uint32_t find_memory_type(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
     VkPhysicalDeviceMemoryProperties memProperties;
@@ -84,19 +82,25 @@ int main() {
         .pNext = &meshFeatures
     };
 
-    const char* deviceExtensions[] = { VK_EXT_MESH_SHADER_EXTENSION_NAME };
+    // Per-pipeline compile times and cache hits in the report.
+    const char *feedbackExtension = pipeline_cache_feedback_extension(physicalDevice);
+    const char* deviceExtensions[] = { VK_EXT_MESH_SHADER_EXTENSION_NAME, feedbackExtension };
     VkDeviceCreateInfo deviceCreateInfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .pNext = &dynamicRenderingFeatures,
         .queueCreateInfoCount = 1,
         .pQueueCreateInfos = &queueCreateInfo,
-        .enabledExtensionCount = 1,
+        .enabledExtensionCount = feedbackExtension ? 2 : 1,
         .ppEnabledExtensionNames = deviceExtensions
     };
 
     VkDevice device;
     VK_CHECK(vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL, &device));
 
+    // Pipelines compiled by an earlier run come out of the cache file.
+    PipelineCache pipelineCache;
+    VK_CHECK(pipeline_cache_open(&pipelineCache, physicalDevice, device, "mesh", feedbackExtension != NULL));
+
     VkQueue queue;
     vkGetDeviceQueue(device, 0, 0, &queue);
 
@@ -159,15 +163,9 @@ int main() {
     VK_CHECK(vkBindBufferMemory(device, buffer, bufferMemory, 0));
 
     // 6. Load Shaders
-    size_t meshSize, fragSize;
-    char* meshCode = read_file("mesh.spv", &meshSize);
-    char* fragCode = read_file("frag.spv", &fragSize);
-
-    VkShaderModuleCreateInfo meshShaderInfo = { .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO, .codeSize = meshSize, .pCode = (uint32_t*)meshCode };
-    VkShaderModuleCreateInfo fragShaderInfo = { .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO, .codeSize = fragSize, .pCode = (uint32_t*)fragCode };
     VkShaderModule meshModule, fragModule;
-    VK_CHECK(vkCreateShaderModule(device, &meshShaderInfo, NULL, &meshModule));
-    VK_CHECK(vkCreateShaderModule(device, &fragShaderInfo, NULL, &fragModule));
+    VK_CHECK(shader_code_create_module(device, &meshShader, &meshModule));
+    VK_CHECK(shader_code_create_module(device, &fragShader, &fragModule));
 
     // 7. Uniform Buffer Setup (New)
     VkBufferCreateInfo uboBufferInfo = {
@@ -287,7 +285,8 @@ int main() {
         .layout = pipelineLayout
     };
     VkPipeline pipeline;
-    VK_CHECK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline));
+    VK_CHECK(pipeline_cache_create_graphics(&pipelineCache, "mesh", &pipelineInfo, &pipeline));
+    pipeline_cache_close(&pipelineCache);
 
     // 10. Command Buffer Record and Submit
     VkCommandPoolCreateInfo poolInfo = { .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, .queueFamilyIndex = 0 };
@@ -361,19 +360,9 @@ int main() {
     void* data;
     vkMapMemory(device, bufferMemory, 0, WIDTH * HEIGHT * 4, 0, &data);
 
-    FILE* file = fopen("output.ppm", "wb");
-    if (file) {
-        fprintf(file, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
-        uint8_t* pixels = (uint8_t*)data;
-        for (int y = 0; y < HEIGHT; ++y) {
-            for (int x = 0; x < WIDTH; ++x) {
-                // PPM expects RGB layout, Vulkan buffer is RGBA
-                fwrite(&pixels[(y * WIDTH + x) * 4], 1, 3, file);
-            }
-        }
-        fclose(file);
+    // PPM expects RGB layout, Vulkan buffer is RGBA
+    if (image_writer_write_ppm("output.ppm", data, IMAGE_PIXEL_RGBA8, WIDTH, HEIGHT, 0) == 0)
         printf("Successfully rendered to output.ppm!\n");
-    }
 
     vkUnmapMemory(device, bufferMemory);
 
@@ -395,8 +384,6 @@ int main() {
     vkDestroyCommandPool(device, commandPool, NULL);
     vkDestroyDevice(device, NULL);
     vkDestroyInstance(instance, NULL);
-    free(meshCode);
-    free(fragCode);
 
     return 0;
 }
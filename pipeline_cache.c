@@ -0,0 +1,474 @@
+#include "pipeline_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PIPELINE_CACHE_MAGIC 0x31435050u // "PPC1"
+
+// Stage feedback slots handed to the driver, more than any sample uses.
+#define PIPELINE_CACHE_MAX_STAGES 8
+
+// Written in front of the driver's data. The driver validates its own
+// header too, but only after it has been handed the bytes, this catches a
+// torn write before that.
+typedef struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t driver_version;
+    uint64_t data_size;
+    uint32_t checksum; // FNV-1a of the data
+    uint32_t pad;
+} PipelineCacheFileHeader;
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint32_t
+fnv1a(const uint8_t *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+// Read the whole file at path. Returns NULL with *reason set when it is
+// missing or unreadable.
+static uint8_t *
+read_file(const char *path, size_t *size, const char **reason)
+{
+    struct stat st;
+    uint8_t *data = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        *reason = errno == ENOENT ? "no file yet" : strerror(errno);
+        return NULL;
+    }
+    if (fstat(fd, &st) || !(data = malloc(st.st_size ? st.st_size : 1))) {
+        *reason = strerror(errno);
+        close(fd);
+        return NULL;
+    }
+
+    size_t done = 0;
+    while (done < (size_t)st.st_size) {
+        ssize_t ret = read(fd, data + done, st.st_size - done);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            *reason = ret < 0 ? strerror(errno) : "file shrank while reading";
+            free(data);
+            close(fd);
+            return NULL;
+        }
+        done += ret;
+    }
+    close(fd);
+    *size = done;
+    return data;
+}
+
+// Check both headers. Returns NULL when the data can be handed to the
+// driver, the reason to drop it otherwise.
+static const char *
+validate(const uint8_t *file, size_t size, const VkPhysicalDeviceProperties *properties)
+{
+    PipelineCacheFileHeader header;
+    VkPipelineCacheHeaderVersionOne vk_header;
+
+    if (size < sizeof(header) + sizeof(vk_header))
+        return "too short";
+    memcpy(&header, file, sizeof(header));
+    if (header.magic != PIPELINE_CACHE_MAGIC)
+        return "not a pipeline cache file";
+    if (header.driver_version != properties->driverVersion)
+        return "written by another driver version";
+    if (header.data_size != size - sizeof(header))
+        return "size does not match the header";
+    if (header.checksum != fnv1a(file + sizeof(header), header.data_size))
+        return "checksum mismatch";
+
+    memcpy(&vk_header, file + sizeof(header), sizeof(vk_header));
+    if (vk_header.headerSize < sizeof(vk_header) || vk_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+        return "unknown driver header";
+    if (vk_header.vendorID != properties->vendorID || vk_header.deviceID != properties->deviceID ||
+        memcmp(vk_header.pipelineCacheUUID, properties->pipelineCacheUUID, VK_UUID_SIZE))
+        return "written for another device";
+    return NULL;
+}
+
+const char *
+pipeline_cache_feedback_extension(VkPhysicalDevice physical_device)
+{
+    uint32_t count = 0;
+    const char *found = NULL;
+
+    vkEnumerateDeviceExtensionProperties(physical_device, NULL, &count, NULL);
+    VkExtensionProperties *extensions = malloc(sizeof(VkExtensionProperties) * (count ? count : 1));
+    if (!extensions)
+        return NULL;
+    vkEnumerateDeviceExtensionProperties(physical_device, NULL, &count, extensions);
+    for (uint32_t i = 0; i < count; i++)
+        if (!strcmp(extensions[i].extensionName, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME))
+            found = VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME;
+    free(extensions);
+    return found;
+}
+
+VkResult
+pipeline_cache_open(PipelineCache *cache, VkPhysicalDevice physical_device, VkDevice device,
+                    const char *name, int feedback)
+{
+    VkPhysicalDeviceProperties properties;
+    const char *enabled = getenv("PIPELINE_CACHE");
+    const char *dir = getenv("PIPELINE_CACHE_DIR");
+    uint8_t *file = NULL;
+    size_t size = 0;
+
+    memset(cache, 0, sizeof(*cache));
+    cache->device = device;
+    cache->feedback = feedback;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->cond, NULL);
+
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    cache->driver_version = properties.driverVersion;
+
+    if (!enabled || strcmp(enabled, "0")) {
+        char uuid[2 * VK_UUID_SIZE + 1];
+        for (int i = 0; i < VK_UUID_SIZE; i++)
+            sprintf(uuid + 2 * i, "%02x", properties.pipelineCacheUUID[i]);
+        snprintf(cache->path, sizeof(cache->path), "%s/%s.%s.%08x.pipeline_cache",
+                 dir && *dir ? dir : ".", name, uuid, properties.driverVersion);
+
+        const char *reason = NULL;
+        file = read_file(cache->path, &size, &reason);
+        if (file && (reason = validate(file, size, &properties))) {
+            free(file);
+            file = NULL;
+        }
+        if (file)
+            cache->warm = 1;
+        else
+            printf("Pipeline cache %s: %s, starting cold\n", cache->path, reason);
+    }
+
+    VkPipelineCacheCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    if (file) {
+        info.initialDataSize = size - sizeof(PipelineCacheFileHeader);
+        info.pInitialData = file + sizeof(PipelineCacheFileHeader);
+    }
+
+    VkResult result = vkCreatePipelineCache(device, &info, NULL, &cache->cache);
+    free(file);
+    return result;
+}
+
+// Account for one pipeline and print what the driver said about it. Called
+// from the workers too, hence the lock.
+static void
+report(PipelineCache *cache, const char *name, const VkPipelineCreationFeedback *pipeline,
+       const VkPipelineCreationFeedback *stages, uint32_t stage_count, double ms)
+{
+    int valid = cache->feedback && (pipeline->flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT);
+    int hit = valid && (pipeline->flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT);
+
+    pthread_mutex_lock(&cache->lock);
+    cache->pipelines++;
+    cache->hits += hit;
+    cache->create_ms += ms;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (!valid) {
+        printf("pipeline %s: %.3f ms\n", name, ms);
+        return;
+    }
+
+    uint32_t stage_hits = 0;
+    for (uint32_t i = 0; i < stage_count; i++)
+        if (stages[i].flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT)
+            stage_hits++;
+
+    printf("pipeline %s: %.3f ms (driver %.3f ms), %s, %u/%u stages cached\n", name, ms,
+           pipeline->duration / 1e6, hit ? "cache hit" : "compiled", stage_hits, stage_count);
+}
+
+VkResult
+pipeline_cache_create_graphics(PipelineCache *cache, const char *name,
+                               const VkGraphicsPipelineCreateInfo *info, VkPipeline *pipeline)
+{
+    VkGraphicsPipelineCreateInfo chained = *info;
+    VkPipelineCreationFeedback pipeline_feedback = {};
+    VkPipelineCreationFeedback stage_feedback[PIPELINE_CACHE_MAX_STAGES] = {};
+    VkPipelineCreationFeedbackCreateInfo feedback = {};
+    uint32_t stage_count = info->stageCount <= PIPELINE_CACHE_MAX_STAGES ? info->stageCount : 0;
+
+    // The feedback goes in front of whatever the caller chained.
+    if (cache->feedback) {
+        feedback.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+        feedback.pNext = info->pNext;
+        feedback.pPipelineCreationFeedback = &pipeline_feedback;
+        feedback.pipelineStageCreationFeedbackCount = stage_count;
+        feedback.pPipelineStageCreationFeedbacks = stage_feedback;
+        chained.pNext = &feedback;
+    }
+
+    double start = now_ms();
+    VkResult result = vkCreateGraphicsPipelines(cache->device, cache->cache, 1, &chained, NULL, pipeline);
+    if (result == VK_SUCCESS)
+        report(cache, name, &pipeline_feedback, stage_feedback, stage_count, now_ms() - start);
+    return result;
+}
+
+VkResult
+pipeline_cache_create_compute(PipelineCache *cache, const char *name,
+                              const VkComputePipelineCreateInfo *info, VkPipeline *pipeline)
+{
+    VkComputePipelineCreateInfo chained = *info;
+    VkPipelineCreationFeedback pipeline_feedback = {};
+    VkPipelineCreationFeedback stage_feedback = {};
+    VkPipelineCreationFeedbackCreateInfo feedback = {};
+
+    if (cache->feedback) {
+        feedback.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+        feedback.pNext = info->pNext;
+        feedback.pPipelineCreationFeedback = &pipeline_feedback;
+        feedback.pipelineStageCreationFeedbackCount = 1;
+        feedback.pPipelineStageCreationFeedbacks = &stage_feedback;
+        chained.pNext = &feedback;
+    }
+
+    double start = now_ms();
+    VkResult result = vkCreateComputePipelines(cache->device, cache->cache, 1, &chained, NULL, pipeline);
+    if (result == VK_SUCCESS)
+        report(cache, name, &pipeline_feedback, &stage_feedback, 1, now_ms() - start);
+    return result;
+}
+
+static void
+run_job(PipelineCache *cache, PipelineJob *job)
+{
+    if (job->is_compute)
+        job->result = pipeline_cache_create_compute(cache, job->name, &job->info.compute, &job->pipeline);
+    else
+        job->result = pipeline_cache_create_graphics(cache, job->name, &job->info.graphics, &job->pipeline);
+
+    pthread_mutex_lock(&cache->lock);
+    job->done = 1;
+    job->done_ms = cache->last_done_ms = now_ms();
+    pthread_cond_broadcast(&cache->cond);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Take jobs until the pool is stopped and the queue is empty.
+static void *
+worker(void *arg)
+{
+    PipelineCache *cache = arg;
+
+    pthread_mutex_lock(&cache->lock);
+    for (;;) {
+        while (!cache->queue && !cache->stopping)
+            pthread_cond_wait(&cache->cond, &cache->lock);
+        PipelineJob *job = cache->queue;
+        if (!job)
+            break;
+        cache->queue = job->next;
+        pthread_mutex_unlock(&cache->lock);
+
+        run_job(cache, job);
+
+        pthread_mutex_lock(&cache->lock);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+
+static void
+start_workers(PipelineCache *cache)
+{
+    const char *env = getenv("PIPELINE_THREADS");
+    long count = env && *env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (count < 1)
+        count = 1;
+    if (count > 64)
+        count = 64;
+    cache->workers = malloc(sizeof(pthread_t) * count);
+    if (!cache->workers)
+        return;
+    while (cache->worker_count < count &&
+           !pthread_create(&cache->workers[cache->worker_count], NULL, worker, cache))
+        cache->worker_count++;
+}
+
+static void
+queue_job(PipelineCache *cache, PipelineJob *job)
+{
+    pthread_mutex_lock(&cache->lock);
+    if (!cache->workers)
+        start_workers(cache);
+    if (!cache->first_queued_ms)
+        cache->first_queued_ms = now_ms();
+
+    // Without a worker the caller does the work, still correct, just serial.
+    if (!cache->worker_count) {
+        pthread_mutex_unlock(&cache->lock);
+        run_job(cache, job);
+        return;
+    }
+
+    if (cache->queue)
+        cache->queue_tail->next = job;
+    else
+        cache->queue = job;
+    cache->queue_tail = job;
+    pthread_cond_broadcast(&cache->cond);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void
+pipeline_cache_queue_graphics(PipelineCache *cache, PipelineJob *job, const char *name,
+                              const VkGraphicsPipelineCreateInfo *info)
+{
+    memset(job, 0, sizeof(*job));
+    job->name = name;
+    job->info.graphics = *info;
+    queue_job(cache, job);
+}
+
+void
+pipeline_cache_queue_compute(PipelineCache *cache, PipelineJob *job, const char *name,
+                             const VkComputePipelineCreateInfo *info)
+{
+    memset(job, 0, sizeof(*job));
+    job->name = name;
+    job->is_compute = 1;
+    job->info.compute = *info;
+    queue_job(cache, job);
+}
+
+VkResult
+pipeline_cache_wait(PipelineCache *cache, PipelineJob *job)
+{
+    pthread_mutex_lock(&cache->lock);
+    while (!job->done)
+        pthread_cond_wait(&cache->cond, &cache->lock);
+    pthread_mutex_unlock(&cache->lock);
+    return job->result;
+}
+
+int
+pipeline_cache_done(PipelineCache *cache, PipelineJob *job)
+{
+    pthread_mutex_lock(&cache->lock);
+    int done = job->done;
+    pthread_mutex_unlock(&cache->lock);
+    return done;
+}
+
+// Write header and data to a temporary file and rename it over path, so a
+// concurrent run or a crash never leaves a half-written cache behind.
+static int
+save(PipelineCache *cache)
+{
+    size_t size = 0;
+    char tmp[PATH_MAX + 8];
+    int fd, ret = 0;
+
+    if (vkGetPipelineCacheData(cache->device, cache->cache, &size, NULL) != VK_SUCCESS)
+        return -1;
+    uint8_t *file = malloc(sizeof(PipelineCacheFileHeader) + size);
+    if (!file)
+        return -1;
+    if (vkGetPipelineCacheData(cache->device, cache->cache, &size, file + sizeof(PipelineCacheFileHeader)) != VK_SUCCESS) {
+        free(file);
+        return -1;
+    }
+
+    PipelineCacheFileHeader header = {};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.driver_version = cache->driver_version;
+    header.data_size = size;
+    header.checksum = fnv1a(file + sizeof(header), size);
+    memcpy(file, &header, sizeof(header));
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", cache->path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s for writing: %s\n", tmp, strerror(errno));
+        free(file);
+        return -1;
+    }
+
+    size_t total = sizeof(header) + size, done = 0;
+    while (done < total) {
+        ssize_t written = write(fd, file + done, total - done);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0) {
+            fprintf(stderr, "Failed to write %s: %s\n", tmp, strerror(errno));
+            ret = -1;
+            break;
+        }
+        done += written;
+    }
+    if (close(fd) && !ret) {
+        fprintf(stderr, "Failed to close %s: %s\n", tmp, strerror(errno));
+        ret = -1;
+    }
+    if (!ret && rename(tmp, cache->path)) {
+        fprintf(stderr, "Failed to rename %s: %s\n", tmp, strerror(errno));
+        ret = -1;
+    }
+    if (ret)
+        unlink(tmp);
+    free(file);
+    return ret;
+}
+
+void
+pipeline_cache_close(PipelineCache *cache)
+{
+    if (cache->workers) {
+        pthread_mutex_lock(&cache->lock);
+        cache->stopping = 1;
+        pthread_cond_broadcast(&cache->cond);
+        pthread_mutex_unlock(&cache->lock);
+        for (unsigned i = 0; i < cache->worker_count; i++)
+            pthread_join(cache->workers[i], NULL);
+        free(cache->workers);
+        cache->workers = NULL;
+    }
+
+    printf("pipeline cache: %s start, %u pipelines in %.3f ms", cache->warm ? "warm" : "cold",
+           cache->pipelines, cache->create_ms);
+    if (cache->feedback)
+        printf(", %u cache hits", cache->hits);
+    if (cache->worker_count)
+        printf(", %.3f ms wall clock on %u thread%s", cache->last_done_ms - cache->first_queued_ms,
+               cache->worker_count, cache->worker_count > 1 ? "s" : "");
+    printf("\n");
+
+    // Nothing new when every pipeline was a hit.
+    if (cache->path[0] && (!cache->warm || !cache->feedback || cache->hits < cache->pipelines))
+        save(cache);
+
+    vkDestroyPipelineCache(cache->device, cache->cache, NULL);
+    cache->cache = VK_NULL_HANDLE;
+    pthread_cond_destroy(&cache->cond);
+    pthread_mutex_destroy(&cache->lock);
+}
@@ -0,0 +1,99 @@
+#ifndef PIPELINE_CACHE_H
+#define PIPELINE_CACHE_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// A VkPipelineCache backed by a file, so pipelines compiled by one run are
+// found by the next one instead of going through the compiler again.
+//
+// The file lives in $PIPELINE_CACHE_DIR (default: the working directory) and
+// is named after the sample, the driver's pipelineCacheUUID and its
+// driverVersion, so a driver update starts a new file instead of feeding the
+// old data to the new driver. PIPELINE_CACHE=0 disables loading and saving,
+// which gives a cold start every time.
+//
+// When the device has VK_EXT_pipeline_creation_feedback enabled every
+// pipeline created through pipeline_cache_create_*() reports its creation
+// time and whether it came out of the cache.
+//
+// pipeline_cache_queue_*() hands pipelines to a pool of worker threads that
+// all create through the one VkPipelineCache, which the driver keeps thread
+// safe. The pool has $PIPELINE_THREADS workers, one per online CPU when
+// unset, started with the first job.
+typedef struct PipelineJob {
+    const char *name;
+    int is_compute;
+    union {
+        VkGraphicsPipelineCreateInfo graphics;
+        VkComputePipelineCreateInfo compute;
+    } info;
+    VkPipeline pipeline;
+    VkResult result;
+    int done;
+    double done_ms; // CLOCK_MONOTONIC, when the pipeline was ready
+    struct PipelineJob *next;
+} PipelineJob;
+
+typedef struct PipelineCache {
+    VkDevice device;
+    VkPipelineCache cache;
+    int feedback;        // VK_EXT_pipeline_creation_feedback is enabled
+    int warm;            // a valid file was loaded
+    uint32_t driver_version;
+    char path[PATH_MAX]; // empty when disabled
+    uint32_t pipelines;  // created through the cache
+    uint32_t hits;       // of which the driver found in the cache
+    double create_ms;    // wall time spent creating them, summed over threads
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // a job was queued or finished, or the pool stops
+    PipelineJob *queue;
+    PipelineJob *queue_tail;
+    pthread_t *workers;
+    unsigned worker_count;
+    int stopping;
+    double first_queued_ms;
+    double last_done_ms;
+} PipelineCache;
+
+// VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME when physical_device
+// supports it, NULL otherwise. Add it to the device extensions and pass
+// feedback = 1 to pipeline_cache_open() to get the per-pipeline report.
+const char *pipeline_cache_feedback_extension(VkPhysicalDevice physical_device);
+
+// Create the cache for the sample called name and seed it from its file.
+// A missing, truncated or foreign file is not an error, the cache starts
+// empty (a cold start) and a message says why.
+VkResult pipeline_cache_open(PipelineCache *cache, VkPhysicalDevice physical_device, VkDevice device,
+                             const char *name, int feedback);
+
+// vkCreate*Pipelines() for a single pipeline through the cache. name only
+// labels the report line.
+VkResult pipeline_cache_create_graphics(PipelineCache *cache, const char *name,
+                                        const VkGraphicsPipelineCreateInfo *info, VkPipeline *pipeline);
+VkResult pipeline_cache_create_compute(PipelineCache *cache, const char *name,
+                                       const VkComputePipelineCreateInfo *info, VkPipeline *pipeline);
+
+// Queue a pipeline for the worker pool and return right away. The create
+// info is copied, what it points to (stages, state structs, the shader
+// modules) has to stay alive until the job is done.
+void pipeline_cache_queue_graphics(PipelineCache *cache, PipelineJob *job, const char *name,
+                                   const VkGraphicsPipelineCreateInfo *info);
+void pipeline_cache_queue_compute(PipelineCache *cache, PipelineJob *job, const char *name,
+                                  const VkComputePipelineCreateInfo *info);
+
+// Block until job is done and return its result. Cheap once it is.
+VkResult pipeline_cache_wait(PipelineCache *cache, PipelineJob *job);
+
+// Whether job is done, without blocking.
+int pipeline_cache_done(PipelineCache *cache, PipelineJob *job);
+
+// Wait for the queued jobs and stop the workers, print the cold/warm summary,
+// write the file back if anything was compiled and destroy the
+// VkPipelineCache.
+void pipeline_cache_close(PipelineCache *cache);
+
+#endif
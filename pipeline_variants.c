@@ -0,0 +1,625 @@
+#include "pipeline_variants.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const VkCullModeFlags cull_modes[PIPELINE_VARIANT_CULL_MODES] = {
+    VK_CULL_MODE_NONE, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_FRONT_BIT,
+};
+static const char *const cull_names[PIPELINE_VARIANT_CULL_MODES] = { "none", "back", "front" };
+
+static const VkPrimitiveTopology topologies[PIPELINE_VARIANT_TOPOLOGIES] = {
+    VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+};
+static const char *const topology_names[PIPELINE_VARIANT_TOPOLOGIES] = { "list", "strip" };
+
+static const char *const blend_names[PIPELINE_VARIANT_BLENDS] = { "opaque", "alpha", "additive" };
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Index = (cull * TOPOLOGIES + topology) * BLENDS + blend.
+static void
+split_index(uint32_t index, uint32_t *cull, uint32_t *topology, uint32_t *blend)
+{
+    *blend = index % PIPELINE_VARIANT_BLENDS;
+    *topology = index / PIPELINE_VARIANT_BLENDS % PIPELINE_VARIANT_TOPOLOGIES;
+    *cull = index / (PIPELINE_VARIANT_BLENDS * PIPELINE_VARIANT_TOPOLOGIES);
+}
+
+// The color attachment of base with blending blend. The write mask stays.
+static VkPipelineColorBlendAttachmentState
+blend_attachment(const PipelineVariants *variants, uint32_t blend)
+{
+    VkPipelineColorBlendAttachmentState attachment = variants->base.pColorBlendState->pAttachments[0];
+
+    attachment.blendEnable = blend ? VK_TRUE : VK_FALSE;
+    attachment.colorBlendOp = VK_BLEND_OP_ADD;
+    attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+    attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    switch (blend) {
+    case 1: // alpha
+        attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        break;
+    case 2: // additive
+        attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        break;
+    default: // opaque, what the equation would be without blending
+        attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+        attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        break;
+    }
+    return attachment;
+}
+
+static const VkPipelineShaderStageCreateInfo *
+find_stage(const VkGraphicsPipelineCreateInfo *info, VkShaderStageFlagBits stage)
+{
+    for (uint32_t i = 0; i < info->stageCount; i++)
+        if (info->pStages[i].stage == stage)
+            return &info->pStages[i];
+    return NULL;
+}
+
+static int
+has_extension(const VkExtensionProperties *extensions, uint32_t count, const char *name)
+{
+    for (uint32_t i = 0; i < count; i++)
+        if (!strcmp(extensions[i].extensionName, name))
+            return 1;
+    return 0;
+}
+
+int
+pipeline_variants_enable(VkPhysicalDevice physical_device, int wanted, PipelineVariantFeatures *features,
+                         const char **extensions, uint32_t *extension_count, const void **chain)
+{
+    uint32_t count = 0;
+    int backend = wanted;
+
+    memset(features, 0, sizeof(*features));
+    features->library.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+    features->shader_object.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT;
+    features->dynamic_rendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+
+    vkEnumerateDeviceExtensionProperties(physical_device, NULL, &count, NULL);
+    VkExtensionProperties *available = malloc(sizeof(VkExtensionProperties) * (count ? count : 1));
+    if (!available)
+        count = 0;
+    else
+        vkEnumerateDeviceExtensionProperties(physical_device, NULL, &count, available);
+
+    int has_library = has_extension(available, count, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+                      has_extension(available, count, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+    int has_shader_object = has_extension(available, count, VK_EXT_SHADER_OBJECT_EXTENSION_NAME) &&
+                            has_extension(available, count, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+    free(available);
+
+    // Only ask about the features of extensions that are there.
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    if (has_library) {
+        features->library.pNext = features2.pNext;
+        features2.pNext = &features->library;
+    }
+    if (has_shader_object) {
+        features->shader_object.pNext = &features->dynamic_rendering;
+        features->dynamic_rendering.pNext = features2.pNext;
+        features2.pNext = &features->shader_object;
+    }
+    vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+    has_library = has_library && features->library.graphicsPipelineLibrary;
+    has_shader_object = has_shader_object && features->shader_object.shaderObject &&
+                        features->dynamic_rendering.dynamicRendering;
+
+    if (backend == PIPELINE_VARIANTS_SHADER_OBJECT && !has_shader_object) {
+        printf("%s not supported, falling back to %s.\n", VK_EXT_SHADER_OBJECT_EXTENSION_NAME,
+               pipeline_variants_backend_name(PIPELINE_VARIANTS_LIBRARY));
+        backend = PIPELINE_VARIANTS_LIBRARY;
+    }
+    if (backend == PIPELINE_VARIANTS_LIBRARY && !has_library) {
+        printf("%s not supported, falling back to %s.\n", VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME,
+               pipeline_variants_backend_name(PIPELINE_VARIANTS_MONOLITHIC));
+        backend = PIPELINE_VARIANTS_MONOLITHIC;
+    }
+
+    // Enable just what the backend needs, in front of the caller's chain.
+    memset(features, 0, sizeof(*features));
+    if (backend == PIPELINE_VARIANTS_LIBRARY) {
+        features->library.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+        features->library.graphicsPipelineLibrary = VK_TRUE;
+        features->library.pNext = (void *)*chain;
+        *chain = &features->library;
+        extensions[(*extension_count)++] = VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME;
+        extensions[(*extension_count)++] = VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME;
+    } else if (backend == PIPELINE_VARIANTS_SHADER_OBJECT) {
+        features->shader_object.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT;
+        features->shader_object.shaderObject = VK_TRUE;
+        features->dynamic_rendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+        features->dynamic_rendering.dynamicRendering = VK_TRUE;
+        features->shader_object.pNext = &features->dynamic_rendering;
+        features->dynamic_rendering.pNext = (void *)*chain;
+        *chain = &features->shader_object;
+        extensions[(*extension_count)++] = VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME;
+        extensions[(*extension_count)++] = VK_EXT_SHADER_OBJECT_EXTENSION_NAME;
+    }
+    return backend;
+}
+
+const char *
+pipeline_variants_backend_name(int backend)
+{
+    switch (backend) {
+    case PIPELINE_VARIANTS_LIBRARY:
+        return "graphics pipeline libraries";
+    case PIPELINE_VARIANTS_SHADER_OBJECT:
+        return "shader objects";
+    default:
+        return "monolithic pipelines";
+    }
+}
+
+// One part of the pipeline as a library. info holds only the state of that
+// part.
+static VkResult
+create_library(PipelineVariants *variants, const char *name, VkGraphicsPipelineLibraryFlagsEXT part,
+               VkGraphicsPipelineCreateInfo *info, VkPipeline *library)
+{
+    VkGraphicsPipelineLibraryCreateInfoEXT library_info = {};
+    library_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+    library_info.flags = part;
+
+    info->sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    info->pNext = &library_info;
+    // The optimized link needs what the driver would otherwise drop.
+    info->flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR |
+                  (variants->optimize ? VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT : 0);
+    return pipeline_cache_create_graphics(variants->cache, name, info, library);
+}
+
+static VkResult
+create_libraries(PipelineVariants *variants)
+{
+    const VkGraphicsPipelineCreateInfo *base = &variants->base;
+    char name[64];
+    VkResult result;
+
+    for (uint32_t i = 0; i < PIPELINE_VARIANT_TOPOLOGIES; i++) {
+        VkPipelineInputAssemblyStateCreateInfo input_assembly = *base->pInputAssemblyState;
+        input_assembly.topology = topologies[i];
+
+        VkGraphicsPipelineCreateInfo info = {};
+        info.pVertexInputState = base->pVertexInputState;
+        info.pInputAssemblyState = &input_assembly;
+        snprintf(name, sizeof(name), "library-vertex-input-%s", topology_names[i]);
+        result = create_library(variants, name, VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+                                &info, &variants->vertex_input[i]);
+        if (result != VK_SUCCESS)
+            return result;
+    }
+
+    for (uint32_t i = 0; i < PIPELINE_VARIANT_CULL_MODES; i++) {
+        VkPipelineRasterizationStateCreateInfo rasterization = *base->pRasterizationState;
+        rasterization.cullMode = cull_modes[i];
+
+        VkGraphicsPipelineCreateInfo info = {};
+        info.stageCount = 1;
+        info.pStages = find_stage(base, VK_SHADER_STAGE_VERTEX_BIT);
+        info.pViewportState = base->pViewportState;
+        info.pRasterizationState = &rasterization;
+        info.layout = base->layout;
+        info.renderPass = base->renderPass;
+        info.subpass = base->subpass;
+        snprintf(name, sizeof(name), "library-pre-rasterization-cull-%s", cull_names[i]);
+        result = create_library(variants, name, VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+                                &info, &variants->pre_rasterization[i]);
+        if (result != VK_SUCCESS)
+            return result;
+    }
+
+    VkGraphicsPipelineCreateInfo info = {};
+    info.stageCount = 1;
+    info.pStages = find_stage(base, VK_SHADER_STAGE_FRAGMENT_BIT);
+    info.pMultisampleState = base->pMultisampleState;
+    info.pDepthStencilState = base->pDepthStencilState;
+    info.layout = base->layout;
+    info.renderPass = base->renderPass;
+    info.subpass = base->subpass;
+    result = create_library(variants, "library-fragment-shader", VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+                            &info, &variants->fragment_shader);
+    if (result != VK_SUCCESS)
+        return result;
+
+    for (uint32_t i = 0; i < PIPELINE_VARIANT_BLENDS; i++) {
+        VkPipelineColorBlendAttachmentState attachment = blend_attachment(variants, i);
+        VkPipelineColorBlendStateCreateInfo color_blend = *base->pColorBlendState;
+        color_blend.attachmentCount = 1;
+        color_blend.pAttachments = &attachment;
+
+        memset(&info, 0, sizeof(info));
+        info.pColorBlendState = &color_blend;
+        info.pMultisampleState = base->pMultisampleState;
+        info.renderPass = base->renderPass;
+        info.subpass = base->subpass;
+        snprintf(name, sizeof(name), "library-fragment-output-%s", blend_names[i]);
+        result = create_library(variants, name, VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+                                &info, &variants->fragment_output[i]);
+        if (result != VK_SUCCESS)
+            return result;
+    }
+    return VK_SUCCESS;
+}
+
+#define LOAD(field, name) (variants->field = (void *)vkGetDeviceProcAddr(variants->device, name))
+
+static VkResult
+create_shader_objects(PipelineVariants *variants, const VkPipelineLayoutCreateInfo *layout_info,
+                      const ShaderCode *vertex, const ShaderCode *fragment)
+{
+    const VkGraphicsPipelineCreateInfo *base = &variants->base;
+    const VkPipelineVertexInputStateCreateInfo *vertex_input = base->pVertexInputState;
+
+    LOAD(create_shaders, "vkCreateShadersEXT");
+    LOAD(destroy_shader, "vkDestroyShaderEXT");
+    LOAD(bind_shaders, "vkCmdBindShadersEXT");
+    LOAD(begin_rendering, "vkCmdBeginRenderingKHR");
+    LOAD(end_rendering, "vkCmdEndRenderingKHR");
+    LOAD(set_viewport, "vkCmdSetViewportWithCountEXT");
+    LOAD(set_scissor, "vkCmdSetScissorWithCountEXT");
+    LOAD(set_cull_mode, "vkCmdSetCullModeEXT");
+    LOAD(set_front_face, "vkCmdSetFrontFaceEXT");
+    LOAD(set_topology, "vkCmdSetPrimitiveTopologyEXT");
+    LOAD(set_primitive_restart, "vkCmdSetPrimitiveRestartEnableEXT");
+    LOAD(set_rasterizer_discard, "vkCmdSetRasterizerDiscardEnableEXT");
+    LOAD(set_polygon_mode, "vkCmdSetPolygonModeEXT");
+    LOAD(set_samples, "vkCmdSetRasterizationSamplesEXT");
+    LOAD(set_sample_mask, "vkCmdSetSampleMaskEXT");
+    LOAD(set_alpha_to_coverage, "vkCmdSetAlphaToCoverageEnableEXT");
+    LOAD(set_depth_test, "vkCmdSetDepthTestEnableEXT");
+    LOAD(set_depth_write, "vkCmdSetDepthWriteEnableEXT");
+    LOAD(set_depth_bias, "vkCmdSetDepthBiasEnableEXT");
+    LOAD(set_stencil_test, "vkCmdSetStencilTestEnableEXT");
+    LOAD(set_depth_bounds_test, "vkCmdSetDepthBoundsTestEnableEXT");
+    LOAD(set_blend_enable, "vkCmdSetColorBlendEnableEXT");
+    LOAD(set_blend_equation, "vkCmdSetColorBlendEquationEXT");
+    LOAD(set_write_mask, "vkCmdSetColorWriteMaskEXT");
+    if (!LOAD(set_vertex_input, "vkCmdSetVertexInputEXT") || !variants->create_shaders || !variants->begin_rendering)
+        return VK_ERROR_EXTENSION_NOT_PRESENT;
+
+    // The vertex input is set per draw, translated once here.
+    if (vertex_input->vertexBindingDescriptionCount > PIPELINE_VARIANT_MAX_VERTEX_INPUTS ||
+        vertex_input->vertexAttributeDescriptionCount > PIPELINE_VARIANT_MAX_VERTEX_INPUTS)
+        return VK_ERROR_INITIALIZATION_FAILED;
+    variants->vertex_binding_count = vertex_input->vertexBindingDescriptionCount;
+    for (uint32_t i = 0; i < variants->vertex_binding_count; i++) {
+        VkVertexInputBindingDescription2EXT *binding = &variants->vertex_bindings[i];
+        binding->sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT;
+        binding->binding = vertex_input->pVertexBindingDescriptions[i].binding;
+        binding->stride = vertex_input->pVertexBindingDescriptions[i].stride;
+        binding->inputRate = vertex_input->pVertexBindingDescriptions[i].inputRate;
+        binding->divisor = 1;
+    }
+    variants->vertex_attribute_count = vertex_input->vertexAttributeDescriptionCount;
+    for (uint32_t i = 0; i < variants->vertex_attribute_count; i++) {
+        VkVertexInputAttributeDescription2EXT *attribute = &variants->vertex_attributes[i];
+        attribute->sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT;
+        attribute->location = vertex_input->pVertexAttributeDescriptions[i].location;
+        attribute->binding = vertex_input->pVertexAttributeDescriptions[i].binding;
+        attribute->format = vertex_input->pVertexAttributeDescriptions[i].format;
+        attribute->offset = vertex_input->pVertexAttributeDescriptions[i].offset;
+    }
+
+    // Linked, so the driver may still optimize across the two stages.
+    const VkPipelineShaderStageCreateInfo *stages[2] = {
+        find_stage(base, VK_SHADER_STAGE_VERTEX_BIT), find_stage(base, VK_SHADER_STAGE_FRAGMENT_BIT),
+    };
+    const ShaderCode *code[2] = { vertex, fragment };
+    VkShaderCreateInfoEXT infos[2] = {};
+    for (uint32_t i = 0; i < 2; i++) {
+        infos[i].sType = VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT;
+        infos[i].flags = VK_SHADER_CREATE_LINK_STAGE_BIT_EXT;
+        infos[i].stage = i ? VK_SHADER_STAGE_FRAGMENT_BIT : VK_SHADER_STAGE_VERTEX_BIT;
+        infos[i].nextStage = i ? 0 : VK_SHADER_STAGE_FRAGMENT_BIT;
+        infos[i].codeType = VK_SHADER_CODE_TYPE_SPIRV_EXT;
+        infos[i].codeSize = code[i]->size;
+        infos[i].pCode = code[i]->code;
+        infos[i].pName = stages[i] ? stages[i]->pName : "main";
+        infos[i].pSpecializationInfo = stages[i] ? stages[i]->pSpecializationInfo : NULL;
+        infos[i].setLayoutCount = layout_info->setLayoutCount;
+        infos[i].pSetLayouts = layout_info->pSetLayouts;
+        infos[i].pushConstantRangeCount = layout_info->pushConstantRangeCount;
+        infos[i].pPushConstantRanges = layout_info->pPushConstantRanges;
+    }
+    return variants->create_shaders(variants->device, 2, infos, NULL, variants->shaders);
+}
+
+VkResult
+pipeline_variants_open(PipelineVariants *variants, int backend, PipelineCache *cache,
+                       const VkGraphicsPipelineCreateInfo *base, const VkPipelineLayoutCreateInfo *layout_info,
+                       const ShaderCode *vertex, const ShaderCode *fragment)
+{
+    const char *optimize = getenv("PIPELINE_VARIANTS_OPTIMIZE");
+    VkResult result = VK_SUCCESS;
+
+    memset(variants, 0, sizeof(*variants));
+    variants->backend = backend;
+    variants->device = cache->device;
+    variants->cache = cache;
+    variants->base = *base;
+    variants->optimize = !optimize || strcmp(optimize, "0");
+
+    for (uint32_t i = 0; i < PIPELINE_VARIANT_COUNT; i++) {
+        uint32_t cull, topology, blend;
+        split_index(i, &cull, &topology, &blend);
+        snprintf(variants->variants[i].name, sizeof(variants->variants[i].name), "variant-cull-%s-%s-%s",
+                 cull_names[cull], topology_names[topology], blend_names[blend]);
+    }
+
+    double start = now_ms();
+    if (backend == PIPELINE_VARIANTS_LIBRARY)
+        result = create_libraries(variants);
+    else if (backend == PIPELINE_VARIANTS_SHADER_OBJECT)
+        result = create_shader_objects(variants, layout_info, vertex, fragment);
+    variants->parts_ms = now_ms() - start;
+    return result;
+}
+
+void
+pipeline_variants_begin_rendering(PipelineVariants *variants, VkCommandBuffer command_buffer,
+                                  const VkRenderPassBeginInfo *begin, VkImage image, VkImageView view)
+{
+    if (variants->backend != PIPELINE_VARIANTS_SHADER_OBJECT) {
+        vkCmdBeginRenderPass(command_buffer, begin, VK_SUBPASS_CONTENTS_INLINE);
+        return;
+    }
+
+    // What the render pass's initial layout and external dependency did.
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+    VkRenderingAttachmentInfo color = {};
+    color.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    color.imageView = view;
+    color.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    color.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    color.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    color.clearValue = begin->pClearValues[0];
+
+    VkRenderingInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    info.renderArea = begin->renderArea;
+    info.layerCount = 1;
+    info.colorAttachmentCount = 1;
+    info.pColorAttachments = &color;
+    variants->begin_rendering(command_buffer, &info);
+}
+
+void
+pipeline_variants_end_rendering(PipelineVariants *variants, VkCommandBuffer command_buffer, VkImage image)
+{
+    if (variants->backend != PIPELINE_VARIANTS_SHADER_OBJECT) {
+        vkCmdEndRenderPass(command_buffer);
+        return;
+    }
+    variants->end_rendering(command_buffer);
+
+    // The render pass's final layout. The caller's barrier after the pass
+    // still orders the reads.
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+static VkResult
+create_monolithic(PipelineVariants *variants, PipelineVariant *variant, uint32_t cull, uint32_t topology,
+                  uint32_t blend)
+{
+    const VkGraphicsPipelineCreateInfo *base = &variants->base;
+    VkGraphicsPipelineCreateInfo info = *base;
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = *base->pInputAssemblyState;
+    input_assembly.topology = topologies[topology];
+    VkPipelineRasterizationStateCreateInfo rasterization = *base->pRasterizationState;
+    rasterization.cullMode = cull_modes[cull];
+    VkPipelineColorBlendAttachmentState attachment = blend_attachment(variants, blend);
+    VkPipelineColorBlendStateCreateInfo color_blend = *base->pColorBlendState;
+    color_blend.attachmentCount = 1;
+    color_blend.pAttachments = &attachment;
+
+    info.pInputAssemblyState = &input_assembly;
+    info.pRasterizationState = &rasterization;
+    info.pColorBlendState = &color_blend;
+    return pipeline_cache_create_graphics(variants->cache, variant->name, &info, &variant->pipeline);
+}
+
+// Fast-link the variant's four libraries, then queue the optimized link.
+static VkResult
+link_libraries(PipelineVariants *variants, PipelineVariant *variant, uint32_t cull, uint32_t topology,
+               uint32_t blend)
+{
+    variant->libraries[0] = variants->vertex_input[topology];
+    variant->libraries[1] = variants->pre_rasterization[cull];
+    variant->libraries[2] = variants->fragment_shader;
+    variant->libraries[3] = variants->fragment_output[blend];
+    variant->link.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+    variant->link.libraryCount = 4;
+    variant->link.pLibraries = variant->libraries;
+
+    VkGraphicsPipelineCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    info.pNext = &variant->link;
+    info.layout = variants->base.layout;
+
+    VkResult result = pipeline_cache_create_graphics(variants->cache, variant->name, &info, &variant->pipeline);
+    if (result != VK_SUCCESS || !variants->optimize)
+        return result;
+
+    // variant->link stays where it is until close, the job can point at it.
+    info.flags = VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT;
+    pipeline_cache_queue_graphics(variants->cache, &variant->optimized, variant->name, &info);
+    variant->optimizing = 1;
+    return VK_SUCCESS;
+}
+
+static void
+bind_shader_objects(PipelineVariants *variants, VkCommandBuffer command_buffer, uint32_t cull, uint32_t topology,
+                    uint32_t blend)
+{
+    static const VkShaderStageFlagBits stages[2] = { VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT };
+    const VkGraphicsPipelineCreateInfo *base = &variants->base;
+    const VkPipelineRasterizationStateCreateInfo *rasterization = base->pRasterizationState;
+    const VkPipelineMultisampleStateCreateInfo *multisample = base->pMultisampleState;
+    VkPipelineColorBlendAttachmentState attachment = blend_attachment(variants, blend);
+    VkSampleMask sample_mask = ~0u;
+
+    variants->bind_shaders(command_buffer, 2, stages, variants->shaders);
+
+    // No pipeline to hold it, every piece of state a draw reads is set.
+    variants->set_viewport(command_buffer, base->pViewportState->viewportCount, base->pViewportState->pViewports);
+    variants->set_scissor(command_buffer, base->pViewportState->scissorCount, base->pViewportState->pScissors);
+    variants->set_vertex_input(command_buffer, variants->vertex_binding_count, variants->vertex_bindings,
+                               variants->vertex_attribute_count, variants->vertex_attributes);
+    variants->set_topology(command_buffer, topologies[topology]);
+    variants->set_primitive_restart(command_buffer, base->pInputAssemblyState->primitiveRestartEnable);
+    variants->set_rasterizer_discard(command_buffer, rasterization->rasterizerDiscardEnable);
+    variants->set_polygon_mode(command_buffer, rasterization->polygonMode);
+    variants->set_cull_mode(command_buffer, cull_modes[cull]);
+    variants->set_front_face(command_buffer, rasterization->frontFace);
+    variants->set_depth_bias(command_buffer, rasterization->depthBiasEnable);
+    variants->set_samples(command_buffer, multisample->rasterizationSamples);
+    variants->set_sample_mask(command_buffer, multisample->rasterizationSamples,
+                              multisample->pSampleMask ? multisample->pSampleMask : &sample_mask);
+    variants->set_alpha_to_coverage(command_buffer, multisample->alphaToCoverageEnable);
+    variants->set_depth_test(command_buffer, VK_FALSE);
+    variants->set_depth_write(command_buffer, VK_FALSE);
+    variants->set_depth_bounds_test(command_buffer, VK_FALSE);
+    variants->set_stencil_test(command_buffer, VK_FALSE);
+
+    VkColorBlendEquationEXT equation = {};
+    equation.srcColorBlendFactor = attachment.srcColorBlendFactor;
+    equation.dstColorBlendFactor = attachment.dstColorBlendFactor;
+    equation.colorBlendOp = attachment.colorBlendOp;
+    equation.srcAlphaBlendFactor = attachment.srcAlphaBlendFactor;
+    equation.dstAlphaBlendFactor = attachment.dstAlphaBlendFactor;
+    equation.alphaBlendOp = attachment.alphaBlendOp;
+    variants->set_blend_enable(command_buffer, 0, 1, &attachment.blendEnable);
+    variants->set_blend_equation(command_buffer, 0, 1, &equation);
+    variants->set_write_mask(command_buffer, 0, 1, &attachment.colorWriteMask);
+}
+
+VkResult
+pipeline_variants_bind(PipelineVariants *variants, VkCommandBuffer command_buffer, uint32_t index)
+{
+    PipelineVariant *variant = &variants->variants[index];
+    uint32_t cull, topology, blend;
+    double start = now_ms();
+    VkResult result = VK_SUCCESS;
+
+    split_index(index, &cull, &topology, &blend);
+    if (variants->backend == PIPELINE_VARIANTS_SHADER_OBJECT) {
+        bind_shader_objects(variants, command_buffer, cull, topology, blend);
+    } else {
+        if (!variant->pipeline)
+            result = variants->backend == PIPELINE_VARIANTS_LIBRARY
+                         ? link_libraries(variants, variant, cull, topology, blend)
+                         : create_monolithic(variants, variant, cull, topology, blend);
+        if (result != VK_SUCCESS)
+            return result;
+
+        // The fast link keeps serving until the optimized one is ready.
+        if (variant->optimizing && !variant->swapped && pipeline_cache_done(variants->cache, &variant->optimized) &&
+            variant->optimized.result == VK_SUCCESS)
+            variant->swapped = 1;
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          variant->swapped ? variant->optimized.pipeline : variant->pipeline);
+    }
+
+    if (!variant->bound) {
+        variant->bound = 1;
+        variant->first_bind_ms = now_ms() - start;
+    }
+    return VK_SUCCESS;
+}
+
+void
+pipeline_variants_close(PipelineVariants *variants)
+{
+    uint32_t bound = 0, optimized = 0, swapped = 0;
+    double total_ms = 0.0, max_ms = 0.0;
+
+    for (uint32_t i = 0; i < PIPELINE_VARIANT_COUNT; i++) {
+        PipelineVariant *variant = &variants->variants[i];
+        if (variant->bound) {
+            bound++;
+            total_ms += variant->first_bind_ms;
+            if (variant->first_bind_ms > max_ms)
+                max_ms = variant->first_bind_ms;
+        }
+        // The pool is stopped, every queued job is done.
+        optimized += variant->optimizing && variant->optimized.result == VK_SUCCESS;
+        swapped += variant->swapped;
+    }
+
+    printf("pipeline variants: %s", pipeline_variants_backend_name(variants->backend));
+    if (variants->backend == PIPELINE_VARIANTS_LIBRARY)
+        printf(", %u libraries in %.3f ms", PIPELINE_VARIANT_TOPOLOGIES + PIPELINE_VARIANT_CULL_MODES + 1 +
+               PIPELINE_VARIANT_BLENDS, variants->parts_ms);
+    else if (variants->backend == PIPELINE_VARIANTS_SHADER_OBJECT)
+        printf(", 2 shader objects in %.3f ms", variants->parts_ms);
+    printf(", %u/%u variants bound, first bind %.3f ms mean, %.3f ms max", bound, PIPELINE_VARIANT_COUNT,
+           bound ? total_ms / bound : 0.0, max_ms);
+    if (variants->backend == PIPELINE_VARIANTS_LIBRARY && variants->optimize)
+        printf(", %u optimized in the background, %u swapped in", optimized, swapped);
+    printf("\n");
+
+    for (uint32_t i = 0; i < PIPELINE_VARIANT_COUNT; i++) {
+        vkDestroyPipeline(variants->device, variants->variants[i].pipeline, NULL);
+        if (variants->variants[i].optimizing)
+            vkDestroyPipeline(variants->device, variants->variants[i].optimized.pipeline, NULL);
+    }
+    for (uint32_t i = 0; i < PIPELINE_VARIANT_TOPOLOGIES; i++)
+        vkDestroyPipeline(variants->device, variants->vertex_input[i], NULL);
+    for (uint32_t i = 0; i < PIPELINE_VARIANT_CULL_MODES; i++)
+        vkDestroyPipeline(variants->device, variants->pre_rasterization[i], NULL);
+    vkDestroyPipeline(variants->device, variants->fragment_shader, NULL);
+    for (uint32_t i = 0; i < PIPELINE_VARIANT_BLENDS; i++)
+        vkDestroyPipeline(variants->device, variants->fragment_output[i], NULL);
+    for (uint32_t i = 0; i < 2; i++)
+        if (variants->shaders[i])
+            variants->destroy_shader(variants->device, variants->shaders[i], NULL);
+}
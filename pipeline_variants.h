@@ -0,0 +1,147 @@
+#ifndef PIPELINE_VARIANTS_H
+#define PIPELINE_VARIANTS_H
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include "pipeline_cache.h"
+#include "shader_code.h"
+
+// Variants of one graphics pipeline that differ in fixed-function state
+// only: cull mode (none, back, front) x topology (triangle list, strip) x
+// blending (off, alpha, additive). Each variant is made the first time it is
+// bound, in one of three ways:
+//
+// PIPELINE_VARIANTS_MONOLITHIC: a full vkCreateGraphicsPipelines per
+//     variant, shaders compiled again every time.
+// PIPELINE_VARIANTS_LIBRARY: VK_EXT_graphics_pipeline_library. The vertex
+//     input, pre-rasterization, fragment shader and fragment output parts
+//     are compiled once at open (2 + 3 + 1 + 3 libraries) and a variant is
+//     a fast link of four of them. The link-time optimized version is then
+//     built on the pipeline cache's worker pool and replaces the fast one
+//     once it is done; PIPELINE_VARIANTS_OPTIMIZE=0 skips that.
+// PIPELINE_VARIANTS_SHADER_OBJECT: VK_EXT_shader_object. The two shaders
+//     are created once and everything else is dynamic state, a variant is a
+//     handful of vkCmdSet*() calls. Shader objects only draw inside dynamic
+//     rendering, see pipeline_variants_begin_rendering().
+//
+// A backend the device lacks falls back to the next simpler one.
+enum {
+    PIPELINE_VARIANTS_MONOLITHIC = 1,
+    PIPELINE_VARIANTS_LIBRARY,
+    PIPELINE_VARIANTS_SHADER_OBJECT,
+};
+
+#define PIPELINE_VARIANT_CULL_MODES 3
+#define PIPELINE_VARIANT_TOPOLOGIES 2
+#define PIPELINE_VARIANT_BLENDS 3
+#define PIPELINE_VARIANT_COUNT (PIPELINE_VARIANT_CULL_MODES * PIPELINE_VARIANT_TOPOLOGIES * PIPELINE_VARIANT_BLENDS)
+
+// Vertex bindings and attributes base may have with shader objects.
+#define PIPELINE_VARIANT_MAX_VERTEX_INPUTS 8
+
+// Feature structs pipeline_variants_enable() chains into the device create
+// info, they have to outlive vkCreateDevice().
+typedef struct PipelineVariantFeatures {
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT library;
+    VkPhysicalDeviceShaderObjectFeaturesEXT shader_object;
+    VkPhysicalDeviceDynamicRenderingFeatures dynamic_rendering;
+} PipelineVariantFeatures;
+
+typedef struct PipelineVariant {
+    char name[40];
+    VkPipeline pipeline;       // monolithic or fast-linked, NULL until first bound
+    VkPipeline libraries[4];   // what it was linked from
+    VkPipelineLibraryCreateInfoKHR link;
+    PipelineJob optimized;     // the link-time optimized build
+    int optimizing;            // optimized was queued
+    int swapped;               // optimized.pipeline is bound from now on
+    int bound;                 // at least once
+    double first_bind_ms;      // creating (if any) and binding it the first time
+} PipelineVariant;
+
+typedef struct PipelineVariants {
+    int backend;
+    VkDevice device;
+    PipelineCache *cache;
+    VkGraphicsPipelineCreateInfo base; // the state the variants start from
+    int optimize;
+    double parts_ms;                   // libraries or shader objects, at open
+
+    // PIPELINE_VARIANTS_LIBRARY
+    VkPipeline vertex_input[PIPELINE_VARIANT_TOPOLOGIES];
+    VkPipeline pre_rasterization[PIPELINE_VARIANT_CULL_MODES];
+    VkPipeline fragment_shader;
+    VkPipeline fragment_output[PIPELINE_VARIANT_BLENDS];
+
+    // PIPELINE_VARIANTS_SHADER_OBJECT
+    VkShaderEXT shaders[2];
+    PFN_vkCreateShadersEXT create_shaders;
+    PFN_vkDestroyShaderEXT destroy_shader;
+    PFN_vkCmdBindShadersEXT bind_shaders;
+    PFN_vkCmdBeginRenderingKHR begin_rendering;
+    PFN_vkCmdEndRenderingKHR end_rendering;
+    PFN_vkCmdSetViewportWithCountEXT set_viewport;
+    PFN_vkCmdSetScissorWithCountEXT set_scissor;
+    PFN_vkCmdSetCullModeEXT set_cull_mode;
+    PFN_vkCmdSetFrontFaceEXT set_front_face;
+    PFN_vkCmdSetPrimitiveTopologyEXT set_topology;
+    PFN_vkCmdSetPrimitiveRestartEnableEXT set_primitive_restart;
+    PFN_vkCmdSetRasterizerDiscardEnableEXT set_rasterizer_discard;
+    PFN_vkCmdSetPolygonModeEXT set_polygon_mode;
+    PFN_vkCmdSetRasterizationSamplesEXT set_samples;
+    PFN_vkCmdSetSampleMaskEXT set_sample_mask;
+    PFN_vkCmdSetAlphaToCoverageEnableEXT set_alpha_to_coverage;
+    PFN_vkCmdSetDepthTestEnableEXT set_depth_test;
+    PFN_vkCmdSetDepthWriteEnableEXT set_depth_write;
+    PFN_vkCmdSetDepthBiasEnableEXT set_depth_bias;
+    PFN_vkCmdSetStencilTestEnableEXT set_stencil_test;
+    PFN_vkCmdSetDepthBoundsTestEnableEXT set_depth_bounds_test;
+    PFN_vkCmdSetColorBlendEnableEXT set_blend_enable;
+    PFN_vkCmdSetColorBlendEquationEXT set_blend_equation;
+    PFN_vkCmdSetColorWriteMaskEXT set_write_mask;
+    PFN_vkCmdSetVertexInputEXT set_vertex_input;
+    uint32_t vertex_binding_count;
+    uint32_t vertex_attribute_count;
+    VkVertexInputBindingDescription2EXT vertex_bindings[PIPELINE_VARIANT_MAX_VERTEX_INPUTS];
+    VkVertexInputAttributeDescription2EXT vertex_attributes[PIPELINE_VARIANT_MAX_VERTEX_INPUTS];
+
+    PipelineVariant variants[PIPELINE_VARIANT_COUNT];
+} PipelineVariants;
+
+// Pick the backend to use on physical_device, starting from wanted and
+// printing why when it has to fall back. Appends the extensions it needs to
+// extensions (room for 2 more) and chains the features into *chain.
+int pipeline_variants_enable(VkPhysicalDevice physical_device, int wanted, PipelineVariantFeatures *features,
+                             const char **extensions, uint32_t *extension_count, const void **chain);
+
+// Prepare the parts of backend. base is a complete graphics pipeline whose
+// state the variants start from: a render pass with one color attachment and
+// no depth, no dynamic state. It and what it points to stay alive until
+// close. Shader objects are created from the embedded SPIR-V of vertex and
+// fragment with the set layouts and push constant ranges of layout_info,
+// which describes base.layout.
+VkResult pipeline_variants_open(PipelineVariants *variants, int backend, PipelineCache *cache,
+                                const VkGraphicsPipelineCreateInfo *base, const VkPipelineLayoutCreateInfo *layout_info,
+                                const ShaderCode *vertex, const ShaderCode *fragment);
+
+// Name of backend for the reports.
+const char *pipeline_variants_backend_name(int backend);
+
+// Begin and end the render pass of base.renderPass, or with shader objects
+// the same clear, store and final VK_IMAGE_LAYOUT_GENERAL done with dynamic
+// rendering on image and view.
+void pipeline_variants_begin_rendering(PipelineVariants *variants, VkCommandBuffer command_buffer,
+                                       const VkRenderPassBeginInfo *begin, VkImage image, VkImageView view);
+void pipeline_variants_end_rendering(PipelineVariants *variants, VkCommandBuffer command_buffer, VkImage image);
+
+// Bind variant index (below PIPELINE_VARIANT_COUNT) for drawing, creating it
+// first if it has not been bound before.
+VkResult pipeline_variants_bind(PipelineVariants *variants, VkCommandBuffer command_buffer, uint32_t index);
+
+// Print the first-bind latencies and destroy everything. The pipeline
+// cache's workers have to be stopped already (pipeline_cache_close()), and
+// no command buffer using a variant may be pending.
+void pipeline_variants_close(PipelineVariants *variants);
+
+#endif
@@ -1,4 +1,6 @@
 glslc triangle.vert -o vert.spv
 glslc triangle.frag -o frag.spv
-gcc main.c -o main.bin -lvulkan
+glslc -mfmt=c triangle.vert -o vert.spv.h
+glslc -mfmt=c triangle.frag -o frag.spv.h
+gcc -O2 main.c ../image_writer.c ../pipeline_cache.c ../shader_code.c -o main.bin -lvulkan -pthread -lz
 ./main.bin
@@ -5,6 +5,20 @@
 #include <stdint.h>
 #include <assert.h>
 
+#include "../image_writer.h"
+#include "../pipeline_cache.h"
+#include "../shader_code.h"
+
+// Compiled in by build.sh
+static const uint32_t vertSpv[] =
+#include "vert.spv.h"
+;
+static const uint32_t fragSpv[] =
+#include "frag.spv.h"
+;
+static const ShaderCode vertShaderCode = SHADER_CODE("vert.spv", vertSpv);
+static const ShaderCode fragShaderCode = SHADER_CODE("frag.spv", fragSpv);
+
 #define WIDTH 256
 #define HEIGHT 256
 
@@ -38,29 +52,9 @@ uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, Vk
     return 0;
 }
 
-char* readFile(const char* filename, size_t* size) {
-    FILE* file = fopen(filename, "rb");
-    assert(file && "Failed to open file!");
-    fseek(file, 0, SEEK_END);
-    *size = ftell(file);
-    rewind(file);
-    char* buffer = (char*)malloc(*size);
-    fread(buffer, 1, *size, file);
-    fclose(file);
-    return buffer;
-}
-
-VkShaderModule createShaderModule(VkDevice device, const char* filename) {
-    size_t size;
-    char* code = readFile(filename, &size);
-    VkShaderModuleCreateInfo createInfo = {
-        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = size,
-        .pCode = (const uint32_t*)code
-    };
+VkShaderModule createShaderModule(VkDevice device, const ShaderCode* shader) {
     VkShaderModule shaderModule;
-    VK_CHECK(vkCreateShaderModule(device, &createInfo, NULL, &shaderModule));
-    free(code);
+    VK_CHECK(shader_code_create_module(device, shader, &shaderModule));
     return shaderModule;
 }
 
@@ -85,14 +79,23 @@ int main() {
         .pQueuePriorities = &queuePriority
     };
 
+    // Per-pipeline compile times and cache hits in the report.
+    const char *feedbackExtension = pipeline_cache_feedback_extension(physicalDevice);
+
     VkDeviceCreateInfo deviceCreateInfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = &queueCreateInfo
+        .pQueueCreateInfos = &queueCreateInfo,
+        .enabledExtensionCount = feedbackExtension ? 1 : 0,
+        .ppEnabledExtensionNames = &feedbackExtension
     };
     VkDevice device;
     VK_CHECK(vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL, &device));
 
+    // Pipelines compiled by an earlier run come out of the cache file.
+    PipelineCache pipelineCache;
+    VK_CHECK(pipeline_cache_open(&pipelineCache, physicalDevice, device, "query-pool", feedbackExtension != NULL));
+
     VkQueue queue;
     vkGetDeviceQueue(device, 0, 0, &queue);
 
@@ -172,8 +175,8 @@ int main() {
     VK_CHECK(vkCreateFramebuffer(device, &fbInfo, NULL, &framebuffer));
 
     // 5. Pipeline Setup with Push Constants
-    VkShaderModule vertShader = createShaderModule(device, "vert.spv");
-    VkShaderModule fragShader = createShaderModule(device, "frag.spv");
+    VkShaderModule vertShader = createShaderModule(device, &vertShaderCode);
+    VkShaderModule fragShader = createShaderModule(device, &fragShaderCode);
     
     VkPipelineShaderStageCreateInfo shaderStages[] = {
         {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, .stage = VK_SHADER_STAGE_VERTEX_BIT, .module = vertShader, .pName = "main"},
@@ -216,7 +219,8 @@ int main() {
         .layout = pipelineLayout, .renderPass = renderPass, .subpass = 0
     };
     VkPipeline pipeline;
-    VK_CHECK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline));
+    VK_CHECK(pipeline_cache_create_graphics(&pipelineCache, "query-pool", &pipelineInfo, &pipeline));
+    pipeline_cache_close(&pipelineCache);
 
     // 6. Query Pool Setup
     VkQueryPoolCreateInfo queryPoolInfo = {
@@ -359,13 +363,7 @@ int main() {
     // 11. Write Image to PPM file
     void* mappedImageBuf;
     vkMapMemory(device, imageBufferMemory, 0, imageBufferSize, 0, &mappedImageBuf);
-    FILE* ppmFile = fopen("output.ppm", "wb");
-    fprintf(ppmFile, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
-    uint8_t* pixels = (uint8_t*)mappedImageBuf;
-    for (int i = 0; i < WIDTH * HEIGHT * 4; i += 4) {
-        fwrite(&pixels[i], 1, 3, ppmFile); 
-    }
-    fclose(ppmFile);
+    image_writer_write_ppm("output.ppm", mappedImageBuf, IMAGE_PIXEL_RGBA8, WIDTH, HEIGHT, 0);
     vkUnmapMemory(device, imageBufferMemory);
     printf("Saved render to output.ppm\n");
 
@@ -1,2 +1,3 @@
 glslangValidator -V ray_query.comp -o ray_query.spv
-gcc main.c -o vulkan_test -lvulkan
+glslangValidator -V ray_query.comp --vn ray_query_spv -o ray_query.spv.h
+gcc -O2 main.c ../image_writer.c ../pipeline_cache.c ../shader_code.c -o vulkan_test -lvulkan -pthread -lz
@@ -3,8 +3,20 @@
 #include <string.h>
 #include <vulkan/vulkan.h>
 
+#include "../image_writer.h"
+#include "../pipeline_cache.h"
+#include "../shader_code.h"
+
+// Compiled in by build.sh
+#include "ray_query.spv.h"
+static const ShaderCode rayQueryShader = SHADER_CODE("ray_query.spv", ray_query_spv);
+
+#ifndef WIDTH
 #define WIDTH  512
+#endif
+#ifndef HEIGHT
 #define HEIGHT 512
+#endif
 
 // Ray Tracing function pointers
 PFN_vkCreateAccelerationStructureKHR              p_vkCreateAccelerationStructureKHR;
@@ -104,24 +116,9 @@ void endSingleTimeCommands(VkCommandBuffer cb) {
     vkFreeCommandBuffers(device, commandPool, 1, &cb);
 }
 
-VkShaderModule createShaderModule(const char* filename) {
-    FILE* f = fopen(filename, "rb");
-    if (!f) { printf("Failed to open shader file\n"); exit(1); }
-    fseek(f, 0, SEEK_END);
-    long sz = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    char* code = malloc(sz);
-    fread(code, 1, sz, f);
-    fclose(f);
-
-    VkShaderModuleCreateInfo ci = {
-        .sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = sz,
-        .pCode    = (const uint32_t*)code
-    };
+VkShaderModule createShaderModule(const ShaderCode* shader) {
     VkShaderModule mod;
-    vkCreateShaderModule(device, &ci, NULL, &mod);
-    free(code);
+    shader_code_create_module(device, shader, &mod);
     return mod;
 }
 
@@ -166,23 +163,30 @@ int main() {
         .pNext               = &asFeatures,
         .bufferDeviceAddress = VK_TRUE
     };
+    // Per-pipeline compile times and cache hits in the report.
+    const char* feedbackExtension = pipeline_cache_feedback_extension(physicalDevice);
     const char* deviceExts[] = {
         VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
         VK_KHR_RAY_QUERY_EXTENSION_NAME,
         VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
-        VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME
+        VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
+        feedbackExtension
     };
     VkDeviceCreateInfo deviceInfo = {
         .sType                   = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .pNext                   = &bdaFeatures,
         .queueCreateInfoCount    = 1,
         .pQueueCreateInfos       = &queueCI,
-        .enabledExtensionCount   = 4,
+        .enabledExtensionCount   = feedbackExtension ? 5 : 4,
         .ppEnabledExtensionNames = deviceExts
     };
     vkCreateDevice(physicalDevice, &deviceInfo, NULL, &device);
     vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
 
+    // Pipelines compiled by an earlier run come out of the cache file.
+    PipelineCache pipelineCache;
+    pipeline_cache_open(&pipelineCache, physicalDevice, device, "ray_query", feedbackExtension != NULL);
+
     // 4. Load RT Function Pointers
     p_vkCreateAccelerationStructureKHR =
         (PFN_vkCreateAccelerationStructureKHR)vkGetDeviceProcAddr(device, "vkCreateAccelerationStructureKHR");
@@ -363,7 +367,8 @@ int main() {
 
     // 7. Output Buffer
     VkBuffer outputBuffer; VkDeviceMemory outputBufferMemory;
-    VkDeviceSize outputBufferSize = WIDTH * HEIGHT * 4 * sizeof(float);
+    // One packed RGBA8 pixel per uint
+    VkDeviceSize outputBufferSize = (VkDeviceSize)WIDTH * HEIGHT * sizeof(uint32_t);
     createBuffer(outputBufferSize,
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
@@ -425,15 +430,23 @@ int main() {
     };
     vkUpdateDescriptorSets(device, 2, writes, 0, NULL);
 
+    // Output size, so the shader does not hardcode the resolution
+    VkPushConstantRange pushRange = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset     = 0,
+        .size       = sizeof(uint32_t) * 2
+    };
     VkPipelineLayoutCreateInfo layoutInfo = {
-        .sType          = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts    = &dsl
+        .sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount         = 1,
+        .pSetLayouts            = &dsl,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges    = &pushRange
     };
     VkPipelineLayout pipelineLayout;
     vkCreatePipelineLayout(device, &layoutInfo, NULL, &pipelineLayout);
 
-    VkShaderModule shaderModule = createShaderModule("ray_query.spv");
+    VkShaderModule shaderModule = createShaderModule(&rayQueryShader);
     VkComputePipelineCreateInfo pipelineInfo = {
         .sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
         .layout = pipelineLayout,
@@ -445,27 +458,22 @@ int main() {
         }
     };
     VkPipeline pipeline;
-    vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline);
+    pipeline_cache_create_compute(&pipelineCache, "ray_query", &pipelineInfo, &pipeline);
+    pipeline_cache_close(&pipelineCache);
 
     // 9. Dispatch
     cmd = beginSingleTimeCommands();
     vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
     vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
                             pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
-    vkCmdDispatch(cmd, WIDTH / 16, HEIGHT / 16, 1);
+    uint32_t size[2] = { WIDTH, HEIGHT };
+    vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(size), size);
+    vkCmdDispatch(cmd, (WIDTH + 15) / 16, (HEIGHT + 15) / 16, 1);
     endSingleTimeCommands(cmd);
 
     // 10. Save to PPM
     vkMapMemory(device, outputBufferMemory, 0, outputBufferSize, 0, &data);
-    float* pixels = (float*)data;
-    FILE* f = fopen("output.ppm", "wb");
-    fprintf(f, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
-    for (int i = 0; i < WIDTH * HEIGHT; ++i) {
-        fputc((unsigned char)(pixels[i * 4 + 0] * 255.0f), f);
-        fputc((unsigned char)(pixels[i * 4 + 1] * 255.0f), f);
-        fputc((unsigned char)(pixels[i * 4 + 2] * 255.0f), f);
-    }
-    fclose(f);
+    image_writer_write_ppm("output.ppm", data, IMAGE_PIXEL_RGBA8, WIDTH, HEIGHT, 0);
     vkUnmapMemory(device, outputBufferMemory);
 
     printf("Render complete. Output saved to output.ppm\n");
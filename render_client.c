@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "render_protocol.h"
+
+// Client for `main.bin --serve`: sends a series of render requests, one at a
+// time, and reports the latency percentiles. With -s it also spawns the
+// given one-shot binary once per request for comparison.
+//
+// usage: render_client.bin [-n requests] [-o none|file|shm] [-s main.bin] [-q] socket
+//   -q asks the server to shut down afterwards.
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+report(const char *name, double *ms, int count)
+{
+    double total = 0.0;
+
+    qsort(ms, count, sizeof(double), compare_double);
+    for (int i = 0; i < count; i++)
+        total += ms[i];
+
+    printf("%-10s %8d %10.3f %10.3f %10.3f %10.3f %10.3f %10.1f\n", name, count, total / count,
+           ms[count / 2], ms[count * 90 / 100], ms[count * 99 / 100], ms[count - 1], count * 1000.0 / total);
+}
+
+// One request, blocking until its answer arrived.
+static int
+render(int sock, RenderRequest *request, int shm_fd, RenderResponse *response)
+{
+    if (render_send(sock, request, sizeof(*request), request->output == RENDER_OUTPUT_SHM ? shm_fd : -1) ||
+        render_recv(sock, response, sizeof(*response), NULL) != 1) {
+        fprintf(stderr, "Lost the connection to the server: %s\n", strerror(errno));
+        return -1;
+    }
+    if (response->status) {
+        fprintf(stderr, "Request failed: %s\n", strerror(-response->status));
+        return -1;
+    }
+    return 0;
+}
+
+static int
+spawn(const char *binary)
+{
+    pid_t pid = fork();
+    int status;
+
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execl(binary, binary, (char *)NULL);
+        _exit(127);
+    }
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR)
+            return -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    RenderOutput output = RENDER_OUTPUT_NONE;
+    const char *spawn_binary = NULL;
+    int count = 100, shutdown_server = 0, opt;
+
+    while ((opt = getopt(argc, argv, "n:o:s:q")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'o':
+            if (!strcmp(optarg, "none"))
+                output = RENDER_OUTPUT_NONE;
+            else if (!strcmp(optarg, "file"))
+                output = RENDER_OUTPUT_FILE;
+            else if (!strcmp(optarg, "shm"))
+                output = RENDER_OUTPUT_SHM;
+            else
+                goto usage;
+            break;
+        case 's':
+            spawn_binary = optarg;
+            break;
+        case 'q':
+            shutdown_server = 1;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc - 1 || count < 1)
+        goto usage;
+
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[optind], sizeof(addr.sun_path) - 1);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "Failed to connect to %s: %s\n", argv[optind], strerror(errno));
+        return -1;
+    }
+
+    // The same frame main.c renders by default, slid across the image.
+    RenderRequest request = {};
+    RenderResponse response;
+    request.magic = RENDER_PROTOCOL_MAGIC;
+    request.color[1] = 1.0f;
+    request.color[3] = 1.0f;
+    request.color_offset[0] = 1.0f;
+    request.test = 24;
+
+    // Warm-up, also tells the image size for the memfd.
+    if (render(sock, &request, -1, &response))
+        return -1;
+
+    size_t shm_size = (size_t)response.width * response.height * response.channels;
+    int shm_fd = -1;
+    if (output == RENDER_OUTPUT_SHM) {
+        shm_fd = memfd_create("render_client", MFD_CLOEXEC);
+        if (shm_fd < 0 || ftruncate(shm_fd, shm_size)) {
+            fprintf(stderr, "Failed to create a %zu byte memfd: %s\n", shm_size, strerror(errno));
+            return -1;
+        }
+    }
+
+    double *served = malloc(sizeof(double) * count);
+    double *spawned = malloc(sizeof(double) * count);
+    if (!served || !spawned)
+        return -1;
+
+    request.output = output;
+    for (int i = 0; i < count; i++) {
+        request.vertex_offset[0] = (float)i / count - 0.5f;
+        if (output == RENDER_OUTPUT_FILE)
+            snprintf(request.path, sizeof(request.path), "client_%04d.ppm", i); // IMAGE_FORMAT decides
+
+        double start = now_ms();
+        if (render(sock, &request, shm_fd, &response))
+            return -1;
+        served[i] = now_ms() - start;
+    }
+
+    printf("%ux%u, %d requests, output %s\n", response.width, response.height, count,
+           output == RENDER_OUTPUT_FILE ? "file" : output == RENDER_OUTPUT_SHM ? "shm" : "none");
+    printf("last counts: triangle %u background %u total %u test %u\n",
+           response.counts[0], response.counts[1], response.counts[2], response.counts[3]);
+    printf("%-10s %8s %10s %10s %10s %10s %10s %10s\n",
+           "", "requests", "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms", "req/s");
+    report("server", served, count);
+
+    if (spawn_binary) {
+        for (int i = 0; i < count; i++) {
+            double start = now_ms();
+            if (spawn(spawn_binary)) {
+                fprintf(stderr, "Failed to run %s\n", spawn_binary);
+                return -1;
+            }
+            spawned[i] = now_ms() - start;
+        }
+        report("spawn", spawned, count);
+    }
+
+    if (shutdown_server) {
+        request.output = RENDER_SHUTDOWN;
+        if (render(sock, &request, -1, &response))
+            return -1;
+    }
+
+    if (shm_fd >= 0)
+        close(shm_fd);
+    close(sock);
+    free(served);
+    free(spawned);
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-n requests] [-o none|file|shm] [-s main.bin] [-q] socket\n", argv[0]);
+    return -1;
+}
@@ -0,0 +1,958 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "image_writer.h"
+#include "pipeline_cache.h"
+#include "shader_code.h"
+
+// Render independent jobs on K render contexts at once, all on one VkDevice.
+// A context is everything one job needs while it is on the GPU: a command
+// pool and buffer, a fence, an offscreen image with its framebuffer, the
+// check.comp result buffer and a staging buffer. Each context is driven by
+// its own thread, which records, submits, waits and writes its job without
+// touching another context's objects. The device, render pass, pipelines
+// and vertex buffer are shared, Vulkan lets any thread use those.
+//
+// `render_pool.bin [jobs]` renders jobs frames (JOB_COUNT by default), job N
+// with the triangle moved to the Nth cell of an 8x8 grid, and saves them as
+// output_pool_NNNN.<ext> (IMAGE_FORMAT as in main.c).
+//
+// $RENDER_CONTEXTS sets K, one per online CPU when unset. The contexts get
+// min(K, queueCount) queues of the graphics & compute family in turn.
+// vkQueueSubmit() needs the queue externally synchronized, so every queue
+// has a lock its contexts submit under; with fewer queues than contexts they
+// take turns on it. $RENDER_QUEUES caps the queue count, RENDER_QUEUES=1
+// puts every context on a single queue.
+//
+// The jobs are split into one contiguous range per context. A context takes
+// its own jobs from the front of its range and, when that is empty, steals
+// from the back of the next non-empty range, so a slow context does not hold
+// the rest of the run up.
+#ifndef IMAGE_WIDTH
+#define IMAGE_WIDTH 256
+#endif
+#ifndef IMAGE_HEIGHT
+#define IMAGE_HEIGHT 256
+#endif
+
+// check.comp runs in 16x16 workgroups over the image rounded up to them and
+// counts every invocation in total, the ones past the edge included.
+#define CHECK_GROUPS_X ((IMAGE_WIDTH + 15) / 16)
+#define CHECK_GROUPS_Y ((IMAGE_HEIGHT + 15) / 16)
+#define CHECK_INVOCATIONS (CHECK_GROUPS_X * CHECK_GROUPS_Y * 256)
+
+#ifndef JOB_COUNT
+#define JOB_COUNT 64
+#endif
+
+#define RENDER_CONTEXTS_MAX 64
+
+typedef struct Vertex {
+    float pos[4];
+    float color[4];
+} Vertex;
+
+// Same layout as in main.c and the shaders.
+typedef struct PushConstants {
+    float positions[3][4];
+    float color[4];
+    float vertex_offset[4];
+    float color_offset[4];
+    uint32_t test;
+    uint32_t use_buffer;
+    uint32_t pad[2];
+    float tile_transform[4];
+} __attribute__((packed)) PushConstants;
+
+// The jobs a context has not started yet. The owner takes from begin,
+// thieves from end.
+typedef struct JobRange {
+    pthread_mutex_t lock;
+    uint32_t begin;
+    uint32_t end;
+} JobRange;
+
+typedef struct RenderQueue {
+    VkQueue queue;
+    pthread_mutex_t lock; // held around vkQueueSubmit()
+} RenderQueue;
+
+typedef struct RenderContext {
+    struct RenderPool *pool;
+    uint32_t index;
+    RenderQueue *queue;
+
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+    VkImage image;
+    VkDeviceMemory imageMemory;
+    VkImageView imageView;
+    VkFramebuffer framebuffer;
+    VkBuffer resultBuffer;
+    VkDeviceMemory resultBufferMemory;
+    uint32_t *results; // mapped
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    void *pixels;      // mapped
+    VkDescriptorSet descriptorSet;
+
+    JobRange jobs;
+    pthread_t thread;
+
+    // Written by the context's thread only, read after it was joined.
+    uint32_t jobsDone;
+    uint32_t jobsStolen;
+    uint32_t badJobs;     // check.comp did not run every invocation once
+    uint64_t totals[4];   // check.comp results summed over the jobs
+    double recordMs;
+    double queueWaitMs;   // waiting for the queue lock
+    double gpuWaitMs;
+    double writeMs;
+} RenderContext;
+
+typedef struct RenderPool {
+    VkDevice device;
+    VkRenderPass renderPass;
+    VkPipelineLayout graphicsPipelineLayout;
+    VkPipelineLayout computePipelineLayout;
+    VkPipeline graphicsPipeline;
+    VkPipeline computePipeline;
+    VkBuffer vertexBuffer;
+    PushConstants defaults;
+    ImageFileFormat fileFormat;
+    RenderContext *contexts;
+    uint32_t contextCount;
+} RenderPool;
+
+#define VK_CHECK(x)                                                              \
+    do {                                                                         \
+        VkResult err = x;                                                        \
+        if (err) {                                                               \
+            fprintf(stderr, "Detected Vulkan error: %d at %s:%d\n", err,         \
+                    __FILE__, __LINE__);                                         \
+            abort();                                                             \
+        }                                                                        \
+    } while (0)
+
+// Compiled in by build.sh, the same shaders as main.c's default build.
+#include "triangle.vert.spv.h"
+#include "triangle.frag.spv.h"
+#include "check.comp.spv.h"
+static const ShaderCode triangleVertShader = SHADER_CODE("triangle.vert.spv", triangle_vert_spv);
+static const ShaderCode triangleFragShader = SHADER_CODE("triangle.frag.spv", triangle_frag_spv);
+static const ShaderCode checkShader = SHADER_CODE("check.comp.spv", check_comp_spv);
+
+static double
+nowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint32_t
+findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) &&
+            (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    fprintf(stderr, "Failed to find suitable memory type!\n");
+    abort();
+}
+
+// A buffer in host-visible, coherent memory that stays mapped at *mapped.
+static void
+createMappedBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage,
+                   VkBuffer *buffer, VkDeviceMemory *memory, void **mapped)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_CHECK(vkCreateBuffer(device, &bufferInfo, NULL, buffer));
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, *buffer, &memRequirements);
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memRequirements.size;
+    allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits,
+                                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    VK_CHECK(vkAllocateMemory(device, &allocInfo, NULL, memory));
+    VK_CHECK(vkBindBufferMemory(device, *buffer, *memory, 0));
+    VK_CHECK(vkMapMemory(device, *memory, 0, size, 0, mapped));
+}
+
+// The next job of range: its first one for the owner, its last one for a
+// thief. Returns 0 when the range is empty.
+static int
+popJob(JobRange *range, int steal, uint32_t *job)
+{
+    int found = 0;
+    pthread_mutex_lock(&range->lock);
+    if (range->begin < range->end) {
+        *job = steal ? --range->end : range->begin++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&range->lock);
+    return found;
+}
+
+// The context's own next job, or one stolen from the others. Jobs are only
+// ever taken, so once every range is empty the run is over.
+static int
+takeJob(RenderContext *context, uint32_t *job)
+{
+    RenderPool *pool = context->pool;
+
+    if (popJob(&context->jobs, 0, job))
+        return 1;
+    for (uint32_t i = 1; i < pool->contextCount; i++) {
+        RenderContext *victim = &pool->contexts[(context->index + i) % pool->contextCount];
+        if (popJob(&victim->jobs, 1, job)) {
+            context->jobsStolen++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Record job into the context's command buffer: clear the counters, draw,
+// check.comp, copy the image to the staging buffer. The same commands as
+// main.c's default path, only the triangle's place differs between jobs.
+static void
+recordJob(RenderContext *context, uint32_t job)
+{
+    RenderPool *pool = context->pool;
+    VkCommandBuffer commandBuffer = context->commandBuffer;
+
+    PushConstants push_constants = pool->defaults;
+    float cell[4] = { 1.0f, 1.0f, ((job % 8) - 3.5f) / 8.0f, ((job / 8 % 8) - 3.5f) / 8.0f };
+    memcpy(push_constants.tile_transform, cell, sizeof(cell));
+
+    // Everything recorded for the previous job goes at once.
+    VK_CHECK(vkResetCommandPool(pool->device, context->commandPool, 0));
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+    vkCmdFillBuffer(commandBuffer, context->resultBuffer, 0, VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         1, &memoryBarrier,
+                         0, NULL,
+                         0, NULL);
+
+    // ---- Graphics Pass ----
+    VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f}; // black color
+    VkRenderPassBeginInfo renderPassBeginInfo = {};
+    renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassBeginInfo.renderPass = pool->renderPass;
+    renderPassBeginInfo.framebuffer = context->framebuffer;
+    renderPassBeginInfo.renderArea.extent.width = IMAGE_WIDTH;
+    renderPassBeginInfo.renderArea.extent.height = IMAGE_HEIGHT;
+    renderPassBeginInfo.clearValueCount = 1;
+    renderPassBeginInfo.pClearValues = &clearColor;
+    vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pool->graphicsPipeline);
+
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &pool->vertexBuffer, &offset);
+    vkCmdPushConstants(commandBuffer,
+                       pool->graphicsPipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                       0,
+                       sizeof(PushConstants),
+                       &push_constants);
+    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+    vkCmdEndRenderPass(commandBuffer);
+
+    // The render pass left the image in GENERAL, check.comp reads it there.
+    VkImageMemoryBarrier imageMemoryBarrier = {};
+    imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageMemoryBarrier.image = context->image;
+    imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageMemoryBarrier.subresourceRange.levelCount = 1;
+    imageMemoryBarrier.subresourceRange.layerCount = 1;
+    imageMemoryBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0, NULL,
+                         0, NULL,
+                         1, &imageMemoryBarrier);
+
+    // ---- Compute Pass ----
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pool->computePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pool->computePipelineLayout,
+                            0, 1, &context->descriptorSet, 0, NULL);
+    vkCmdPushConstants(commandBuffer,
+                       pool->computePipelineLayout,
+                       VK_SHADER_STAGE_COMPUTE_BIT,
+                       0,
+                       sizeof(PushConstants),
+                       &push_constants);
+    vkCmdDispatch(commandBuffer, CHECK_GROUPS_X, CHECK_GROUPS_Y, 1);
+
+    // ---- Readback ----
+    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0, NULL,
+                         0, NULL,
+                         1, &imageMemoryBarrier);
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent.width = IMAGE_WIDTH;
+    region.imageExtent.height = IMAGE_HEIGHT;
+    region.imageExtent.depth = 1;
+    vkCmdCopyImageToBuffer(commandBuffer, context->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           context->stagingBuffer, 1, &region);
+
+    // The results and the pixels are read by the host once the fence signals.
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT,
+                         0,
+                         1, &memoryBarrier,
+                         0, NULL,
+                         0, NULL);
+
+    VK_CHECK(vkEndCommandBuffer(commandBuffer));
+}
+
+static void *
+contextThread(void *arg)
+{
+    RenderContext *context = arg;
+    RenderPool *pool = context->pool;
+    const char *ext = image_writer_format_extension(pool->fileFormat);
+    uint32_t job;
+
+    while (takeJob(context, &job)) {
+        double start = nowMs();
+        recordJob(context, job);
+        double recorded = nowMs();
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &context->commandBuffer;
+
+        pthread_mutex_lock(&context->queue->lock);
+        double locked = nowMs();
+        VK_CHECK(vkQueueSubmit(context->queue->queue, 1, &submitInfo, context->fence));
+        pthread_mutex_unlock(&context->queue->lock);
+
+        VK_CHECK(vkWaitForFences(pool->device, 1, &context->fence, VK_TRUE, UINT64_MAX));
+        VK_CHECK(vkResetFences(pool->device, 1, &context->fence));
+        double finished = nowMs();
+
+        if (context->results[2] != CHECK_INVOCATIONS)
+            context->badJobs++;
+        for (uint32_t i = 0; i < 4; i++)
+            context->totals[i] += context->results[i];
+
+        char path[64];
+        snprintf(path, sizeof(path), "output_pool_%04u.%s", job, ext);
+        image_writer_write(path, context->pixels, IMAGE_PIXEL_RGBA8, pool->fileFormat,
+                           IMAGE_WIDTH, IMAGE_HEIGHT, 0);
+
+        context->recordMs += recorded - start;
+        context->queueWaitMs += locked - recorded;
+        context->gpuWaitMs += finished - locked;
+        context->writeMs += nowMs() - finished;
+        context->jobsDone++;
+    }
+    return NULL;
+}
+
+static uint32_t
+countFromEnv(const char *name, long fallback)
+{
+    const char *env = getenv(name);
+    long count = env && *env ? atol(env) : fallback;
+    if (count < 1)
+        count = 1;
+    if (count > RENDER_CONTEXTS_MAX)
+        count = RENDER_CONTEXTS_MAX;
+    return (uint32_t)count;
+}
+
+int main(int argc, char **argv) {
+    uint32_t jobCount = JOB_COUNT;
+    if (argc > 1 && atol(argv[1]) > 0)
+        jobCount = (uint32_t)atol(argv[1]);
+    uint32_t contextCount = countFromEnv("RENDER_CONTEXTS", sysconf(_SC_NPROCESSORS_ONLN));
+
+    // 1. Vulkan Instance Creation
+    VkApplicationInfo appInfo = {};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "Vulkan Render Pool";
+    appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.pEngineName = "No Engine";
+    appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.apiVersion = VK_API_VERSION_1_1;
+
+    VkInstanceCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pApplicationInfo = &appInfo;
+
+    VkInstance instance;
+    VK_CHECK(vkCreateInstance(&createInfo, NULL, &instance));
+
+    // 2. Physical Device and Queue Family Selection
+    uint32_t deviceCount = 0;
+    vkEnumeratePhysicalDevices(instance, &deviceCount, NULL);
+    if (deviceCount == 0) {
+        fprintf(stderr, "Failed to find GPUs with Vulkan support!\n");
+        return -1;
+    }
+    VkPhysicalDevice *physicalDevices = malloc(sizeof(VkPhysicalDevice) * deviceCount);
+    vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDevices);
+
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    uint32_t queueFamilyIndex = -1;
+    uint32_t familyQueueCount = 0;
+
+    for (uint32_t i = 0; i < deviceCount && physicalDevice == VK_NULL_HANDLE; i++) {
+        VkQueueFamilyProperties queueFamilyProperties[16];
+        uint32_t queueFamilyCount = 16;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevices[i], &queueFamilyCount, queueFamilyProperties);
+
+        for (uint32_t j = 0; j < queueFamilyCount; j++) {
+            if ((queueFamilyProperties[j].queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+                (queueFamilyProperties[j].queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+                physicalDevice = physicalDevices[i];
+                queueFamilyIndex = j;
+                familyQueueCount = queueFamilyProperties[j].queueCount;
+                break;
+            }
+        }
+    }
+    free(physicalDevices);
+
+    if (physicalDevice == VK_NULL_HANDLE) {
+        fprintf(stderr, "Failed to find a suitable physical device with graphics & compute queue!\n");
+        return -1;
+    }
+
+    // 3. Logical Device with one queue per context, as far as the family has them
+    uint32_t queueCount = countFromEnv("RENDER_QUEUES", contextCount);
+    if (queueCount > contextCount)
+        queueCount = contextCount;
+    if (queueCount > familyQueueCount)
+        queueCount = familyQueueCount;
+
+    float queuePriorities[RENDER_CONTEXTS_MAX];
+    for (uint32_t i = 0; i < queueCount; i++)
+        queuePriorities[i] = 1.0f;
+
+    VkDeviceQueueCreateInfo queueCreateInfo = {};
+    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
+    queueCreateInfo.queueCount = queueCount;
+    queueCreateInfo.pQueuePriorities = queuePriorities;
+
+    VkDeviceCreateInfo deviceCreateInfo = {};
+    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+    deviceCreateInfo.queueCreateInfoCount = 1;
+
+    // Per-pipeline compile times and cache hits in the report.
+    const char *feedbackExtension = pipeline_cache_feedback_extension(physicalDevice);
+    deviceCreateInfo.enabledExtensionCount = feedbackExtension ? 1 : 0;
+    deviceCreateInfo.ppEnabledExtensionNames = &feedbackExtension;
+
+    VkDevice device;
+    VK_CHECK(vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL, &device));
+
+    RenderQueue queues[RENDER_CONTEXTS_MAX];
+    for (uint32_t i = 0; i < queueCount; i++) {
+        vkGetDeviceQueue(device, queueFamilyIndex, i, &queues[i].queue);
+        pthread_mutex_init(&queues[i].lock, NULL);
+    }
+    printf("%u render contexts on %u of the family's %u queues.\n", contextCount, queueCount, familyQueueCount);
+
+    // Pipelines compiled by an earlier run come out of the cache file.
+    PipelineCache pipelineCache;
+    VK_CHECK(pipeline_cache_open(&pipelineCache, physicalDevice, device, "render_pool", feedbackExtension != NULL));
+
+    // 4. Shared Vertex Buffer
+    const Vertex vertices[3] = {
+        { { 0.0f, -0.5f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f, 1.0f } },//gree color
+        { { 0.5f,  0.5f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f, 1.0f } },
+        { {-0.5f,  0.5f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f, 1.0f } }
+    };
+
+    RenderPool pool = {};
+    pool.device = device;
+    pool.fileFormat = image_writer_format_from_env();
+    pool.contextCount = contextCount;
+
+    VkDeviceMemory vertexBufferMemory;
+    void *data;
+    createMappedBuffer(physicalDevice, device, sizeof(vertices), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                       &pool.vertexBuffer, &vertexBufferMemory, &data);
+    memcpy(data, vertices, sizeof(vertices));
+    vkUnmapMemory(device, vertexBufferMemory);
+
+    // The parameters every job starts from, main.c's defaults.
+    memcpy(pool.defaults.color, vertices[0].color, sizeof(pool.defaults.color));
+    memcpy(pool.defaults.positions[0], vertices[0].pos, sizeof(pool.defaults.positions[0]));
+    memcpy(pool.defaults.positions[1], vertices[1].pos, sizeof(pool.defaults.positions[1]));
+    memcpy(pool.defaults.positions[2], vertices[2].pos, sizeof(pool.defaults.positions[2]));
+    pool.defaults.test = 24;
+    pool.defaults.use_buffer = 0;
+    pool.defaults.vertex_offset[0] = 0.5f;
+    pool.defaults.color_offset[0] = 1.0f;
+
+    // 5. Shared Render Pass: clear, store, leave the image in GENERAL for check.comp
+    VkAttachmentDescription colorAttachment = {};
+    colorAttachment.format = VK_FORMAT_R8G8B8A8_UNORM;
+    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkAttachmentReference colorAttachmentRef = {};
+    colorAttachmentRef.attachment = 0;
+    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorAttachmentRef;
+
+    // The previous job's copy read the image before this one clears it.
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.srcAccessMask = 0;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &colorAttachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = 1;
+    renderPassInfo.pDependencies = &dependency;
+    VK_CHECK(vkCreateRenderPass(device, &renderPassInfo, NULL, &pool.renderPass));
+
+    // 6. Shared Pipelines
+    VkShaderModule vertShaderModule, fragShaderModule, computeShaderModule;
+    VK_CHECK(shader_code_create_module(device, &triangleVertShader, &vertShaderModule));
+    VK_CHECK(shader_code_create_module(device, &triangleFragShader, &fragShaderModule));
+    VK_CHECK(shader_code_create_module(device, &checkShader, &computeShaderModule));
+
+    VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = vertShaderModule;
+    shaderStages[0].pName = "main";
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = fragShaderModule;
+    shaderStages[1].pName = "main";
+
+    VkVertexInputBindingDescription bindingDescription = {};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(Vertex);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    VkVertexInputAttributeDescription attributeDescriptions[2] = {};
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    attributeDescriptions[0].offset = offsetof(Vertex, pos);
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    attributeDescriptions[1].offset = offsetof(Vertex, color);
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexAttributeDescriptionCount = 2;
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkViewport viewport = { 0.0f, 0.0f, (float)IMAGE_WIDTH, (float)IMAGE_HEIGHT, 0.0f, 1.0f };
+    VkRect2D scissor = { { 0, 0 }, { IMAGE_WIDTH, IMAGE_HEIGHT } };
+
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.pViewports = &viewport;
+    viewportState.scissorCount = 1;
+    viewportState.pScissors = &scissor;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer = {};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending = {};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.size = sizeof(PushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &pool.graphicsPipelineLayout));
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.layout = pool.graphicsPipelineLayout;
+    pipelineInfo.renderPass = pool.renderPass;
+
+    PipelineJob graphicsJob;
+    pipeline_cache_queue_graphics(&pipelineCache, &graphicsJob, "triangle", &pipelineInfo);
+
+    // check.comp: the context's image and result buffer, and the push constants
+    VkDescriptorSetLayoutBinding bindings[2] = {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = 2;
+    setLayoutInfo.pBindings = bindings;
+
+    VkDescriptorSetLayout computeSetLayout;
+    VK_CHECK(vkCreateDescriptorSetLayout(device, &setLayoutInfo, NULL, &computeSetLayout));
+
+    VkPushConstantRange computePushConstantRange = {};
+    computePushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    computePushConstantRange.size = sizeof(PushConstants);
+
+    VkPipelineLayoutCreateInfo computePipelineLayoutInfo = {};
+    computePipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    computePipelineLayoutInfo.setLayoutCount = 1;
+    computePipelineLayoutInfo.pSetLayouts = &computeSetLayout;
+    computePipelineLayoutInfo.pushConstantRangeCount = 1;
+    computePipelineLayoutInfo.pPushConstantRanges = &computePushConstantRange;
+    VK_CHECK(vkCreatePipelineLayout(device, &computePipelineLayoutInfo, NULL, &pool.computePipelineLayout));
+
+    VkComputePipelineCreateInfo computePipelineInfo = {};
+    computePipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computePipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computePipelineInfo.stage.module = computeShaderModule;
+    computePipelineInfo.stage.pName = "main";
+    computePipelineInfo.layout = pool.computePipelineLayout;
+
+    PipelineJob computeJob;
+    pipeline_cache_queue_compute(&pipelineCache, &computeJob, "check", &computePipelineInfo);
+
+    // 7. Render Contexts, created while the pipelines compile
+    VkDescriptorPoolSize poolSizes[2] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[0].descriptorCount = contextCount;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = contextCount;
+
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+    descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolInfo.poolSizeCount = 2;
+    descriptorPoolInfo.pPoolSizes = poolSizes;
+    descriptorPoolInfo.maxSets = contextCount;
+
+    VkDescriptorPool descriptorPool;
+    VK_CHECK(vkCreateDescriptorPool(device, &descriptorPoolInfo, NULL, &descriptorPool));
+
+    pool.contexts = calloc(contextCount, sizeof(RenderContext));
+    if (!pool.contexts) {
+        fprintf(stderr, "Failed to allocate %u render contexts!\n", contextCount);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < contextCount; i++) {
+        RenderContext *context = &pool.contexts[i];
+        context->pool = &pool;
+        context->index = i;
+        context->queue = &queues[i % queueCount];
+
+        // Contiguous ranges, the first jobCount % contextCount get one more.
+        pthread_mutex_init(&context->jobs.lock, NULL);
+        context->jobs.begin = (uint32_t)((uint64_t)jobCount * i / contextCount);
+        context->jobs.end = (uint32_t)((uint64_t)jobCount * (i + 1) / contextCount);
+
+        VkCommandPoolCreateInfo cmdPoolInfo = {};
+        cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+        VK_CHECK(vkCreateCommandPool(device, &cmdPoolInfo, NULL, &context->commandPool));
+
+        VkCommandBufferAllocateInfo allocCmdBufferInfo = {};
+        allocCmdBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocCmdBufferInfo.commandPool = context->commandPool;
+        allocCmdBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocCmdBufferInfo.commandBufferCount = 1;
+        VK_CHECK(vkAllocateCommandBuffers(device, &allocCmdBufferInfo, &context->commandBuffer));
+
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VK_CHECK(vkCreateFence(device, &fenceInfo, NULL, &context->fence));
+
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent.width = IMAGE_WIDTH;
+        imageInfo.extent.height = IMAGE_HEIGHT;
+        imageInfo.extent.depth = 1;
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        VK_CHECK(vkCreateImage(device, &imageInfo, NULL, &context->image));
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, context->image, &memRequirements);
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VK_CHECK(vkAllocateMemory(device, &allocInfo, NULL, &context->imageMemory));
+        VK_CHECK(vkBindImageMemory(device, context->image, context->imageMemory, 0));
+
+        VkImageViewCreateInfo imageViewInfo = {};
+        imageViewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewInfo.image = context->image;
+        imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+        imageViewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageViewInfo.subresourceRange.levelCount = 1;
+        imageViewInfo.subresourceRange.layerCount = 1;
+        VK_CHECK(vkCreateImageView(device, &imageViewInfo, NULL, &context->imageView));
+
+        VkFramebufferCreateInfo framebufferInfo = {};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = pool.renderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.pAttachments = &context->imageView;
+        framebufferInfo.width = IMAGE_WIDTH;
+        framebufferInfo.height = IMAGE_HEIGHT;
+        framebufferInfo.layers = 1;
+        VK_CHECK(vkCreateFramebuffer(device, &framebufferInfo, NULL, &context->framebuffer));
+
+        createMappedBuffer(physicalDevice, device, sizeof(uint32_t) * 4,
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                           &context->resultBuffer, &context->resultBufferMemory, (void **)&context->results);
+        createMappedBuffer(physicalDevice, device, (VkDeviceSize)IMAGE_WIDTH * IMAGE_HEIGHT * 4,
+                           VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                           &context->stagingBuffer, &context->stagingBufferMemory, &context->pixels);
+
+        VkDescriptorSetAllocateInfo setAllocInfo = {};
+        setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        setAllocInfo.descriptorPool = descriptorPool;
+        setAllocInfo.descriptorSetCount = 1;
+        setAllocInfo.pSetLayouts = &computeSetLayout;
+        VK_CHECK(vkAllocateDescriptorSets(device, &setAllocInfo, &context->descriptorSet));
+
+        VkDescriptorImageInfo descImageInfo = {};
+        descImageInfo.imageView = context->imageView;
+        descImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkDescriptorBufferInfo descBufferInfo = {};
+        descBufferInfo.buffer = context->resultBuffer;
+        descBufferInfo.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet writeSets[2] = {};
+        writeSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeSets[0].dstSet = context->descriptorSet;
+        writeSets[0].dstBinding = 0;
+        writeSets[0].descriptorCount = 1;
+        writeSets[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        writeSets[0].pImageInfo = &descImageInfo;
+        writeSets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeSets[1].dstSet = context->descriptorSet;
+        writeSets[1].dstBinding = 1;
+        writeSets[1].descriptorCount = 1;
+        writeSets[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writeSets[1].pBufferInfo = &descBufferInfo;
+        vkUpdateDescriptorSets(device, 2, writeSets, 0, NULL);
+    }
+    printf("%u render contexts created, %u jobs to render.\n", contextCount, jobCount);
+
+    VK_CHECK(pipeline_cache_wait(&pipelineCache, &graphicsJob));
+    VK_CHECK(pipeline_cache_wait(&pipelineCache, &computeJob));
+    pool.graphicsPipeline = graphicsJob.pipeline;
+    pool.computePipeline = computeJob.pipeline;
+
+    // 8. Run: one thread per context until every job is taken
+    double renderStart = nowMs();
+    uint32_t started = 0;
+    for (; started < contextCount; started++) {
+        int err = pthread_create(&pool.contexts[started].thread, NULL, contextThread, &pool.contexts[started]);
+        if (err) {
+            fprintf(stderr, "Failed to start render context thread %u: %s\n", started, strerror(err));
+            break;
+        }
+    }
+    // The contexts that did start steal the jobs of those that did not.
+    for (uint32_t i = 0; i < started; i++)
+        pthread_join(pool.contexts[i].thread, NULL);
+    double renderMs = nowMs() - renderStart;
+    if (started == 0)
+        return -1;
+
+    pipeline_cache_close(&pipelineCache);
+
+    // 9. Report
+    uint32_t jobsDone = 0, jobsStolen = 0, badJobs = 0;
+    uint32_t fewestJobs = UINT32_MAX, mostJobs = 0;
+    uint64_t totals[4] = {};
+    double recordMs = 0.0, queueWaitMs = 0.0, gpuWaitMs = 0.0, writeMs = 0.0;
+    for (uint32_t i = 0; i < started; i++) {
+        RenderContext *context = &pool.contexts[i];
+        jobsDone += context->jobsDone;
+        jobsStolen += context->jobsStolen;
+        badJobs += context->badJobs;
+        if (context->jobsDone < fewestJobs)
+            fewestJobs = context->jobsDone;
+        if (context->jobsDone > mostJobs)
+            mostJobs = context->jobsDone;
+        for (uint32_t j = 0; j < 4; j++)
+            totals[j] += context->totals[j];
+        recordMs += context->recordMs;
+        queueWaitMs += context->queueWaitMs;
+        gpuWaitMs += context->gpuWaitMs;
+        writeMs += context->writeMs;
+    }
+
+    printf("----------------------------------------\n");
+    printf("%u jobs on %u render contexts, %u queue%s%s: %.2f ms total, %.1f jobs/s\n",
+           jobsDone, started, queueCount, queueCount == 1 ? "" : "s",
+           queueCount < started ? " shared under a lock" : "", renderMs, jobsDone * 1000.0 / renderMs);
+    printf("per job: %.3f ms recording, %.3f ms waiting for the queue, %.3f ms on the GPU, %.3f ms writing\n",
+           recordMs / jobsDone, queueWaitMs / jobsDone, gpuWaitMs / jobsDone, writeMs / jobsDone);
+    printf("work stealing: %u of %u jobs stolen, %u to %u jobs per context\n",
+           jobsStolen, jobsDone, fewestJobs, mostJobs);
+    printf("Compute Shader Result over all jobs: triangleCount: %llu backgroundCount: %llu totalCount: %llu test: %llu\n",
+           (unsigned long long)totals[0], (unsigned long long)totals[1],
+           (unsigned long long)totals[2], (unsigned long long)totals[3]);
+    if (badJobs)
+        printf("%u jobs did not run every check invocation exactly once!\n", badJobs);
+    printf("Rendered images saved to output_pool_NNNN.%s\n", image_writer_format_extension(pool.fileFormat));
+
+    // 10. Cleanup
+    for (uint32_t i = 0; i < contextCount; i++) {
+        RenderContext *context = &pool.contexts[i];
+        vkDestroyBuffer(device, context->stagingBuffer, NULL);
+        vkFreeMemory(device, context->stagingBufferMemory, NULL);
+        vkDestroyBuffer(device, context->resultBuffer, NULL);
+        vkFreeMemory(device, context->resultBufferMemory, NULL);
+        vkDestroyFramebuffer(device, context->framebuffer, NULL);
+        vkDestroyImageView(device, context->imageView, NULL);
+        vkDestroyImage(device, context->image, NULL);
+        vkFreeMemory(device, context->imageMemory, NULL);
+        vkDestroyFence(device, context->fence, NULL);
+        vkDestroyCommandPool(device, context->commandPool, NULL);
+        pthread_mutex_destroy(&context->jobs.lock);
+    }
+    free(pool.contexts);
+    for (uint32_t i = 0; i < queueCount; i++)
+        pthread_mutex_destroy(&queues[i].lock);
+
+    vkDestroyDescriptorPool(device, descriptorPool, NULL);
+    vkDestroyPipeline(device, pool.computePipeline, NULL);
+    vkDestroyPipeline(device, pool.graphicsPipeline, NULL);
+    vkDestroyPipelineLayout(device, pool.computePipelineLayout, NULL);
+    vkDestroyPipelineLayout(device, pool.graphicsPipelineLayout, NULL);
+    vkDestroyDescriptorSetLayout(device, computeSetLayout, NULL);
+    vkDestroyShaderModule(device, computeShaderModule, NULL);
+    vkDestroyShaderModule(device, fragShaderModule, NULL);
+    vkDestroyShaderModule(device, vertShaderModule, NULL);
+    vkDestroyRenderPass(device, pool.renderPass, NULL);
+    vkDestroyBuffer(device, pool.vertexBuffer, NULL);
+    vkFreeMemory(device, vertexBufferMemory, NULL);
+    vkDestroyDevice(device, NULL);
+    vkDestroyInstance(instance, NULL);
+
+    return badJobs ? 1 : 0;
+}
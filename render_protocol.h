@@ -0,0 +1,137 @@
+#ifndef RENDER_PROTOCOL_H
+#define RENDER_PROTOCOL_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Wire format between `main.bin --serve <socket>` and render_client. Both ends
+// live on the same machine, so the structs travel as they are, in host byte
+// order, over a SOCK_STREAM Unix-domain socket. Every request gets exactly
+// one response, in order.
+#define RENDER_PROTOCOL_MAGIC 0x31524452u // "RDR1"
+
+typedef enum RenderOutput {
+    RENDER_OUTPUT_NONE,  // only the check.comp counts come back
+    RENDER_OUTPUT_FILE,  // written to path in the server's IMAGE_FORMAT
+    RENDER_OUTPUT_SHM,   // raw pixels copied into a memfd sent with the request
+    RENDER_SHUTDOWN,     // stop the server once the frames in flight are done
+} RenderOutput;
+
+typedef struct RenderRequest {
+    uint32_t magic;
+    uint32_t output;         // RenderOutput
+    uint32_t width;          // 0, or the server's image size
+    uint32_t height;
+    float vertex_offset[4];
+    float color_offset[4];
+    float color[4];
+    uint32_t test;
+    uint32_t pad;
+    char path[256];          // RENDER_OUTPUT_FILE
+} RenderRequest;
+
+typedef struct RenderResponse {
+    int32_t status;          // 0, or a negative errno
+    uint32_t width;          // size of the server's image
+    uint32_t height;
+    uint32_t channels;       // bytes per pixel copied into the memfd
+    uint32_t counts[4];      // triangle, background, total, test
+} RenderResponse;
+
+// Send size bytes, with fd attached as SCM_RIGHTS when it is not -1.
+// Returns 0 on success, -1 with errno set otherwise. A peer that went away
+// shows up as EPIPE instead of a signal.
+static inline int
+render_send(int sock, const void *buf, size_t size, int fd)
+{
+    const char *p = buf;
+
+    while (size) {
+        struct iovec iov = { (void *)p, size };
+        union {
+            struct cmsghdr header;
+            char data[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        if (fd >= 0) {
+            memset(&control, 0, sizeof(control));
+            msg.msg_control = control.data;
+            msg.msg_controllen = sizeof(control.data);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        }
+
+        ssize_t ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        fd = -1; // the descriptor rides along with the first byte only
+        p += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+// Receive exactly size bytes. A descriptor sent along is stored in *fd,
+// which is left alone otherwise (fd may be NULL if none is expected).
+// Returns 1 on success, 0 if the peer closed the connection before the
+// first byte, -1 with errno set otherwise.
+static inline int
+render_recv(int sock, void *buf, size_t size, int *fd)
+{
+    char *p = buf;
+    size_t received = 0;
+
+    while (received < size) {
+        struct iovec iov = { p + received, size - received };
+        union {
+            struct cmsghdr header;
+            char data[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data;
+        msg.msg_controllen = sizeof(control.data);
+
+        ssize_t ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (ret == 0) {
+            if (received == 0)
+                return 0;
+            errno = ECONNRESET;
+            return -1;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                int passed;
+                memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+                if (fd)
+                    *fd = passed;
+                else
+                    close(passed);
+            }
+        }
+        received += ret;
+    }
+    return 1;
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include "shader_code.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SPIRV_MAGIC 0x07230203u
+
+// Map dir/name read-only. Returns the mapping, NULL with a message printed
+// when the file is missing or does not look like SPIR-V.
+static void *
+map_override(const char *dir, const char *name, size_t *size)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    void *code;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s, using the embedded %s\n", path, strerror(errno), name);
+        return NULL;
+    }
+    if (fstat(fd, &st)) {
+        fprintf(stderr, "Failed to stat %s: %s, using the embedded %s\n", path, strerror(errno), name);
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size < 4 || st.st_size % 4) {
+        fprintf(stderr, "%s is not SPIR-V (%lld bytes), using the embedded %s\n", path, (long long)st.st_size, name);
+        close(fd);
+        return NULL;
+    }
+
+    code = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (code == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s, using the embedded %s\n", path, strerror(errno), name);
+        return NULL;
+    }
+    if (*(const uint32_t *)code != SPIRV_MAGIC) {
+        fprintf(stderr, "%s is not SPIR-V, using the embedded %s\n", path, name);
+        munmap(code, st.st_size);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return code;
+}
+
+VkResult
+shader_code_create_module(VkDevice device, const ShaderCode *shader, VkShaderModule *module)
+{
+    const char *dir = getenv("SHADER_DIR");
+    void *mapped = NULL;
+    size_t mapped_size = 0;
+
+    VkShaderModuleCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    info.codeSize = shader->size;
+    info.pCode = shader->code;
+
+    if (dir && *dir && (mapped = map_override(dir, shader->name, &mapped_size))) {
+        info.codeSize = mapped_size;
+        info.pCode = mapped;
+    }
+
+    // The driver copies the code, the mapping is not needed afterwards.
+    VkResult result = vkCreateShaderModule(device, &info, NULL, module);
+    if (mapped)
+        munmap(mapped, mapped_size);
+    return result;
+}
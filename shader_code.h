@@ -0,0 +1,25 @@
+#ifndef SHADER_CODE_H
+#define SHADER_CODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// SPIR-V compiled into the binary. The build scripts turn every shader into
+// a header holding a uint32_t array (glslangValidator --vn, glslc -mfmt=c),
+// so a run reads no shader files and cannot miss one.
+typedef struct ShaderCode {
+    const char *name;     // the .spv file it was built as, for the override
+    const uint32_t *code;
+    size_t size;          // in bytes
+} ShaderCode;
+
+#define SHADER_CODE(name, array) { (name), (array), sizeof(array) }
+
+// Create a shader module from the embedded code. During shader development
+// SHADER_DIR=<dir> maps <dir>/<name> with mmap() instead, so a rebuilt .spv
+// is picked up without relinking; a file that cannot be used is reported and
+// the embedded copy is taken.
+VkResult shader_code_create_module(VkDevice device, const ShaderCode *shader, VkShaderModule *module);
+
+#endif
@@ -1,4 +1,5 @@
 glslc shader.comp -o comp.spv
-gcc -o spill_fill.bin spill_fill.c -lvulkan
+glslc -mfmt=c shader.comp -o comp.spv.h
+gcc -o spill_fill.bin spill_fill.c ../pipeline_cache.c ../shader_code.c -lvulkan -pthread
 
 
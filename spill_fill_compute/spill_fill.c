@@ -3,6 +3,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../pipeline_cache.h"
+#include "../shader_code.h"
+
+// The SPIR-V, compiled in by build.sh (glslc -mfmt=c)
+static const uint32_t spvCode[] =
+#include "comp.spv.h"
+;
+static const ShaderCode shader = SHADER_CODE("comp.spv", spvCode);
+
 #define CHECK_VK(res) if(res != VK_SUCCESS) { printf("Error at line %d: %d\n", __LINE__, res); exit(1); }
 
 struct buffer_data {
@@ -24,21 +33,7 @@ uint32_t findMemoryType(VkPhysicalDeviceMemoryProperties memProps, uint32_t type
 }
 
 int main() {
-    // 1. Load the compiled SPIR-V binary from disk
-    FILE *f = fopen("comp.spv", "rb");
-    if (!f) {
-        printf("[ERROR] Could not open comp.spv. Did you compile the compute shader?\n");
-        printf("Run: glslangValidator -V shader.comp -o comp.spv\n");
-        return 1;
-    }
-    fseek(f, 0, SEEK_END);
-    long spv_size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    uint32_t *spv_code = malloc(spv_size);
-    fread(spv_code, 1, spv_size, f);
-    fclose(f);
-
-    // 2. Initialize Vulkan Instance and Device
+    // 1. Initialize Vulkan Instance and Device
     VkInstance instance;
     VkApplicationInfo appInfo = { VK_STRUCTURE_TYPE_APPLICATION_INFO, NULL, "SpillTestCompute", 1, "NoEngine", 1, VK_API_VERSION_1_0 };
     VkInstanceCreateInfo instInfo = { VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO, NULL, 0, &appInfo, 0, NULL, 0, NULL };
@@ -52,14 +47,22 @@ int main() {
     float queuePriority = 1.0f;
     VkDeviceQueueCreateInfo queueInfo = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO, NULL, 0, queueFamilyIndex, 1, &queuePriority };
     
+    // Per-pipeline compile times and cache hits in the report.
+    const char *feedbackExtension = pipeline_cache_feedback_extension(physicalDevice);
+
     VkDevice device;
-    VkDeviceCreateInfo deviceInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO, NULL, 0, 1, &queueInfo, 0, NULL, 0, NULL, NULL };
+    VkDeviceCreateInfo deviceInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO, NULL, 0, 1, &queueInfo, 0, NULL,
+                                      feedbackExtension ? 1 : 0, &feedbackExtension, NULL };
     CHECK_VK(vkCreateDevice(physicalDevice, &deviceInfo, NULL, &device));
 
+    // Pipelines compiled by an earlier run come out of the cache file.
+    PipelineCache pipelineCache;
+    CHECK_VK(pipeline_cache_open(&pipelineCache, physicalDevice, device, "spill_fill_compute", feedbackExtension != NULL));
+
     VkQueue queue;
     vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
 
-    // 3. Setup SSBO Buffer
+    // 2. Setup SSBO Buffer
     VkBuffer buffer;
     VkBufferCreateInfo bufInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, NULL, 0, sizeof(struct buffer_data), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_SHARING_MODE_EXCLUSIVE, 0, NULL };
     CHECK_VK(vkCreateBuffer(device, &bufInfo, NULL, &buffer));
@@ -87,11 +90,9 @@ int main() {
     memcpy(data, &const_buffer_data, sizeof(struct buffer_data));
     vkUnmapMemory(device, memory);
 
-    // 4. Create Compute Pipeline & Descriptors
-    VkShaderModuleCreateInfo smInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO, NULL, 0, spv_size, spv_code };
+    // 3. Create Compute Pipeline & Descriptors
     VkShaderModule shaderModule;
-    CHECK_VK(vkCreateShaderModule(device, &smInfo, NULL, &shaderModule));
-    free(spv_code);
+    CHECK_VK(shader_code_create_module(device, &shader, &shaderModule));
 
     // Note the stage flag is now VK_SHADER_STAGE_COMPUTE_BIT
     VkDescriptorSetLayoutBinding binding = { 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, NULL };
@@ -129,9 +130,10 @@ int main() {
         -1
     };
     VkPipeline pipeline;
-    CHECK_VK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline));
+    CHECK_VK(pipeline_cache_create_compute(&pipelineCache, "spill_fill_compute", &pipelineInfo, &pipeline));
+    pipeline_cache_close(&pipelineCache);
 
-    // 5. Record and Submit Commands
+    // 4. Record and Submit Commands
     VkCommandPoolCreateInfo poolCreateInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, NULL, 0, queueFamilyIndex };
     VkCommandPool commandPool;
     CHECK_VK(vkCreateCommandPool(device, &poolCreateInfo, NULL, &commandPool));
@@ -158,7 +160,7 @@ int main() {
     vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
     vkQueueWaitIdle(queue);
 
-    // 6. Verify Results
+    // 5. Verify Results
     struct buffer_data* data_out;
     vkMapMemory(device, memory, 0, sizeof(struct buffer_data), 0, (void**)&data_out);
 
@@ -1,3 +1,4 @@
 glslc shader.vert -o vert.spv
-gcc -o spill_fill.bin spill_fill.c -lvulkan
+glslc -mfmt=c shader.vert -o vert.spv.h
+gcc -o spill_fill.bin spill_fill.c ../pipeline_cache.c ../shader_code.c -lvulkan -pthread
 
@@ -0,0 +1,79 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Single-producer/single-consumer ring of pointers.
+//
+// push/pop themselves are lock-free: the producer only ever stores tail and
+// the consumer only ever stores head, each on its own cache line. A counting
+// semaphore lets the consumer sleep instead of spinning while the ring is
+// empty.
+typedef struct SpscQueue {
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    _Alignas(64) size_t mask;
+    void **items;
+    sem_t available;
+} SpscQueue;
+
+// capacity is rounded up to a power of two.
+static inline int
+spsc_queue_init(SpscQueue *queue, size_t capacity)
+{
+    size_t size = 1;
+
+    while (size < capacity)
+        size <<= 1;
+
+    queue->items = calloc(size, sizeof(void *));
+    if (!queue->items)
+        return -1;
+
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->mask = size - 1;
+    return sem_init(&queue->available, 0, 0);
+}
+
+static inline void
+spsc_queue_destroy(SpscQueue *queue)
+{
+    sem_destroy(&queue->available);
+    free(queue->items);
+}
+
+// Producer side. Returns false when the ring is full.
+static inline bool
+spsc_queue_push(SpscQueue *queue, void *item)
+{
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    if (tail - head > queue->mask)
+        return false;
+
+    queue->items[tail & queue->mask] = item;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    sem_post(&queue->available);
+    return true;
+}
+
+// Consumer side. Blocks until an item is available.
+static inline void *
+spsc_queue_pop(SpscQueue *queue)
+{
+    while (sem_wait(&queue->available) && errno == EINTR)
+        ;
+
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    void *item = queue->items[head & queue->mask];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return item;
+}
+
+#endif
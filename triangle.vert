@@ -8,17 +8,26 @@ layout(location = 1) in vec4 inColor;
 // Output to the fragment shader
 layout(location = 0) out vec4 outColor;
 
+#ifdef PARAMS_UBO
+// The same block as a uniform buffer the host rewrites every frame, so the
+// command buffer can be recorded once (PRERECORDED in main.c)
+layout(set = 0, binding = 0, std140) uniform FrameParams {
+#else
 // Push constant block with separate offsets
 layout(push_constant) uniform PushConstants {
+#endif
     vec4 positions[3];
     vec4 color;
     vec4 vertex_offset;
     vec4 color_offset;
     uint test;
     uint use_buffer;
+    vec4 tile_transform; // xy scale, zw offset of clip space for tiled rendering
 } push_consts;
 
 void main() {
     outColor = inColor;
-    gl_Position = inPosition;
+    gl_Position = vec4(inPosition.xy * push_consts.tile_transform.xy +
+                       push_consts.tile_transform.zw * inPosition.w,
+                       inPosition.zw);
 }
\ No newline at end of file